@@ -5,6 +5,7 @@
 #include <math.h>
 
 #include "ComputePowerSpectrum.h"
+#include "fft_plans.h"
 #include "meraxes.h"
 #include "misc_tools.h"
 
@@ -114,15 +115,9 @@ void Compute_PS(int snapshot) // Adding the 21cm PS if only Pop II are present!
     }
   }
 
-  fftwf_plan plan = fftwf_mpi_plan_dft_r2c_3d(
-    ReionGridDim, ReionGridDim, ReionGridDim, (float*)deldel_ps, deldel_ps, run_globals.mpi_comm, FFTW_ESTIMATE);
-  fftwf_execute(plan);
-  fftwf_destroy_plan(plan);
+  fft_execute_r2c_3d(ReionGridDim, ReionGridDim, ReionGridDim, (float*)deldel_ps, deldel_ps);
 #if USE_MINI_HALOS
-  fftwf_plan planII = fftwf_mpi_plan_dft_r2c_3d(
-    ReionGridDim, ReionGridDim, ReionGridDim, (float*)deldel_psII, deldel_psII, run_globals.mpi_comm, FFTW_ESTIMATE);
-  fftwf_execute(planII);
-  fftwf_destroy_plan(planII);
+  fft_execute_r2c_3d(ReionGridDim, ReionGridDim, ReionGridDim, (float*)deldel_psII, deldel_psII);
 #endif
 
   // Calculate power spectrum
@@ -5,6 +5,7 @@
 
 #include "ComputeTs.h"
 #include "XRayHeatingFunctions.h"
+#include "cosmology.h"
 #include "find_HII_bubbles.h"
 #include "meraxes.h"
 #include "misc_tools.h"
@@ -663,8 +664,8 @@ void _ComputeTs(int snapshot)
       }
     }
 
-    growth_factor_zp = dicke(zp);
-    dgrowth_factor_dzp = ddicke_dz(zp);
+    growth_factor_zp = growth_factor(zp);
+    dgrowth_factor_dzp = growth_factor_dz(zp);
     dt_dzp = dtdz((float)zp);
 
     // Below is the converstion of the soft-band X_ray luminosity into number of X-ray photons produced. This is the
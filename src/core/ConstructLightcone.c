@@ -1,5 +1,5 @@
 #include "ConstructLightcone.h"
-#include "XRayHeatingFunctions.h"
+#include "cosmology.h"
 #include "meraxes.h"
 #include "misc_tools.h"
 #include <string.h>
@@ -7,8 +7,18 @@
 /*
  * This code is a re-write of the light-cone (cuboid) construction from 21cmFAST.
  * Modified for usage within Meraxes by Bradley Greig.
+ *
+ * The light-cone is made up of slices which are one cell apart in comoving distance, starting from the redshift of
+ * EndSnapshotLightcone.
  */
 
+//! The index of the first light-cone slice at or beyond redshift z
+static long long lightcone_slice_index(double z, double r_start, double dR)
+{
+  double r = comoving_distance_to(z) - r_start;
+  return (r > 0) ? (long long)ceil(r / dR) : 0;
+}
+
 void Initialise_ConstructLightcone()
 {
   int i;
@@ -19,15 +29,11 @@ void Initialise_ConstructLightcone()
 
   double dR = (box_size / (double)ReionGridDim) * MPC; // cell size in comoving cm
 
-  double z1_LC, z2_LC, z_LC;
-  double start_redshift = run_globals.ZZ[0];
-
   // Initialise some required tracking variables
   run_globals.params.LightconeLength = 0;
   run_globals.params.EndSnapshotLightcone = 0;
   run_globals.params.CurrentLCPos = 0;
 
-  long long total_slice_i = 0;
   i = 0;
 
   // Find the first snapshot beyond the user provided beginning of the light-cone (defined from the lowest redshift)
@@ -44,26 +50,11 @@ void Initialise_ConstructLightcone()
 
   mlog("final snapshot for light-cone = %d", MLOG_MESG, closest_snapshot);
 
-  // End of the light-cone, i.e. low redshift part
-  z1_LC = z_LC = run_globals.ZZ[closest_snapshot];
-
-  i = 0;
-  // Below incrementes backwards to match 21cmFAST
-  while (z1_LC < start_redshift) {
-
-    z2_LC = run_globals.ZZ[closest_snapshot - 1 - i];
-
-    while (z_LC < z2_LC) {
-
-      total_slice_i++;
-      z_LC -= dR / drdz((float)z_LC);
-    }
-    z1_LC = z2_LC;
-    i += 1;
-  }
+  // The light-cone extends from the final snapshot out to the first one
+  double r_start = comoving_distance_to(run_globals.ZZ[closest_snapshot]);
 
   // Store the length of the light-cone to be able to allocate the array to hold the light-cone
-  run_globals.params.LightconeLength = total_slice_i;
+  run_globals.params.LightconeLength = lightcone_slice_index(run_globals.ZZ[0], r_start, dR);
   run_globals.params.EndSnapshotLightcone = closest_snapshot;
 }
 
@@ -83,41 +74,27 @@ void ConstructLightcone(int snapshot)
   double box_size = run_globals.params.BoxSize / run_globals.params.Hubble_h; // Mpc
   double dR = (box_size / (double)ReionGridDim) * MPC;                        // cell size in comoving cm
 
-  double z_LC, z1_LC, z2_LC, t_z1_LC, t_z2_LC, z_slice, t_z_slice, fz1, fz2;
+  double z1_LC, z2_LC, t_z1_LC, t_z2_LC, z_slice, t_z_slice, fz1, fz2;
 
   long long slice_ct = 0;
   long long slice_ct_snapshot = 0;
 
-  int i_real, i_real_LC, closest_snapshot;
+  int i_real, i_real_LC;
 
   if (snapshot > 0) {
 
     // Set the redshift (and time) for the upper redshift end of the light-cone
     z2_LC = run_globals.ZZ[snapshot - 1];
-    t_z2_LC = gettime(z2_LC);
+    t_z2_LC = cosmic_time(z2_LC);
 
     // Set the redshift (and time) for the lower redshift end of the light-cone
-    z1_LC = z_LC = run_globals.ZZ[snapshot];
-    t_z1_LC = gettime(z1_LC);
+    z1_LC = run_globals.ZZ[snapshot];
+    t_z1_LC = cosmic_time(z1_LC);
 
-    // Repeat some of the light-cone initialisation just to avoid passing things around
-
-    // Set the lowest redshift snapshot
-    closest_snapshot = run_globals.params.EndSnapshotLightcone;
-
-    z_LC = run_globals.ZZ[closest_snapshot];
-
-    // Loop through to find the size of lightcone added at this time step (solely used for indexing the light-cone
-    // properly across snapshots)
-    while (z_LC < z2_LC) {
-
-      if (z_LC >= run_globals.ZZ[snapshot] && z_LC < run_globals.ZZ[snapshot - 1]) {
-        slice_ct_snapshot++;
-      }
-      z_LC -= dR / drdz((float)z_LC);
-    }
-
-    z_LC = run_globals.ZZ[closest_snapshot];
+    // The slices added at this time step are those with z1_LC <= z < z2_LC
+    double r_start = comoving_distance_to(run_globals.ZZ[run_globals.params.EndSnapshotLightcone]);
+    long long first_slice = lightcone_slice_index(z1_LC, r_start, dR);
+    slice_ct_snapshot = lightcone_slice_index(z2_LC, r_start, dR) - first_slice;
 
     // Determine the starting indexes for this co-eval snapshot of the light-cone (incrementing from lower to upper
     // redshifts)
@@ -126,36 +103,32 @@ void ConstructLightcone(int snapshot)
     iz = (int)(slice_ct % ReionGridDim);
 
     // Now do the interpolation of the light-cone
-    while (z_LC < z2_LC) {
+    for (long long i_slice = first_slice; i_slice < first_slice + slice_ct_snapshot; i_slice++) {
+      z_slice = redshift_at_comoving_distance(r_start + (double)i_slice * dR);
+      t_z_slice = cosmic_time(z_slice);
 
-      if (z_LC >= run_globals.ZZ[snapshot] && z_LC < run_globals.ZZ[snapshot - 1]) {
-        z_slice = z_LC;
-        t_z_slice = gettime(z_slice);
+      Lightcone_redshifts[slice_ct] = (float)z_slice;
 
-        Lightcone_redshifts[slice_ct] = (float)z_slice;
+      // Ensure we don't overstep the gridsize of the co-eval box
+      if (iz >= ReionGridDim) {
+        iz = 0;
+      }
 
-        // Ensure we don't overstep the gridsize of the co-eval box
-        if (iz >= ReionGridDim) {
-          iz = 0;
-        }
+      for (int ii = 0; ii < local_nix; ii++) {
+        for (int jj = 0; jj < ReionGridDim; jj++) {
+          i_real_LC = grid_index_LC(ii, jj, (int)slice_ct, ReionGridDim, (int)run_globals.params.LightconeLength);
+          i_real = grid_index(ii, jj, iz, ReionGridDim, INDEX_REAL);
 
-        for (int ii = 0; ii < local_nix; ii++) {
-          for (int jj = 0; jj < ReionGridDim; jj++) {
-            i_real_LC = grid_index_LC(ii, jj, (int)slice_ct, ReionGridDim, (int)run_globals.params.LightconeLength);
-            i_real = grid_index(ii, jj, iz, ReionGridDim, INDEX_REAL);
-
-            fz1 = delta_T[i_real];
-            fz2 = delta_T_prev[i_real];
-            run_globals.reion_grids.LightconeBox[i_real_LC] =
-              (float)((fz2 - fz1) / (t_z2_LC - t_z1_LC) * (t_z_slice - t_z1_LC) +
-                      fz1); // linearly interpolate in z (time actually)
-          }
+          fz1 = delta_T[i_real];
+          fz2 = delta_T_prev[i_real];
+          run_globals.reion_grids.LightconeBox[i_real_LC] =
+            (float)((fz2 - fz1) / (t_z2_LC - t_z1_LC) * (t_z_slice - t_z1_LC) +
+                    fz1); // linearly interpolate in z (time actually)
         }
-
-        iz++;
-        slice_ct++;
       }
-      z_LC -= dR / drdz((float)z_LC);
+
+      iz++;
+      slice_ct++;
     }
   } else {
     // Used to correctly index the starting point of the co-eval boxes for the light-cone
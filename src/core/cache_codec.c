@@ -0,0 +1,318 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache_codec.h"
+#include "meraxes.h"
+
+/*
+ * A small, dependency free codec for the in-memory snapshot caches used in interactive / MCMC mode.
+ *
+ * Each block is byte shuffled (so that byte n of every element is stored contiguously), delta encoded byte-by-byte
+ * and then compressed with a simple LZ77 scheme (LZ4-like sequences of literals and matches with 16 bit offsets).
+ * Shuffling an array of structs turns it into columns of similar bytes, which is where almost all of the gain comes
+ * from.
+ *
+ * Floats may optionally be quantised to a fixed absolute tolerance first, in which case the differences between
+ * neighbouring quantised values are stored.
+ */
+
+#define LZ_HASH_BITS 16
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+typedef struct cache_block_header_t
+{
+  uint64_t n_bytes;    //!< uncompressed size
+  uint64_t n_stored;   //!< size of the payload following this header
+  uint32_t elem_size;  //!< shuffle stride
+  uint32_t compressed; //!< 0 if the payload is the shuffled data itself
+  double step;         //!< quantisation step of float blocks (0 if lossless)
+} cache_block_header_t;
+
+static inline uint32_t read_u32(const uint8_t* ptr)
+{
+  uint32_t val;
+  memcpy(&val, ptr, sizeof(uint32_t));
+  return val;
+}
+
+static inline uint32_t lz_hash(uint32_t val)
+{
+  return (val * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t* lz_write_length(uint8_t* op, size_t len)
+{
+  while (len >= 255) {
+    *op++ = 255;
+    len -= 255;
+  }
+  *op++ = (uint8_t)len;
+  return op;
+}
+
+static uint8_t* lz_write_sequence(uint8_t* op,
+                                  const uint8_t* literals,
+                                  size_t n_literals,
+                                  size_t offset,
+                                  size_t match_len)
+{
+  size_t match_code = (match_len > 0) ? match_len - LZ_MIN_MATCH : 0;
+  uint8_t* token = op++;
+
+  *token = (uint8_t)(((n_literals < 15 ? n_literals : 15) << 4) | (match_code < 15 ? match_code : 15));
+  if (n_literals >= 15)
+    op = lz_write_length(op, n_literals - 15);
+  memcpy(op, literals, n_literals);
+  op += n_literals;
+
+  if (match_len > 0) {
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    if (match_code >= 15)
+      op = lz_write_length(op, match_code - 15);
+  }
+
+  return op;
+}
+
+static size_t lz_bound(size_t n_bytes)
+{
+  return n_bytes + n_bytes / 255 + 16;
+}
+
+static size_t lz_compress(const uint8_t* in, size_t n_bytes, uint8_t* out)
+{
+  // N.B. positions are 64 bit so that blocks larger than 2 GB (e.g. the slabs of large grids) can be compressed
+  int64_t* table = malloc(sizeof(int64_t) * (1 << LZ_HASH_BITS));
+  uint8_t* op = out;
+  size_t anchor = 0;
+  size_t ip = 0;
+
+  for (int ii = 0; ii < (1 << LZ_HASH_BITS); ii++)
+    table[ii] = -1;
+
+  while (ip + LZ_MIN_MATCH <= n_bytes) {
+    uint32_t seq = read_u32(in + ip);
+    uint32_t hash = lz_hash(seq);
+    int64_t candidate = table[hash];
+    table[hash] = (int64_t)ip;
+
+    if ((candidate >= 0) && (ip - (size_t)candidate <= LZ_MAX_OFFSET) && (read_u32(in + candidate) == seq)) {
+      size_t match_len = LZ_MIN_MATCH;
+      while ((ip + match_len < n_bytes) && (in[candidate + match_len] == in[ip + match_len]))
+        match_len++;
+
+      op = lz_write_sequence(op, in + anchor, ip - anchor, ip - (size_t)candidate, match_len);
+      ip += match_len;
+      anchor = ip;
+    } else
+      // skip through incompressible data faster
+      ip += 1 + ((ip - anchor) >> 6);
+  }
+
+  // the final sequence is literals only
+  op = lz_write_sequence(op, in + anchor, n_bytes - anchor, 0, 0);
+
+  free(table);
+  return (size_t)(op - out);
+}
+
+static void lz_decompress(const uint8_t* in, size_t n_in, uint8_t* out, size_t n_out)
+{
+  const uint8_t* ip = in;
+  const uint8_t* iend = in + n_in;
+  uint8_t* op = out;
+
+  while (ip < iend) {
+    uint8_t token = *ip++;
+
+    size_t n_literals = token >> 4;
+    if (n_literals == 15) {
+      uint8_t byte;
+      do {
+        byte = *ip++;
+        n_literals += byte;
+      } while (byte == 255);
+    }
+    memcpy(op, ip, n_literals);
+    op += n_literals;
+    ip += n_literals;
+
+    if (ip >= iend)
+      break;
+
+    size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+
+    size_t match_len = token & 0x0f;
+    if (match_len == 15) {
+      uint8_t byte;
+      do {
+        byte = *ip++;
+        match_len += byte;
+      } while (byte == 255);
+    }
+    match_len += LZ_MIN_MATCH;
+
+    // matches may overlap the bytes they produce
+    const uint8_t* match = op - offset;
+    for (size_t ii = 0; ii < match_len; ii++)
+      op[ii] = match[ii];
+    op += match_len;
+  }
+
+  if ((size_t)(op - out) != n_out) {
+    mlog_error("Corrupt cache block (decoded %zu of %zu bytes)!", (size_t)(op - out), n_out);
+    ABORT(EXIT_FAILURE);
+  }
+}
+
+static void shuffle_and_delta(const uint8_t* in, uint8_t* out, size_t n_bytes, size_t elem_size)
+{
+  size_t n_elem = n_bytes / elem_size;
+  uint8_t* op = out;
+
+  for (size_t i_byte = 0; i_byte < elem_size; i_byte++) {
+    const uint8_t* ip = in + i_byte;
+    for (size_t ii = 0; ii < n_elem; ii++, ip += elem_size)
+      *op++ = *ip;
+  }
+  memcpy(op, in + n_elem * elem_size, n_bytes - n_elem * elem_size);
+
+  for (size_t ii = n_bytes - 1; ii > 0; ii--)
+    out[ii] = (uint8_t)(out[ii] - out[ii - 1]);
+}
+
+static void undelta_and_unshuffle(uint8_t* in, uint8_t* out, size_t n_bytes, size_t elem_size)
+{
+  size_t n_elem = n_bytes / elem_size;
+  const uint8_t* ip = in;
+
+  for (size_t ii = 1; ii < n_bytes; ii++)
+    in[ii] = (uint8_t)(in[ii] + in[ii - 1]);
+
+  for (size_t i_byte = 0; i_byte < elem_size; i_byte++) {
+    uint8_t* op = out + i_byte;
+    for (size_t ii = 0; ii < n_elem; ii++, op += elem_size)
+      *op = *ip++;
+  }
+  memcpy(out + n_elem * elem_size, ip, n_bytes - n_elem * elem_size);
+}
+
+static size_t compress_block(const void* src, size_t n_bytes, size_t elem_size, double step, void** dest)
+{
+  uint8_t* shuffled = malloc(n_bytes > 0 ? n_bytes : 1);
+  uint8_t* block = malloc(sizeof(cache_block_header_t) + lz_bound(n_bytes));
+  cache_block_header_t header = { n_bytes, 0, (uint32_t)elem_size, 1, step };
+
+  if (n_bytes > 0)
+    shuffle_and_delta(src, shuffled, n_bytes, elem_size);
+
+  header.n_stored = lz_compress(shuffled, n_bytes, block + sizeof(cache_block_header_t));
+  if (header.n_stored >= n_bytes) {
+    // don't bother if the data are incompressible
+    header.compressed = 0;
+    header.n_stored = n_bytes;
+    memcpy(block + sizeof(cache_block_header_t), shuffled, n_bytes);
+  }
+  memcpy(block, &header, sizeof(cache_block_header_t));
+  free(shuffled);
+
+  size_t block_size = sizeof(cache_block_header_t) + header.n_stored;
+  *dest = realloc(block, block_size);
+
+  return block_size;
+}
+
+static double decompress_block(const void* src, void* dest, size_t n_bytes)
+{
+  const uint8_t* block = src;
+  cache_block_header_t header;
+
+  memcpy(&header, block, sizeof(cache_block_header_t));
+  assert(header.n_bytes == n_bytes);
+
+  uint8_t* shuffled = malloc(n_bytes > 0 ? n_bytes : 1);
+  if (header.compressed)
+    lz_decompress(block + sizeof(cache_block_header_t), header.n_stored, shuffled, n_bytes);
+  else
+    memcpy(shuffled, block + sizeof(cache_block_header_t), n_bytes);
+
+  if (n_bytes > 0)
+    undelta_and_unshuffle(shuffled, dest, n_bytes, header.elem_size);
+  free(shuffled);
+
+  return header.step;
+}
+
+//! Compress n_bytes of an array of elem_size byte elements into a newly allocated block and return its size
+size_t compress_cache_block(const void* src, size_t n_bytes, size_t elem_size, void** dest)
+{
+  return compress_block(src, n_bytes, elem_size, 0.0, dest);
+}
+
+void decompress_cache_block(const void* src, void* dest, size_t n_bytes)
+{
+  decompress_block(src, dest, n_bytes);
+}
+
+//! Compress an array of floats, allowing an absolute error of up to tolerance (0 for lossless)
+size_t compress_cache_floats(const float* src, size_t n_floats, double tolerance, void** dest)
+{
+  if (tolerance <= 0)
+    return compress_block(src, sizeof(float) * n_floats, sizeof(float), 0.0, dest);
+
+  // Quantise to the nearest multiple of the step and store the (zig-zag encoded) difference from the previous value.
+  // The step is a little less than twice the tolerance, leaving room for rounding the reconstructed value to a float.
+  // Every reconstructed value is checked against the tolerance, and we fall back to lossless compression if any value
+  // can't be quantised (i.e. where the float spacing itself approaches the tolerance).
+  double step = 1.75 * tolerance;
+  uint32_t* quantised = malloc(sizeof(uint32_t) * (n_floats > 0 ? n_floats : 1));
+  int32_t prev = 0;
+
+  for (size_t ii = 0; ii < n_floats; ii++) {
+    double scaled = (double)src[ii] / step;
+    bool quantisable = isfinite(scaled) && (fabs(scaled) <= (double)(1 << 29));
+    int32_t val = quantisable ? (int32_t)lrint(scaled) : 0;
+
+    // N.B. must match the reconstruction in decompress_cache_floats
+    if (quantisable)
+      quantisable = fabs((double)(float)(val * step) - (double)src[ii]) <= tolerance;
+
+    if (!quantisable) {
+      free(quantised);
+      return compress_block(src, sizeof(float) * n_floats, sizeof(float), 0.0, dest);
+    }
+
+    int32_t diff = val - prev;
+    quantised[ii] = ((uint32_t)diff << 1) ^ (uint32_t)(diff >> 31);
+    prev = val;
+  }
+
+  size_t block_size = compress_block(quantised, sizeof(uint32_t) * n_floats, sizeof(uint32_t), step, dest);
+  free(quantised);
+
+  return block_size;
+}
+
+void decompress_cache_floats(const void* src, float* dest, size_t n_floats)
+{
+  double step = decompress_block(src, dest, sizeof(float) * n_floats);
+
+  if (step > 0) {
+    int32_t val = 0;
+
+    for (size_t ii = 0; ii < n_floats; ii++) {
+      uint32_t code;
+      memcpy(&code, &dest[ii], sizeof(uint32_t));
+      int32_t diff = (int32_t)(code >> 1) ^ -(int32_t)(code & 1);
+      val += diff;
+      dest[ii] = (float)(val * step);
+    }
+  }
+}
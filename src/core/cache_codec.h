@@ -0,0 +1,20 @@
+#ifndef CACHE_CODEC_H
+#define CACHE_CODEC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  size_t compress_cache_block(const void* src, size_t n_bytes, size_t elem_size, void** dest);
+  void decompress_cache_block(const void* src, void* dest, size_t n_bytes);
+  size_t compress_cache_floats(const float* src, size_t n_floats, double tolerance, void** dest);
+  void decompress_cache_floats(const void* src, float* dest, size_t n_floats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,12 +1,16 @@
 #include <fftw3-mpi.h>
 
+#include "cosmology.h"
+#include "fft_plans.h"
 #include "magnitudes.h"
+#include "mcmc_resume.h"
 #include "meraxes.h"
 #include "parse_paramfile.h"
 #include "read_grids.h"
 #include "read_halos.h"
 #include "recombinations.h"
 #include "reionization.h"
+#include "shared_tables.h"
 
 #if USE_MINI_HALOS
 #include "metal_evo.h"
@@ -16,7 +20,11 @@ void cleanup()
 {
   mlog("Running cleanup...", MLOG_OPEN);
 
+  // N.B. A memory dry run stops before the tables, grids and output properties are set up (see init_meraxes)
+  bool dry_run = run_globals.params.FlagMemoryDryRun;
+
   free_grids_cache();
+  free_mcmc_resume_states();
 
   if (run_globals.RequestedMassRatioModifier != -1)
     free(run_globals.mass_ratio_modifier);
@@ -26,23 +34,28 @@ void cleanup()
   free_halo_storage();
 
 #ifdef CALC_MAGS
-  cleanup_mags();
+  if (!dry_run)
+    cleanup_mags();
 #endif
 
+  free_shared_tables();
+  free_cosmology();
+
   if (run_globals.RequestedForestId)
     free(run_globals.RequestedForestId);
 
-  if (run_globals.params.Flag_PatchyReion) {
+  if (run_globals.params.Flag_PatchyReion && !dry_run) {
     free_reionization_grids();
+    free_fft_plans();
     fftwf_mpi_cleanup();
   }
 
-  if (run_globals.params.Flag_IncludeRecombinations) {
+  if (run_globals.params.Flag_IncludeRecombinations && !dry_run) {
     free_MHR();
   }
 
 #if USE_MINI_HALOS
-  if (run_globals.params.Flag_IncludeMetalEvo)
+  if (run_globals.params.Flag_IncludeMetalEvo && !dry_run)
     free_metal_grids();
 #endif
 
@@ -61,8 +74,11 @@ void cleanup()
     free(run_globals.hdf5props.field_names);
     free(run_globals.hdf5props.dst_field_sizes);
     free(run_globals.hdf5props.dst_offsets);
-    H5Tclose(run_globals.hdf5props.array3f_tid);
-    H5Tclose(run_globals.hdf5props.array_nhist_f_tid);
+    free(run_globals.hdf5props.table_offsets);
+    if (!dry_run) {
+      H5Tclose(run_globals.hdf5props.array3f_tid);
+      H5Tclose(run_globals.hdf5props.array_nhist_f_tid);
+    }
     mlog(" ...done", MLOG_CLOSE);
   }
 
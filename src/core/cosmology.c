@@ -0,0 +1,232 @@
+#include <gsl/gsl_integration.h>
+#include <gsl/gsl_spline.h>
+#include <math.h>
+
+#include "XRayHeatingFunctions.h"
+#include "cosmology.h"
+#include "meraxes.h"
+
+/*
+ * Tabulated cosmology.
+ *
+ * The lookback time, cosmic time, growth factor and comoving distance are tabulated against ln(1+z) once at
+ * initialisation and interpolated with cubic splines from then on, as are the inverses of the cosmic time and the
+ * comoving distance.  The tables extend to twice (1 + z) of the first snapshot.  Outside of this range (or before the
+ * tables are built) the quantities are evaluated directly.
+ */
+
+#define COSMOLOGY_TABLE_N 4096
+
+enum cosmology_table
+{
+  COSMO_LOOKBACK_TIME,
+  COSMO_COSMIC_TIME,
+  COSMO_GROWTH,
+  COSMO_COMOVING_DISTANCE,
+  N_COSMO_TABLES
+};
+
+static struct
+{
+  gsl_spline* tables[N_COSMO_TABLES];
+  gsl_spline* x_at_time;     //!< ln(1+z) as a function of the cosmic time
+  gsl_spline* x_at_distance; //!< ln(1+z) as a function of the comoving distance
+  double x_max;
+  double time_range[2];
+  double distance_range[2];
+} cosmology = { { NULL }, NULL, NULL, 0.0, { 0.0, 0.0 }, { 0.0, 0.0 } };
+
+static double integrand_lookback_time(double a, void* params)
+{
+  double omega_m = ((run_params_t*)params)->OmegaM;
+  double omega_k = ((run_params_t*)params)->OmegaK;
+  double omega_lambda = ((run_params_t*)params)->OmegaLambda;
+
+  return 1 / sqrt(omega_m / a + omega_k + omega_lambda * a * a);
+}
+
+//! Lookback time to redshift z in internal units
+static double integrate_lookback_time(double z)
+{
+#define WORKSIZE 1000
+  gsl_function F;
+  gsl_integration_workspace* workspace;
+  double result;
+  double abserr;
+
+  workspace = gsl_integration_workspace_alloc(WORKSIZE);
+  F.function = &integrand_lookback_time;
+  F.params = &(run_globals.params);
+
+  gsl_integration_qag(
+    &F, 1.0 / (z + 1), 1.0, 1.0 / run_globals.Hubble, 1.0e-8, WORKSIZE, GSL_INTEG_GAUSS21, workspace, &result, &abserr);
+
+  gsl_integration_workspace_free(workspace);
+
+  return 1 / run_globals.Hubble * result;
+#undef WORKSIZE
+}
+
+// N.B. consistent with drdz (i.e. a flat universe of matter and a cosmological constant)
+static double integrand_comoving_distance(double z, void* params)
+{
+  run_params_t* run_params = params;
+  double OMm = run_params->OmegaM;
+  double OMl = run_params->OmegaLambda;
+
+  return SPEED_OF_LIGHT / (HUBBLE * run_params->Hubble_h * sqrt(OMm * pow(1 + z, 3) + OMl));
+}
+
+//! Comoving distance to redshift z in cm
+static double integrate_comoving_distance(double z)
+{
+  gsl_function F;
+  gsl_integration_workspace* w = gsl_integration_workspace_alloc(1000);
+  double result;
+  double error;
+
+  F.function = &integrand_comoving_distance;
+  F.params = &(run_globals.params);
+
+  gsl_integration_qag(&F, 0.0, z, 0, 1.0e-8, 1000, GSL_INTEG_GAUSS61, w, &result, &error);
+  gsl_integration_workspace_free(w);
+
+  return result;
+}
+
+static gsl_spline* make_spline(const double* x, const double* y, int n)
+{
+  gsl_spline* spline = gsl_spline_alloc(gsl_interp_cspline, (size_t)n);
+  gsl_spline_init(spline, x, y, (size_t)n);
+  return spline;
+}
+
+void init_cosmology(void)
+{
+  int n = COSMOLOGY_TABLE_N;
+  double* x = malloc(sizeof(double) * n);
+  double* y[N_COSMO_TABLES];
+
+  for (int ii = 0; ii < N_COSMO_TABLES; ii++)
+    y[ii] = malloc(sizeof(double) * n);
+
+  cosmology.x_max = log(2.0 * (1.0 + run_globals.ZZ[0]));
+
+  for (int ii = 0; ii < n; ii++) {
+    x[ii] = cosmology.x_max * (double)ii / (double)(n - 1);
+    double z = expm1(x[ii]);
+
+    y[COSMO_LOOKBACK_TIME][ii] = integrate_lookback_time(z);
+    y[COSMO_COSMIC_TIME][ii] = gettime(z);
+    y[COSMO_GROWTH][ii] = dicke(z);
+    y[COSMO_COMOVING_DISTANCE][ii] = integrate_comoving_distance(z);
+  }
+
+  for (int ii = 0; ii < N_COSMO_TABLES; ii++)
+    cosmology.tables[ii] = make_spline(x, y[ii], n);
+
+  cosmology.x_at_distance = make_spline(y[COSMO_COMOVING_DISTANCE], x, n);
+  cosmology.distance_range[0] = y[COSMO_COMOVING_DISTANCE][0];
+  cosmology.distance_range[1] = y[COSMO_COMOVING_DISTANCE][n - 1];
+
+  // the cosmic time decreases with redshift, but the spline abscissae must increase
+  double* time = y[COSMO_COSMIC_TIME];
+  for (int ii = 0; ii < n / 2; ii++) {
+    double tmp = time[ii];
+    time[ii] = time[n - 1 - ii];
+    time[n - 1 - ii] = tmp;
+    tmp = x[ii];
+    x[ii] = x[n - 1 - ii];
+    x[n - 1 - ii] = tmp;
+  }
+  cosmology.x_at_time = make_spline(time, x, n);
+  cosmology.time_range[0] = time[0];
+  cosmology.time_range[1] = time[n - 1];
+
+  for (int ii = 0; ii < N_COSMO_TABLES; ii++)
+    free(y[ii]);
+  free(x);
+}
+
+void free_cosmology(void)
+{
+  for (int ii = 0; ii < N_COSMO_TABLES; ii++) {
+    gsl_spline_free(cosmology.tables[ii]);
+    cosmology.tables[ii] = NULL;
+  }
+  gsl_spline_free(cosmology.x_at_time);
+  gsl_spline_free(cosmology.x_at_distance);
+  cosmology.x_at_time = NULL;
+  cosmology.x_at_distance = NULL;
+}
+
+// N.B. No accelerators are used, so that the tables can be evaluated from multiple threads
+static inline bool tabulated(enum cosmology_table table, double z, double* x)
+{
+  *x = log1p(z);
+  return (cosmology.tables[table] != NULL) && (*x >= 0.0) && (*x <= cosmology.x_max);
+}
+
+//! Lookback time to redshift z in internal units
+double lookback_time(double z)
+{
+  double x;
+  if (tabulated(COSMO_LOOKBACK_TIME, z, &x))
+    return gsl_spline_eval(cosmology.tables[COSMO_LOOKBACK_TIME], x, NULL);
+  return integrate_lookback_time(z);
+}
+
+//! Age of the universe at redshift z in s (see gettime)
+double cosmic_time(double z)
+{
+  double x;
+  if (tabulated(COSMO_COSMIC_TIME, z, &x))
+    return gsl_spline_eval(cosmology.tables[COSMO_COSMIC_TIME], x, NULL);
+  return gettime(z);
+}
+
+//! Growth factor at redshift z, normalised to 1 at z=0 (see dicke)
+double growth_factor(double z)
+{
+  double x;
+  if (tabulated(COSMO_GROWTH, z, &x))
+    return gsl_spline_eval(cosmology.tables[COSMO_GROWTH], x, NULL);
+  return dicke(z);
+}
+
+double growth_factor_dz(double z)
+{
+  double x;
+  if (tabulated(COSMO_GROWTH, z, &x))
+    return gsl_spline_eval_deriv(cosmology.tables[COSMO_GROWTH], x, NULL) / (1.0 + z);
+  return ddicke_dz(z);
+}
+
+//! Comoving distance to redshift z in cm
+double comoving_distance_to(double z)
+{
+  double x;
+  if (tabulated(COSMO_COMOVING_DISTANCE, z, &x))
+    return gsl_spline_eval(cosmology.tables[COSMO_COMOVING_DISTANCE], x, NULL);
+  return integrate_comoving_distance(z);
+}
+
+static double invert(gsl_spline* spline, const double range[2], double y, const char* name)
+{
+  if ((spline == NULL) || (y < range[0]) || (y > range[1])) {
+    mlog_error("The %s %g is outside of the tabulated range!", name, y);
+    ABORT(EXIT_FAILURE);
+  }
+
+  return expm1(gsl_spline_eval(spline, y, NULL));
+}
+
+double redshift_at_cosmic_time(double time)
+{
+  return invert(cosmology.x_at_time, cosmology.time_range, time, "cosmic time");
+}
+
+double redshift_at_comoving_distance(double distance)
+{
+  return invert(cosmology.x_at_distance, cosmology.distance_range, distance, "comoving distance");
+}
@@ -0,0 +1,23 @@
+#ifndef COSMOLOGY_H
+#define COSMOLOGY_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  void init_cosmology(void);
+  void free_cosmology(void);
+  double lookback_time(double z);
+  double cosmic_time(double z);
+  double redshift_at_cosmic_time(double time);
+  double growth_factor(double z);
+  double growth_factor_dz(double z);
+  double comoving_distance_to(double z);
+  double redshift_at_comoving_distance(double distance);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
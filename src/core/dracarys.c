@@ -3,6 +3,9 @@
 #include "ConstructLightcone.h"
 #include "debug.h"
 #include "galaxies.h"
+#include "magnitudes.h"
+#include "mcmc_resume.h"
+#include "memory_budget.h"
 #include "meraxes.h"
 #include "misc_tools.h"
 #include "physics/evolve.h"
@@ -50,6 +53,7 @@ void dracarys()
   int last_nout_gals = 0;
   int last_snap = 0;
   int kill_counter = 0;
+  int first_snapshot = 0;
   int i_snap;
   int NSteps = run_globals.params.NSteps;
   int n_store_snapshots = run_globals.NStoreSnapshots;
@@ -79,8 +83,14 @@ void dracarys()
   timer_info timer;
   timer_start(&timer);
 
+  // If the parameters changed since the last MCMC call leave the early snapshots unaffected, pick up from there
+  bool mcmc_resume = check_mcmc_resume_enabled();
+  if (mcmc_resume)
+    first_snapshot = restore_mcmc_resume_state(&NGal);
+  run_globals.FirstEvolvedSnapshot = first_snapshot;
+
   // Loop through each snapshot
-  for (int snapshot = 0; snapshot <= last_snap; snapshot++) {
+  for (int snapshot = first_snapshot; snapshot <= last_snap; snapshot++) {
     int* index_lookup = NULL;
     int merger_counter = 0;
     int new_gal_counter = 0;
@@ -99,8 +109,8 @@ void dracarys()
     // Reset book keeping counters
     kill_counter = 0;
 
-    // Read in the halos for this snapshot
-    if (run_globals.params.FlagInteractive || run_globals.params.FlagMCMC)
+    // Read in the halos for this snapshot (cached halos are copied into the first slot)
+    if ((run_globals.params.FlagInteractive || run_globals.params.FlagMCMC) && !halo_cache_in_use())
       i_snap = snapshot;
     else
       i_snap = 0;
@@ -116,6 +126,8 @@ void dracarys()
     fof_group = snapshot_fof_group[i_snap];
     index_lookup = snapshot_index_lookup[i_snap];
 
+    mem_end_phase(MEM_PHASE_READ_HALOS);
+
     mlog("Processing snapshot %d (z = %.2f)...", MLOG_OPEN | MLOG_TIMERSTART, snapshot, run_globals.ZZ[snapshot]);
 
     // Calculate the critical halo mass for cooling
@@ -324,9 +336,7 @@ void dracarys()
     if (run_globals.params.Flag_IncludeMetalEvo) { // Need this for metal grid, here you assign to galaxies their
                                                    // metallicity and probabilities from bubbles
       int ngals_in_metal_slabs = map_galaxies_to_slabs_metals(NGal);
-      for (int ii = 0; ii < 5; ii++) {
-        assign_probability_to_galaxies(ngals_in_metal_slabs, snapshot, ii);
-      }
+      assign_probability_to_galaxies(ngals_in_metal_slabs, snapshot);
     }
 #endif
 
@@ -349,6 +359,8 @@ void dracarys()
     // Add the ghost galaxies into the nout_gals count
     nout_gals += ghost_counter;
 
+    mem_end_phase(MEM_PHASE_EVOLVE);
+
     if (run_globals.params.Flag_PatchyReion) {
 
       if (check_if_reionization_ongoing(snapshot)) {
@@ -392,7 +404,7 @@ void dracarys()
       // if we have already created a mapping of galaxies to MPI slabs then we no
       // longer need them as they will need to be re-created for the new halo
       // positions in the next time step
-      free(run_globals.reion_grids.galaxy_to_slab_map);
+      free_galaxy_to_slab_map();
     }
 
 #if USE_MINI_HALOS
@@ -405,6 +417,8 @@ void dracarys()
     }
 #endif
 
+    mem_end_phase(MEM_PHASE_REIONIZATION);
+
 #ifdef DEBUG
     // print some statistics for this snapshot
     MPI_Allreduce(MPI_IN_PLACE, &merger_counter, 1, MPI_INT, MPI_SUM, run_globals.mpi_comm);
@@ -434,6 +448,10 @@ void dracarys()
         if (snapshot == run_globals.ListOutputSnaps[i_out])
           write_snapshot(nout_gals, i_out, &last_nout_gals);
 
+    mem_end_phase(MEM_PHASE_OUTPUT);
+    if (run_globals.params.FlagMemoryReport)
+      mem_report(snapshot);
+
     // Update the LastIdentSnap values for non-ghosts
     gal = run_globals.FirstGal;
     while (gal != NULL) {
@@ -449,6 +467,9 @@ void dracarys()
     if (run_globals.params.FlagMCMC)
       meraxes_mhysa_hook(run_globals.mhysa_self, snapshot, nout_gals);
 
+    if (mcmc_resume)
+      save_mcmc_resume_state(snapshot, NGal);
+
     mlog("...done", MLOG_CLOSE | MLOG_TIMERSTOP);
   }
 
@@ -458,10 +479,13 @@ void dracarys()
     nout_gals = 0;
     last_nout_gals = 0;
 
-    mlog("Resetting halo->galaxy pointers", MLOG_MESG);
-    for (int ii = 0; ii < n_store_snapshots; ii++)
-      for (int jj = 0; jj < snapshot_trees_info[ii].n_halos; jj++)
-        snapshot_halo[ii][jj].Galaxy = NULL;
+    // N.B. Cached halos are stored without any galaxy pointers
+    if (!halo_cache_in_use()) {
+      mlog("Resetting halo->galaxy pointers", MLOG_MESG);
+      for (int ii = 0; ii < n_store_snapshots; ii++)
+        for (int jj = 0; jj < snapshot_trees_info[ii].n_halos; jj++)
+          snapshot_halo[ii][jj].Galaxy = NULL;
+    }
 
     // reset started and finished flags for reionization and reinialize the grids if needed
     if (run_globals.params.Flag_PatchyReion) {
@@ -476,7 +500,11 @@ void dracarys()
   gal = run_globals.FirstGal;
   while (gal != NULL) {
     next_gal = gal->Next;
+#ifdef CALC_MAGS
+    free_luminosities(gal);
+#endif
     free(gal);
+    mem_track(MEM_GALAXIES, -(ptrdiff_t)sizeof(galaxy_t));
     gal = next_gal;
   }
   run_globals.FirstGal = NULL;
@@ -0,0 +1,284 @@
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "fft_plans.h"
+#include "meraxes.h"
+
+/*
+ * A registry of all of the FFTW plans used during the run.
+ *
+ * Plans are either bound to a fixed pair of arrays (the reionization grids), or are shared between all transforms of
+ * the same shape and executed on arbitrary arrays using the new-array execute functions (e.g. smoothing the input
+ * grids or computing power spectra).  Plans are created at the planning rigor set by FFTW3PlanRigor.  By default
+ * (FFTW3PlanRigor = -1) only the bound plans are measured, and only if FFTW3WisdomDir is set; the shared plans of the
+ * transient transforms stay at FFTW_ESTIMATE, which avoids the scratch slab needed to measure them.
+ *
+ * If FFTW3WisdomDir is set, the wisdom for each transform shape is imported from a file named by the shape and the
+ * number of ranks before the first plan of that shape is created.  Whenever a measured plan is created afterwards, the
+ * merged wisdom (imported and newly generated) is written back to that file.
+ */
+
+typedef enum fft_direction
+{
+  FFT_R2C,
+  FFT_C2R
+} fft_direction;
+
+typedef struct fft_plan_entry_t
+{
+  fftwf_plan plan;
+  void* in;
+  void* out;
+  int n[3];
+  fft_direction direction;
+  bool in_place;
+  bool aligned;
+  bool shared;
+} fft_plan_entry_t;
+
+typedef struct fft_wisdom_entry_t
+{
+  int n[3];
+  bool unsaved;
+} fft_wisdom_entry_t;
+
+static struct
+{
+  fft_plan_entry_t* plans;
+  fft_wisdom_entry_t* wisdom;
+  int n_plans;
+  int n_wisdom;
+  unsigned flags;
+  unsigned shared_flags;
+} fft_registry = { NULL, NULL, 0, 0, FFTW_ESTIMATE, FFTW_ESTIMATE };
+
+static bool wisdom_enabled(unsigned flags)
+{
+  return (strlen(run_globals.params.FFTW3WisdomDir) > 0) && !(flags & FFTW_ESTIMATE);
+}
+
+static void wisdom_fname(char* fname, const int n[3])
+{
+  // N.B. cubic transforms keep the original naming scheme so that existing wisdom files can still be used
+  if ((n[0] == n[1]) && (n[1] == n[2]))
+    sprintf(fname,
+            "%s/fftw3f-meraxes-N_%d-ranks_%d.wisdom",
+            run_globals.params.FFTW3WisdomDir,
+            n[0],
+            run_globals.mpi_size);
+  else
+    sprintf(fname,
+            "%s/fftw3f-meraxes-N_%dx%dx%d-ranks_%d.wisdom",
+            run_globals.params.FFTW3WisdomDir,
+            n[0],
+            n[1],
+            n[2],
+            run_globals.mpi_size);
+}
+
+static fft_wisdom_entry_t* load_wisdom(const int n[3], unsigned flags)
+{
+  if (!wisdom_enabled(flags))
+    return NULL;
+
+  for (int ii = 0; ii < fft_registry.n_wisdom; ii++)
+    if (memcmp(fft_registry.wisdom[ii].n, n, sizeof(int) * 3) == 0)
+      return &fft_registry.wisdom[ii];
+
+  char fname[STRLEN + 64];
+  bool loaded = false;
+  wisdom_fname(fname, n);
+
+  if (run_globals.mpi_rank == 0) {
+    if (fftwf_import_wisdom_from_filename(fname)) {
+      mlog("Successfully loaded FFTW3 wisdom from %s", MLOG_MESG, fname);
+      loaded = true;
+    } else {
+      mlog("No suitable FFTW3 wisdom exists for %dx%dx%d transforms. New wisdom will be created (this may take a "
+           "while).",
+           MLOG_MESG | MLOG_FLUSH,
+           n[0],
+           n[1],
+           n[2]);
+      // Check to see if the wisdom directory exists and if not, create it
+      struct stat filestatus;
+      if (stat(run_globals.params.FFTW3WisdomDir, &filestatus) != 0)
+        mkdir(run_globals.params.FFTW3WisdomDir, 02755);
+    }
+  }
+  MPI_Bcast(&loaded, 1, MPI_C_BOOL, 0, run_globals.mpi_comm);
+  if (loaded)
+    fftwf_mpi_broadcast_wisdom(run_globals.mpi_comm);
+
+  fft_registry.wisdom = realloc(fft_registry.wisdom, sizeof(fft_wisdom_entry_t) * (fft_registry.n_wisdom + 1));
+  fft_wisdom_entry_t* entry = &fft_registry.wisdom[fft_registry.n_wisdom++];
+  memcpy(entry->n, n, sizeof(int) * 3);
+  entry->unsaved = false;
+
+  return entry;
+}
+
+//! Write the wisdom of any transform shapes which have been planned since their wisdom was last saved (collective)
+void save_fft_wisdom(void)
+{
+  bool gathered = false;
+
+  for (int ii = 0; ii < fft_registry.n_wisdom; ii++) {
+    fft_wisdom_entry_t* entry = &fft_registry.wisdom[ii];
+    if (!entry->unsaved)
+      continue;
+
+    if (!gathered) {
+      fftwf_mpi_gather_wisdom(run_globals.mpi_comm);
+      gathered = true;
+    }
+
+    if (run_globals.mpi_rank == 0) {
+      char fname[STRLEN + 64];
+      wisdom_fname(fname, entry->n);
+      if (fftwf_export_wisdom_to_filename(fname))
+        mlog("Successfully saved FFTW3 wisdom to %s", MLOG_MESG, fname);
+    }
+    entry->unsaved = false;
+  }
+}
+
+void init_fft_plans(void)
+{
+  fftwf_mpi_init();
+
+  switch (run_globals.params.FFTW3PlanRigor) {
+    case -1:
+      // default to the most thorough planning that is worth doing if the results are going to be kept
+      fft_registry.flags = (strlen(run_globals.params.FFTW3WisdomDir) > 0) ? FFTW_PATIENT : FFTW_ESTIMATE;
+      fft_registry.shared_flags = FFTW_ESTIMATE;
+      return;
+    case 0:
+      fft_registry.flags = FFTW_ESTIMATE;
+      break;
+    case 1:
+      fft_registry.flags = FFTW_MEASURE;
+      break;
+    case 2:
+      fft_registry.flags = FFTW_PATIENT;
+      break;
+    case 3:
+      fft_registry.flags = FFTW_EXHAUSTIVE;
+      break;
+    default:
+      mlog_error("Unrecognised FFTW3PlanRigor (%d)!", run_globals.params.FFTW3PlanRigor);
+      ABORT(EXIT_FAILURE);
+  }
+
+  // an explicitly requested rigor applies to every transform
+  fft_registry.shared_flags = fft_registry.flags;
+}
+
+static fftwf_plan create_plan(fft_direction direction, const int n[3], void* in, void* out, unsigned flags)
+{
+  if (direction == FFT_R2C)
+    return fftwf_mpi_plan_dft_r2c_3d(n[0], n[1], n[2], in, out, run_globals.mpi_comm, flags);
+  else
+    return fftwf_mpi_plan_dft_c2r_3d(n[0], n[1], n[2], in, out, run_globals.mpi_comm, flags);
+}
+
+static fftwf_plan get_plan(fft_direction direction, int n0, int n1, int n2, void* in, void* out, bool shared)
+{
+  const int n[3] = { n0, n1, n2 };
+  bool in_place = (in == out);
+  bool aligned = (fftwf_alignment_of(in) == 0) && (fftwf_alignment_of(out) == 0);
+
+  for (int ii = 0; ii < fft_registry.n_plans; ii++) {
+    fft_plan_entry_t* entry = &fft_registry.plans[ii];
+    if ((entry->direction != direction) || (memcmp(entry->n, n, sizeof(int) * 3) != 0) ||
+        (entry->in_place != in_place) || (entry->shared != shared))
+      continue;
+    if (shared ? (entry->aligned == aligned) : ((entry->in == in) && (entry->out == out)))
+      return entry->plan;
+  }
+
+  fftwf_plan plan;
+  unsigned flags = shared ? fft_registry.shared_flags : fft_registry.flags;
+  fft_wisdom_entry_t* wisdom = load_wisdom(n, flags);
+
+  if (shared && !(flags & FFTW_ESTIMATE)) {
+    // Measuring overwrites the arrays, so plan shared transforms using scratch arrays instead.  Unaligned arrays can
+    // only be executed by plans which were told to expect them.
+    ptrdiff_t local_n0, local_0_start;
+    ptrdiff_t n_complex =
+      fftwf_mpi_local_size_3d(n0, n1, n2 / 2 + 1, run_globals.mpi_comm, &local_n0, &local_0_start);
+    fftwf_complex* scratch_complex = fftwf_alloc_complex((size_t)n_complex);
+    float* scratch_real = in_place ? (float*)scratch_complex : fftwf_alloc_real((size_t)n_complex * 2);
+
+    if (!aligned)
+      flags |= FFTW_UNALIGNED;
+
+    if (direction == FFT_R2C)
+      plan = create_plan(direction, n, scratch_real, scratch_complex, flags);
+    else
+      plan = create_plan(direction, n, scratch_complex, scratch_real, flags);
+
+    if (!in_place)
+      fftwf_free(scratch_real);
+    fftwf_free(scratch_complex);
+  } else {
+    if (shared && !aligned)
+      flags |= FFTW_UNALIGNED;
+    plan = create_plan(direction, n, in, out, flags);
+  }
+
+  if (plan == NULL) {
+    mlog_error("Failed to create FFTW plan for %dx%dx%d transform!", n0, n1, n2);
+    ABORT(EXIT_FAILURE);
+  }
+
+  // planning may have added to the imported wisdom
+  if (wisdom != NULL)
+    wisdom->unsaved = true;
+
+  fft_registry.plans = realloc(fft_registry.plans, sizeof(fft_plan_entry_t) * (fft_registry.n_plans + 1));
+  fft_registry.plans[fft_registry.n_plans++] =
+    (fft_plan_entry_t){ plan, in, out, { n0, n1, n2 }, direction, in_place, aligned, shared };
+
+  return plan;
+}
+
+//! Get a plan bound to the given arrays (owned by the registry; execute with fftwf_execute)
+fftwf_plan fft_plan_r2c_3d(int n0, int n1, int n2, float* in, fftwf_complex* out)
+{
+  return get_plan(FFT_R2C, n0, n1, n2, in, out, false);
+}
+
+fftwf_plan fft_plan_c2r_3d(int n0, int n1, int n2, fftwf_complex* in, float* out)
+{
+  return get_plan(FFT_C2R, n0, n1, n2, in, out, false);
+}
+
+//! Execute a transform on arbitrary arrays using the shared plan for this shape (collective)
+void fft_execute_r2c_3d(int n0, int n1, int n2, float* in, fftwf_complex* out)
+{
+  fftwf_plan plan = get_plan(FFT_R2C, n0, n1, n2, in, out, true);
+  save_fft_wisdom();
+  fftwf_mpi_execute_dft_r2c(plan, in, out);
+}
+
+void fft_execute_c2r_3d(int n0, int n1, int n2, fftwf_complex* in, float* out)
+{
+  fftwf_plan plan = get_plan(FFT_C2R, n0, n1, n2, in, out, true);
+  save_fft_wisdom();
+  fftwf_mpi_execute_dft_c2r(plan, in, out);
+}
+
+void free_fft_plans(void)
+{
+  for (int ii = 0; ii < fft_registry.n_plans; ii++)
+    fftwf_destroy_plan(fft_registry.plans[ii].plan);
+
+  free(fft_registry.plans);
+  free(fft_registry.wisdom);
+  fft_registry.plans = NULL;
+  fft_registry.wisdom = NULL;
+  fft_registry.n_plans = 0;
+  fft_registry.n_wisdom = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef FFT_PLANS_H
+#define FFT_PLANS_H
+
+#include <fftw3-mpi.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  void init_fft_plans(void);
+  fftwf_plan fft_plan_r2c_3d(int n0, int n1, int n2, float* in, fftwf_complex* out);
+  fftwf_plan fft_plan_c2r_3d(int n0, int n1, int n2, fftwf_complex* in, float* out);
+  void fft_execute_r2c_3d(int n0, int n1, int n2, float* in, fftwf_complex* out);
+  void fft_execute_c2r_3d(int n0, int n1, int n2, fftwf_complex* in, float* out);
+  void save_fft_wisdom(void);
+  void free_fft_plans(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -44,6 +44,83 @@ double RtoM(double R)
   return -1;
 }
 
+// Fractional allowance for single precision round-off in the filtered fields when bounding them in
+// filter_step_may_ionise().  This is several orders of magnitude larger than the error expected from the FFTs.
+#define FILTER_BOUND_TOL 1e-3
+
+static bool filter_step_may_ionise(double R, double M_mean, double pixel_volume)
+{
+  // Returns false only if no cell can possibly pass the ionisation criterion in _find_HII_bubbles() at this filter
+  // radius.  This uses upper bounds on the filtered stellar mass (and x_e) fields and a lower bound on the filtered
+  // density field, derived from the k-space grids (see filtered_abs_sums()), so that we don't need to filter and
+  // inverse transform them first.
+  reion_grids_t* grids = &(run_globals.reion_grids);
+  const int ReionGridDim = run_globals.params.ReionGridDim;
+  const int local_ix_start = (int)(grids->slab_ix_start[run_globals.mpi_rank]);
+  const int local_nix = (int)(grids->slab_nix[run_globals.mpi_rank]);
+
+  enum bound_fields
+  {
+    bound_deltax,
+    bound_stars,
+#if USE_MINI_HALOS
+    bound_starsIII,
+#endif
+    bound_x_e,
+    n_bound_fields
+  };
+
+  fftwf_complex* boxes[n_bound_fields];
+  boxes[bound_deltax] = grids->deltax_unfiltered;
+  boxes[bound_stars] = grids->stars_unfiltered;
+#if USE_MINI_HALOS
+  boxes[bound_starsIII] = grids->starsIII_unfiltered;
+#endif
+  boxes[bound_x_e] = grids->x_e_unfiltered;
+
+  int n_boxes = run_globals.params.Flag_IncludeSpinTemp ? n_bound_fields : n_bound_fields - 1;
+
+  // sums followed by dc_terms, so that we only need one reduction
+  double bounds[2 * n_bound_fields] = { 0 };
+  filtered_abs_sums(boxes,
+                    n_boxes,
+                    local_ix_start,
+                    local_nix,
+                    ReionGridDim,
+                    (float)R,
+                    run_globals.params.ReionFilterType,
+                    bounds,
+                    bounds + n_bound_fields);
+  MPI_Allreduce(MPI_IN_PLACE, bounds, 2 * n_bound_fields, MPI_DOUBLE, MPI_SUM, run_globals.mpi_comm);
+
+  double* sums = bounds;
+  double* dc_terms = bounds + n_bound_fields;
+
+  // N.B. The sanity checks in _find_HII_bubbles() clamp deltax at -1 + REL_TOL and x_e at 0.999
+  double density_min = 1.0 + dc_terms[bound_deltax] - sums[bound_deltax] -
+                       FILTER_BOUND_TOL * (fabs(dc_terms[bound_deltax]) + sums[bound_deltax]);
+  density_min = fmax(density_min, 0.5 * REL_TOL);
+
+  double neutral_fraction_min = 1.0;
+  if (run_globals.params.Flag_IncludeSpinTemp) {
+    double x_e_max = (fabs(dc_terms[bound_x_e]) + sums[bound_x_e]) * (1.0 + FILTER_BOUND_TOL);
+    neutral_fraction_min = 1.0 - fmin(x_e_max, 0.999);
+  }
+
+  // Recombinations only ever raise the threshold, so we can safely ignore them here
+  double f_coll_factor =
+    (4.0 / 3.0) * M_PI * R * R * R / pixel_volume / (M_mean * density_min) * (1.0 + FILTER_BOUND_TOL);
+  double ionising_max =
+    (fabs(dc_terms[bound_stars]) + sums[bound_stars]) * f_coll_factor * run_globals.params.physics.ReionEfficiency;
+#if USE_MINI_HALOS
+  ionising_max += (fabs(dc_terms[bound_starsIII]) + sums[bound_starsIII]) * f_coll_factor *
+                  run_globals.params.physics.ReionEfficiencyIII;
+#endif
+
+  // Include a further factor of 2 safety margin
+  return (2.0 * ionising_max) > neutral_fraction_min;
+}
+
 void _find_HII_bubbles(const int snapshot)
 {
   // TODO: TAKE A VERY VERY CLOSE LOOK AT UNITS!!!!
@@ -195,6 +272,12 @@ void _find_HII_bubbles(const int snapshot)
 
   bool flag_last_filter_step = false;
 
+  // Filter steps at which no cell crosses the ionisation threshold leave all of the grids untouched, so we can skip
+  // them whenever this can be guaranteed beforehand (e.g. at high redshift, when there are few or no stars).  The
+  // bound becomes less constraining as R decreases, so we stop checking once it first fails.
+  bool flag_check_skip = true;
+  int n_skipped_steps = 0;
+
   // set recombinations to zero (for case when recombinations are not used)
   rec = 0.0;
 
@@ -210,6 +293,16 @@ void _find_HII_bubbles(const int snapshot)
     // mlog("R = %.2e (h=0.678 -> %.2e)", MLOG_MESG, R, R/0.678);
     mlog(".", MLOG_CONT);
 
+    // N.B. The last filter step is never skipped as it assigns the partial ionisations
+    if (flag_check_skip && !flag_last_filter_step) {
+      if (!filter_step_may_ionise(R, RtoM(R), pixel_volume)) {
+        n_skipped_steps++;
+        R /= ReionDeltaRFactor;
+        continue;
+      }
+      flag_check_skip = false;
+    }
+
     // copy the k-space grids
     memcpy(deltax_filtered, deltax_unfiltered, sizeof(fftwf_complex) * slab_n_complex);
     memcpy(stars_filtered, stars_unfiltered, sizeof(fftwf_complex) * slab_n_complex);
@@ -445,6 +538,9 @@ void _find_HII_bubbles(const int snapshot)
     R /= ReionDeltaRFactor;
   }
 
+  if (n_skipped_steps > 0)
+    mlog("Skipped %d filter steps which could not ionise any cells.", MLOG_MESG, n_skipped_steps);
+
   // Find the volume and mass weighted neutral fractions
   // TODO: The deltax grid will have rounding errors from forward and reverse
   //       FFT. Should cache deltax slabs prior to ffts and reuse here.
@@ -2,6 +2,7 @@
 
 #include "galaxies.h"
 #include "magnitudes.h"
+#include "memory_budget.h"
 #include "meraxes.h"
 #include "misc_tools.h"
 #include "tree_flags.h"
@@ -10,6 +11,7 @@
 galaxy_t* new_galaxy(int snapshot, unsigned long halo_ID)
 {
   galaxy_t* gal = malloc(sizeof(galaxy_t));
+  mem_track(MEM_GALAXIES, (ptrdiff_t)sizeof(galaxy_t));
 
   // Initialise the properties
   gal->ID = (unsigned long)(snapshot * 1e10 + halo_ID);
@@ -349,7 +351,11 @@ void kill_galaxy(galaxy_t* gal, galaxy_t* prev_gal, int* NGal, int* kill_counter
   }
 
   // Finally deallocated the galaxy and decrement any necessary counters
+#ifdef CALC_MAGS
+  free_luminosities(gal);
+#endif
   free(gal);
+  mem_track(MEM_GALAXIES, -(ptrdiff_t)sizeof(galaxy_t));
   *NGal = *NGal - 1;
   *kill_counter = *kill_counter + 1;
 }
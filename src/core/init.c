@@ -1,20 +1,23 @@
-#include <gsl/gsl_integration.h>
 #include <string.h>
 #include <time.h>
 
 #include "ComputePowerSpectrum.h"
 #include "ConstructLightcone.h"
 #include "cooling.h"
+#include "cosmology.h"
 #include "init.h"
 #include "magnitudes.h"
+#include "memory_budget.h"
 #include "meraxes.h"
 #include "misc_tools.h"
 #include "parse_paramfile.h"
+#include "read_grids.h"
 #include "read_halos.h"
 #include "recombinations.h"
 #include "reionization.h"
 #include "reionization_modifiers.h"
 #include "save.h"
+#include "shared_tables.h"
 #include "stellar_feedback.h"
 #include "virial_properties.h"
 #if USE_MINI_HALOS
@@ -148,37 +151,10 @@ static void read_snap_list()
   MPI_Bcast(run_globals.AA, run_globals.params.SnaplistLength, MPI_DOUBLE, 0, run_globals.mpi_comm);
 }
 
-double integrand_time_to_present(double a, void* params)
-{
-  double omega_m = ((run_params_t*)params)->OmegaM;
-  double omega_k = ((run_params_t*)params)->OmegaK;
-  double omega_lambda = ((run_params_t*)params)->OmegaLambda;
-
-  return 1 / sqrt(omega_m / a + omega_k + omega_lambda * a * a);
-}
-
 static double time_to_present(double z)
 {
-#define WORKSIZE 1000
-  gsl_function F;
-  gsl_integration_workspace* workspace;
-  double time;
-  double result;
-  double abserr;
-
-  workspace = gsl_integration_workspace_alloc(WORKSIZE);
-  F.function = &integrand_time_to_present;
-  F.params = &(run_globals.params);
-
-  gsl_integration_qag(
-    &F, 1.0 / (z + 1), 1.0, 1.0 / run_globals.Hubble, 1.0e-8, WORKSIZE, GSL_INTEG_GAUSS21, workspace, &result, &abserr);
-
-  time = 1 / run_globals.Hubble * result;
-
-  gsl_integration_workspace_free(workspace);
-
   // return time to present as a function of redshift
-  return time;
+  return lookback_time(z);
 }
 
 void set_units()
@@ -211,6 +187,11 @@ void init_storage()
 
   malloc_reionization_grids();
 
+  // N.B. must come after the reionization grids, as it relies on the slab decomposition and cache arrays
+  if (run_globals.params.Flag_PatchyReion && run_globals.params.FlagSharedGridsCache &&
+      (run_globals.params.FlagInteractive || run_globals.params.FlagMCMC))
+    preload_shared_grids_cache();
+
 #if USE_MINI_HALOS
   if (run_globals.params.Flag_IncludeMetalEvo)
     malloc_metal_grids();
@@ -245,8 +226,13 @@ void init_meraxes()
   parse_output_snaps(run_globals.params.OutputSnapsString);
 
   snaplist_len = run_globals.params.SnaplistLength;
-  for (i = 0; i < snaplist_len; i++) {
+  for (i = 0; i < snaplist_len; i++)
     run_globals.ZZ[i] = 1 / run_globals.AA[i] - 1;
+
+  // tabulate the cosmic time, growth factor etc. out to beyond the first snapshot
+  init_cosmology();
+
+  for (i = 0; i < snaplist_len; i++) {
     run_globals.LTTime[i] = time_to_present(run_globals.ZZ[i]);
     run_globals.rhocrit[i] = 3 * pow(hubble_at_snapshot(i), 2) / (8 * M_PI * run_globals.G);
   }
@@ -263,9 +249,37 @@ void init_meraxes()
   // read in the requested forest IDs (if any)
   read_requested_forest_ids();
 
+  // Set the SelectForestsSwitch
+  run_globals.SelectForestsSwitch = true;
+
+  if (run_globals.params.Flag_IncludeSpinTemp){
+    run_globals.NstoreSnapshots_SFR = set_sfr_history();
+    mlog("Storing %d snapshots of SFR histories for Ts.", MLOG_MESG, run_globals.NstoreSnapshots_SFR);
+  }
+
+  // Determine the size of the light-cone for initialising the light-cone grid
+  if (run_globals.params.Flag_PatchyReion && run_globals.params.Flag_ConstructLightcone) {
+    Initialise_ConstructLightcone();
+  }
+
+  if (run_globals.params.Flag_ComputePS) {
+    Initialise_PowerSpectrum();
+  }
+
+  // N.B. The sizes of all of the large allocations are known by now, so the memory budget is estimated before any of
+  // the large tables are read
+  if (run_globals.params.FlagMemoryReport || run_globals.params.FlagMemoryDryRun)
+    estimate_memory_budget();
+
+  if (run_globals.params.FlagMemoryDryRun)
+    return;
+
   // read in the cooling functions
   read_cooling_functions();
 
+  // N.B. must come before reading any of the tables which can be node-shared
+  init_shared_tables();
+
   // read in the stellar feedback tables
   read_stellar_feedback_tables();
 
@@ -292,20 +306,6 @@ void init_meraxes()
   set_ReionEfficiency();
   set_quasar_fobs();
 
-  if (run_globals.params.Flag_IncludeSpinTemp){
-    run_globals.NstoreSnapshots_SFR = set_sfr_history();
-    mlog("Storing %d snapshots of SFR histories for Ts.", MLOG_MESG, run_globals.NstoreSnapshots_SFR);
-  }
-
-  // Determine the size of the light-cone for initialising the light-cone grid
-  if (run_globals.params.Flag_PatchyReion && run_globals.params.Flag_ConstructLightcone) {
-    Initialise_ConstructLightcone();
-  }
-
-  if (run_globals.params.Flag_ComputePS) {
-    Initialise_PowerSpectrum();
-  }
-
   // Initialise interpolation tables for inhomogeneous recombinations
   // TODO: Should this also depend on Flag_PatchyReion? (apply decision to cleanup.c too)
   if (run_globals.params.Flag_IncludeRecombinations) {
@@ -316,9 +316,6 @@ void init_meraxes()
   run_globals.FirstGal = NULL;
   run_globals.LastGal = NULL;
 
-  // Set the SelectForestsSwitch
-  run_globals.SelectForestsSwitch = true;
-
   // This will be set by Mhysa
   run_globals.mhysa_self = NULL;
 }
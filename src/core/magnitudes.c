@@ -3,102 +3,163 @@
 
 #include "debug.h"
 #include "magnitudes.h"
+#include "memory_budget.h"
 #include "meraxes.h"
 #include "misc_tools.h"
 #include "parse_paramfile.h"
+#include "shared_tables.h"
 #include <assert.h>
 
 #include <gsl/gsl_interp.h>
 #include <gsl/gsl_spline.h>
 
-void init_luminosities(galaxy_t* gal)
+/*
+ * Luminosity store
+ *
+ * The fluxes of each galaxy (MAGS_N_SNAPS x MAGS_N_BANDS values for each of the LUM_N_COMPONENTS components) are kept
+ * in a single contiguous array, outside of galaxy_t.  Galaxies only get an entry (galaxy_t.LumIndex) the first time
+ * that they form stars, and entries are recycled when galaxies merge or are killed.  Galaxies without an entry have
+ * TOL flux in every band.
+ */
+
+enum luminosity_component
 {
-  // Initialise all elements of flux arrays to TOL.
-  double* inBCFlux = gal->inBCFlux;
-  double* outBCFlux = gal->outBCFlux;
+  LUM_IN_BC,
+  LUM_OUT_BC,
 #if USE_MINI_HALOS
-  double* inBCFluxIII = gal->inBCFluxIII;
-  double* outBCFluxIII = gal->outBCFluxIII;
+  LUM_IN_BC_III,
+  LUM_OUT_BC_III,
 #endif
+  LUM_N_COMPONENTS
+};
 
-  for (int iSF = 0; iSF < MAGS_N; ++iSF) {
-    inBCFlux[iSF] = TOL;
-    outBCFlux[iSF] = TOL;
-#if USE_MINI_HALOS
-    inBCFluxIII[iSF] = TOL;
-    outBCFluxIII[iSF] = TOL;
-#endif
+#define LUM_ENTRY_SIZE (LUM_N_COMPONENTS * MAGS_N)
+
+typedef struct luminosity_store_t
+{
+  luminosity_t* flux;
+  int* free_entries;
+  int n_entries;
+  int n_free;
+} luminosity_store_t;
+
+static luminosity_store_t lum_store = { NULL, NULL, 0, 0 };
+
+static inline luminosity_t* get_luminosities(galaxy_t* gal, enum luminosity_component component)
+{
+  return lum_store.flux + (size_t)gal->LumIndex * LUM_ENTRY_SIZE + (size_t)component * MAGS_N;
+}
+
+static void alloc_luminosities(galaxy_t* gal)
+{
+  if (lum_store.n_free == 0) {
+    int n_old = lum_store.n_entries;
+    int n_new = (n_old > 0) ? 2 * n_old : 1024;
+
+    lum_store.flux = realloc(lum_store.flux, sizeof(luminosity_t) * LUM_ENTRY_SIZE * (size_t)n_new);
+    lum_store.free_entries = realloc(lum_store.free_entries, sizeof(int) * (size_t)n_new);
+    mem_track(MEM_GALAXIES, (ptrdiff_t)((sizeof(luminosity_t) * LUM_ENTRY_SIZE + sizeof(int)) * (n_new - n_old)));
+
+    // hand out the lowest indices first
+    for (int ii = n_new - 1; ii >= n_old; ii--)
+      lum_store.free_entries[lum_store.n_free++] = ii;
+    lum_store.n_entries = n_new;
   }
+
+  gal->LumIndex = lum_store.free_entries[--lum_store.n_free];
+
+  luminosity_t* flux = get_luminosities(gal, 0);
+  for (int ii = 0; ii < LUM_ENTRY_SIZE; ++ii)
+    flux[ii] = (luminosity_t)TOL;
 }
 
-void add_luminosities(mag_params_t* miniSpectra,
-                      galaxy_t* gal,
-                      int snapshot,
-                      double metals,
-                      double sfr,
-                      double new_stars)
+void init_luminosities(galaxy_t* gal)
 {
-  // Add luminosities when there is a burst. SFRs in principal should be in a
-  // unit of M_solar/yr. However, one can convert the unit on final results
-  // rather than here in order to achieve better performance.
+  // Galaxies only get an entry in the luminosity store once they form stars
+  gal->LumIndex = -1;
+}
 
-  // Compute integer metallicity
-  int Z = (int)(metals * 1000 - .5);
-  if (Z < miniSpectra->minZ + 1)
-    Z = miniSpectra->minZ + 1;
-  else if (Z > miniSpectra->maxZ)
-    Z = miniSpectra->maxZ;
+void free_luminosities(galaxy_t* gal)
+{
+  if (gal->LumIndex > -1) {
+    lum_store.free_entries[lum_store.n_free++] = gal->LumIndex;
+    gal->LumIndex = -1;
+  }
+}
 
-  // Add luminosities
-  int iA, iF, iS, iAgeBC;
-  int offset;
-  int nAgeStep;
+/*
+ * Luminosity kernels
+ *
+ * The flux added to a galaxy by a burst only depends on the metallicity and the snapshot of the burst.  For every
+ * (metallicity, snapshot) pair we therefore tabulate the contribution of unit SFR to all target snapshots and bands,
+ * laid out exactly like a luminosity store entry (the LUM_IN_BC block followed by the LUM_OUT_BC block).  Adding a
+ * burst is then a single multiply-add over 2 x MAGS_N contiguous values.  Pop III bursts only contribute to the
+ * outside-birth-cloud fluxes and have no metallicity dependence.
+ */
+
+typedef struct luminosity_kernels_t
+{
+  luminosity_t* table;
+#if USE_MINI_HALOS
+  luminosity_t* tableIII;
+#endif
+  int nZ;
+  int nSnaps;
+} luminosity_kernels_t;
+
+static luminosity_kernels_t lum_kernels = { 0 };
+
+static void fill_luminosity_kernels(mag_params_t* miniSpectra)
+{
+  int nSnaps = lum_kernels.nSnaps;
+  int nZ = lum_kernels.nZ;
   int nZF = miniSpectra->nMaxZ * MAGS_N_BANDS;
+  size_t kernel_size = 2 * MAGS_N;
+
+  luminosity_t* table = lum_kernels.table;
+  memset(table, 0, (size_t)nZ * nSnaps * kernel_size * sizeof(luminosity_t));
+#if USE_MINI_HALOS
+  luminosity_t* tableIII = lum_kernels.tableIII;
+  memset(tableIII, 0, (size_t)nSnaps * MAGS_N * sizeof(luminosity_t));
+#endif
+
   double* pWorking = miniSpectra->working;
   double* pInBC = miniSpectra->inBC;
   double* pOutBC = miniSpectra->outBC;
-  double* pInBCFlux = gal->inBCFlux;
-  double* pOutBCFlux = gal->outBCFlux;
-
 #if USE_MINI_HALOS
-  double time_unit = run_globals.units.UnitTime_in_Megayears / run_globals.params.Hubble_h * 1e6;
-  int nZFIII = MAGS_N_BANDS;
   double* pWorkingIII = miniSpectra->workingIII;
-  double* pInBCFluxIII = gal->inBCFluxIII;
-  double* pOutBCFluxIII = gal->outBCFluxIII;
-  if ((gal->Galaxy_Population == 3) && (bool)run_globals.params.physics.InstantSfIII)
-    sfr = new_stars * time_unit; // a bit hacky... (we want new_stars / sfr is in units of year)
 #endif
 
-  for (iS = 0; iS < MAGS_N_SNAPS; ++iS) {
-    nAgeStep = miniSpectra->targetSnap[iS];
-    iA = nAgeStep - snapshot;
-    if (iA >= 0) {
+  for (int iS = 0; iS < MAGS_N_SNAPS; ++iS) {
+    int nAgeStep = miniSpectra->targetSnap[iS];
+    int iAgeBC = miniSpectra->iAgeBC[iS];
+
+    for (int snapshot = 0; snapshot <= nAgeStep; ++snapshot) {
+      // N.B. bursts at snapshot 0 have no age bin of their own, so they are put in the oldest one
+      int iA = (nAgeStep - snapshot < nAgeStep) ? nAgeStep - snapshot : nAgeStep - 1;
+
 #if USE_MINI_HALOS
-      if (gal->Galaxy_Population == 3) {
-        offset = iA * MAGS_N_BANDS;
-        for (iF = 0; iF < MAGS_N_BANDS; ++iF) {
-          pOutBCFlux[iF] += sfr * pWorkingIII[offset + iF];
-          pOutBCFluxIII[iF] += sfr * pWorkingIII[offset + iF];
-        }
-      } else
+      luminosity_t* kernelIII = tableIII + (size_t)snapshot * MAGS_N + iS * MAGS_N_BANDS;
+      for (int iF = 0; iF < MAGS_N_BANDS; ++iF)
+        kernelIII[iF] = (luminosity_t)pWorkingIII[iA * MAGS_N_BANDS + iF];
 #endif
-      {
-        iAgeBC = miniSpectra->iAgeBC[iS];
+
+      for (int iZ = 0; iZ < nZ; ++iZ) {
+        int Z = miniSpectra->minZ + 1 + iZ;
+        luminosity_t* kernelIn = table + ((size_t)iZ * nSnaps + snapshot) * kernel_size + iS * MAGS_N_BANDS;
+        luminosity_t* kernelOut = kernelIn + MAGS_N;
+
         if (iA > iAgeBC) {
-          offset = (Z * nAgeStep + iA) * MAGS_N_BANDS;
-          for (iF = 0; iF < MAGS_N_BANDS; ++iF)
-            pOutBCFlux[iF] += sfr * pWorking[offset + iF];
+          for (int iF = 0; iF < MAGS_N_BANDS; ++iF)
+            kernelOut[iF] = (luminosity_t)pWorking[(Z * nAgeStep + iA) * MAGS_N_BANDS + iF];
         } else if (iA == iAgeBC) {
-          offset = Z * MAGS_N_BANDS;
-          for (iF = 0; iF < MAGS_N_BANDS; ++iF) {
-            pInBCFlux[iF] += sfr * pInBC[offset + iF];
-            pOutBCFlux[iF] += sfr * pOutBC[offset + iF];
+          for (int iF = 0; iF < MAGS_N_BANDS; ++iF) {
+            kernelIn[iF] = (luminosity_t)pInBC[Z * MAGS_N_BANDS + iF];
+            kernelOut[iF] = (luminosity_t)pOutBC[Z * MAGS_N_BANDS + iF];
           }
         } else {
-          offset = (Z * nAgeStep + iA) * MAGS_N_BANDS;
-          for (iF = 0; iF < MAGS_N_BANDS; ++iF)
-            pInBCFlux[iF] += sfr * pWorking[offset + iF];
+          for (int iF = 0; iF < MAGS_N_BANDS; ++iF)
+            kernelIn[iF] = (luminosity_t)pWorking[(Z * nAgeStep + iA) * MAGS_N_BANDS + iF];
         }
       }
     }
@@ -106,40 +167,161 @@ void add_luminosities(mag_params_t* miniSpectra,
     pWorking += nAgeStep * nZF;
     pInBC += nZF;
     pOutBC += nZF;
-    pInBCFlux += MAGS_N_BANDS;
-    pOutBCFlux += MAGS_N_BANDS;
 #if USE_MINI_HALOS
-    pWorkingIII += nAgeStep * nZFIII;
-    pInBCFluxIII += MAGS_N_BANDS;
-    pOutBCFluxIII += MAGS_N_BANDS;
+    pWorkingIII += nAgeStep * MAGS_N_BANDS;
 #endif
   }
 }
 
-void merge_luminosities(galaxy_t* target, galaxy_t* gal)
+static void init_luminosity_kernels(mag_params_t* miniSpectra)
 {
-  // Sum fluexs together when a merge happens.
+  int nSnaps = 0;
+  for (int iS = 0; iS < MAGS_N_SNAPS; ++iS)
+    if (miniSpectra->targetSnap[iS] + 1 > nSnaps)
+      nSnaps = miniSpectra->targetSnap[iS] + 1;
 
-  double* inBCFluxTgt = target->inBCFlux;
-  double* outBCFluxTgt = target->outBCFlux;
-  double* inBCFlux = gal->inBCFlux;
-  double* outBCFlux = gal->outBCFlux;
+  lum_kernels.nZ = miniSpectra->maxZ - miniSpectra->minZ;
+  lum_kernels.nSnaps = nSnaps;
 
+  size_t table_size = (size_t)lum_kernels.nZ * nSnaps * 2 * MAGS_N * sizeof(luminosity_t);
+  lum_kernels.table = alloc_shared_table(table_size);
 #if USE_MINI_HALOS
-  double* inBCFluxTgtIII = target->inBCFluxIII;
-  double* outBCFluxTgtIII = target->outBCFluxIII;
-  double* inBCFluxIII = gal->inBCFluxIII;
-  double* outBCFluxIII = gal->outBCFluxIII;
+  lum_kernels.tableIII = alloc_shared_table((size_t)nSnaps * MAGS_N * sizeof(luminosity_t));
 #endif
 
-  for (int iSF = 0; iSF < MAGS_N; ++iSF) {
-    inBCFluxTgt[iSF] += inBCFlux[iSF];
-    outBCFluxTgt[iSF] += outBCFlux[iSF];
+  // node-shared kernels are only computed by the first rank on each node
+  if (is_shared_table_writer())
+    fill_luminosity_kernels(miniSpectra);
+
+  sync_shared_table(lum_kernels.table);
 #if USE_MINI_HALOS
-    inBCFluxTgtIII[iSF] += inBCFluxIII[iSF];
-    outBCFluxTgtIII[iSF] += outBCFluxIII[iSF];
+  sync_shared_table(lum_kernels.tableIII);
+#endif
+
+  mlog("Luminosity kernels use %.1f MB per %s.",
+       MLOG_MESG,
+       (double)table_size / (1024. * 1024.),
+       run_globals.params.FlagSharedTables ? "node" : "rank");
+}
+
+static inline void add_luminosity_kernel(luminosity_t* restrict flux,
+                                         const luminosity_t* restrict kernel,
+                                         luminosity_t weight,
+                                         size_t n)
+{
+  for (size_t ii = 0; ii < n; ++ii)
+    flux[ii] += weight * kernel[ii];
+}
+
+void add_luminosities(mag_params_t* miniSpectra,
+                      galaxy_t* gal,
+                      int snapshot,
+                      double metals,
+                      double sfr,
+                      double new_stars)
+{
+  // Add luminosities when there is a burst. SFRs in principal should be in a
+  // unit of M_solar/yr. However, one can convert the unit on final results
+  // rather than here in order to achieve better performance.
+
+  if (gal->LumIndex < 0)
+    alloc_luminosities(gal);
+
+  // Bursts after the last target snapshot don't contribute to any of the fluxes
+  if (snapshot >= lum_kernels.nSnaps)
+    return;
+
+#if USE_MINI_HALOS
+  if (gal->Galaxy_Population == 3) {
+    if ((bool)run_globals.params.physics.InstantSfIII) {
+      double time_unit = run_globals.units.UnitTime_in_Megayears / run_globals.params.Hubble_h * 1e6;
+      sfr = new_stars * time_unit; // a bit hacky... (we want new_stars / sfr is in units of year)
+    }
+
+    const luminosity_t* kernelIII = lum_kernels.tableIII + (size_t)snapshot * MAGS_N;
+    add_luminosity_kernel(get_luminosities(gal, LUM_OUT_BC), kernelIII, (luminosity_t)sfr, MAGS_N);
+    add_luminosity_kernel(get_luminosities(gal, LUM_OUT_BC_III), kernelIII, (luminosity_t)sfr, MAGS_N);
+    return;
+  }
 #endif
+
+  // Compute integer metallicity
+  int Z = (int)(metals * 1000 - .5);
+  if (Z < miniSpectra->minZ + 1)
+    Z = miniSpectra->minZ + 1;
+  else if (Z > miniSpectra->maxZ)
+    Z = miniSpectra->maxZ;
+
+  int iZ = Z - miniSpectra->minZ - 1;
+  const luminosity_t* kernel = lum_kernels.table + ((size_t)iZ * lum_kernels.nSnaps + snapshot) * 2 * MAGS_N;
+
+  // N.B. the LUM_IN_BC and LUM_OUT_BC blocks of an entry are adjacent
+  add_luminosity_kernel(get_luminosities(gal, LUM_IN_BC), kernel, (luminosity_t)sfr, 2 * MAGS_N);
+}
+
+void merge_luminosities(galaxy_t* target, galaxy_t* gal)
+{
+  // Sum fluexs together when a merge happens.
+
+  if (gal->LumIndex < 0)
+    return;
+
+  // If the target has no stars of its own then it can simply take over the entry of the galaxy
+  if (target->LumIndex < 0) {
+    target->LumIndex = gal->LumIndex;
+    gal->LumIndex = -1;
+    return;
+  }
+
+  add_luminosity_kernel(get_luminosities(target, 0), get_luminosities(gal, 0), 1, LUM_ENTRY_SIZE);
+
+  free_luminosities(gal);
+}
+
+//! Copy the luminosity store into a (re)allocated buffer, returning its size
+size_t save_luminosity_store(void** buffer)
+{
+  size_t flux_size = sizeof(luminosity_t) * LUM_ENTRY_SIZE * (size_t)lum_store.n_entries;
+  size_t size = sizeof(luminosity_store_t) + flux_size + sizeof(int) * (size_t)lum_store.n_free;
+  char* ptr = realloc(*buffer, size);
+
+  *buffer = ptr;
+  memcpy(ptr, &lum_store, sizeof(luminosity_store_t));
+  ptr += sizeof(luminosity_store_t);
+  memcpy(ptr, lum_store.flux, flux_size);
+  ptr += flux_size;
+  memcpy(ptr, lum_store.free_entries, sizeof(int) * (size_t)lum_store.n_free);
+
+  return size;
+}
+
+//! Restore the luminosity store from a buffer filled by save_luminosity_store
+void restore_luminosity_store(const void* buffer)
+{
+  const char* ptr = buffer;
+  luminosity_store_t saved;
+
+  memcpy(&saved, ptr, sizeof(luminosity_store_t));
+  ptr += sizeof(luminosity_store_t);
+
+  if (saved.n_entries > lum_store.n_entries) {
+    lum_store.flux = realloc(lum_store.flux, sizeof(luminosity_t) * LUM_ENTRY_SIZE * (size_t)saved.n_entries);
+    lum_store.free_entries = realloc(lum_store.free_entries, sizeof(int) * (size_t)saved.n_entries);
+    mem_track(MEM_GALAXIES,
+              (ptrdiff_t)((sizeof(luminosity_t) * LUM_ENTRY_SIZE + sizeof(int)) *
+                          (saved.n_entries - lum_store.n_entries)));
+    lum_store.n_entries = saved.n_entries;
   }
+
+  size_t flux_size = sizeof(luminosity_t) * LUM_ENTRY_SIZE * (size_t)saved.n_entries;
+  memcpy(lum_store.flux, ptr, flux_size);
+  ptr += flux_size;
+  memcpy(lum_store.free_entries, ptr, sizeof(int) * (size_t)saved.n_free);
+  lum_store.n_free = saved.n_free;
+
+  // any entries beyond those which were saved are free
+  for (int ii = lum_store.n_entries - 1; ii >= saved.n_entries; ii--)
+    lum_store.free_entries[lum_store.n_free++] = ii;
 }
 
 int JWST_WAVELENGTHS[8] = {70, 90, 115, 150, 200, 277, 356, 444};
@@ -657,13 +839,15 @@ void init_magnitudes(void)
   MPI_Bcast(&offset_inBCIII, sizeof(ptrdiff_t), MPI_BYTE, MASTER, mpi_comm);
   MPI_Bcast(&offset_outBCIII, sizeof(ptrdiff_t), MPI_BYTE, MASTER, mpi_comm);
 #endif
-  if (mpi_rank != MASTER) {
-    working = (double*)malloc(mag_params->totalSize);
-#if USE_MINI_HALOS
-    workingIII = (double*)malloc(mag_params->totalSizeIII);
-#endif
+
+  // The templates are stored in (possibly node-shared) tables
+  double* templates = alloc_shared_table(mag_params->totalSize);
+  if (mpi_rank == MASTER) {
+    memcpy(templates, working, mag_params->totalSize);
+    free(working);
   }
-  MPI_Bcast(working, mag_params->totalSize, MPI_BYTE, MASTER, mpi_comm);
+  share_table(templates, mag_params->totalSize);
+  working = templates;
 
   mag_params->working = working;
   mag_params->inBC = working + offset_inBC;
@@ -672,19 +856,57 @@ void init_magnitudes(void)
   mag_params->logWaves = working + offset_logWaves;
 
 #if USE_MINI_HALOS
-  MPI_Bcast(workingIII, mag_params->totalSizeIII, MPI_BYTE, MASTER, mpi_comm);
-  mag_params->workingIII = workingIII;
+  double* templatesIII = alloc_shared_table(mag_params->totalSizeIII);
+  if (mpi_rank == MASTER) {
+    memcpy(templatesIII, workingIII, mag_params->totalSizeIII);
+    free(workingIII);
+  }
+  share_table(templatesIII, mag_params->totalSizeIII);
+  mag_params->workingIII = templatesIII;
 #endif
+
+  init_luminosity_kernels(mag_params);
 }
 
 void cleanup_mags(void)
 {
   if (!run_globals.params.FlagMCMC)
     H5Tclose(run_globals.hdf5props.array_nmag_f_tid);
-  free(run_globals.mag_params.working);
+  free_shared_table(run_globals.mag_params.working);
 #if USE_MINI_HALOS
-  free(run_globals.mag_params.workingIII);
+  free_shared_table(run_globals.mag_params.workingIII);
 #endif
+  free_shared_table(lum_kernels.table);
+#if USE_MINI_HALOS
+  free_shared_table(lum_kernels.tableIII);
+#endif
+  free(lum_store.flux);
+  free(lum_store.free_entries);
+}
+
+static inline int target_snap_index(int snapshot)
+{
+  for (int iS = 0; iS < MAGS_N_SNAPS; ++iS)
+    if (snapshot == run_globals.mag_params.targetSnap[iS])
+      return iS;
+  return -1;
+}
+
+static inline double sfr_unit_mag(void)
+{
+  return -2.5 * log10(run_globals.units.UnitMass_in_g / run_globals.units.UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS);
+}
+
+//! Load the fluxes of a galaxy at a target snapshot (TOL if it has never formed stars)
+static inline void load_fluxes(galaxy_t* gal, int iS, int i_band, double* in_bc, double* out_bc)
+{
+  if (gal->LumIndex > -1) {
+    *in_bc = (double)get_luminosities(gal, LUM_IN_BC)[iS * MAGS_N_BANDS + i_band];
+    *out_bc = (double)get_luminosities(gal, LUM_OUT_BC)[iS * MAGS_N_BANDS + i_band];
+  } else {
+    *in_bc = TOL;
+    *out_bc = TOL;
+  }
 }
 
 #if USE_MINI_HALOS
@@ -693,26 +915,17 @@ void get_output_magnitudesIII(float* mags, galaxy_t* gal, int snapshot)
   // Convert fluxes to AB magnitudes at all target snapshots.
 
   // Check if ``snapshot`` is a target snapshot
-  int iS;
-  int* targetSnap = run_globals.mag_params.targetSnap;
-  double* pInBCFlux = gal->inBCFluxIII;
-  double* pOutBCFlux = gal->outBCFluxIII;
+  int iS = target_snap_index(snapshot);
 
-  for (iS = 0; iS < MAGS_N_SNAPS; ++iS) {
-    if (snapshot == targetSnap[iS])
-      break;
-    else {
-      pInBCFlux += MAGS_N_BANDS;
-      pOutBCFlux += MAGS_N_BANDS;
-    }
-  }
   // Correct the unit of SFRs and convert fluxes to magnitudes
-  if (iS != MAGS_N_SNAPS) {
-    double redshift = run_globals.ZZ[snapshot];
-    double sfr_unit =
-      -2.5 * log10(run_globals.units.UnitMass_in_g / run_globals.units.UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS);
+  if (iS > -1) {
+    double mag_offset = 8.9 + sfr_unit_mag();
     for (int i_band = 0; i_band < MAGS_N_BANDS; ++i_band) {
-      mags[i_band] = (float)(-2.5 * log10(pInBCFlux[i_band] + pOutBCFlux[i_band]) + 8.9 + sfr_unit);
+      double flux = 2.0 * TOL;
+      if (gal->LumIndex > -1)
+        flux = (double)get_luminosities(gal, LUM_IN_BC_III)[iS * MAGS_N_BANDS + i_band] +
+               (double)get_luminosities(gal, LUM_OUT_BC_III)[iS * MAGS_N_BANDS + i_band];
+      mags[i_band] = (float)(-2.5 * log10(flux) + mag_offset);
     }
 
   } else {
@@ -723,58 +936,114 @@ void get_output_magnitudesIII(float* mags, galaxy_t* gal, int snapshot)
 }
 #endif
 
-void get_output_magnitudes(float* mags, float* dusty_mags, galaxy_t* gal, int snapshot)
+/*
+ * Apply the best fit dust--gas model from Qiu, Mutch, da Cunha et al. 2019, MNRAS, 489, 1357 to a batch of galaxies.
+ *
+ * This is equivalent to calling sector's dust_absorption_approx for each galaxy in turn.  The optical depth of each
+ * component scales as tau_UV * (lambda / 1600A)^n, where only tau_UV depends on the galaxy, so we tabulate the
+ * wavelength dependence once and then work through the galaxies band by band on structure-of-arrays buffers, which
+ * lets the compiler vectorise the inner loops.
+ *
+ * The results are written to dusty_mags[i_gal * MAGS_N_BANDS + i_band].
+ */
+void get_output_dusty_magnitudes(float* dusty_mags, galaxy_t** gals, int n_gals, int snapshot)
 {
-  // Convert fluxes to AB magnitudes at all target snapshots.
+  const double nISM = -1.6;
+  const double nBC = -1.6;
+  int iS = target_snap_index(snapshot);
+
+  if (iS < 0) {
+    for (int ii = 0; ii < n_gals * MAGS_N_BANDS; ++ii)
+      dusty_mags[ii] = 999.999f;
+    return;
+  }
 
-  // Check if ``snapshot`` is a target snapshot
-  int iS;
-  int* targetSnap = run_globals.mag_params.targetSnap;
-  double* pInBCFlux = gal->inBCFlux;
-  double* pOutBCFlux = gal->outBCFlux;
+  double redshift = run_globals.ZZ[snapshot];
+  double mag_offset = 8.9 + sfr_unit_mag();
+  double* centre_waves = run_globals.mag_params.allcentreWaves[iS];
+  double wave_ISM[MAGS_N_BANDS], wave_BC[MAGS_N_BANDS];
 
-  for (iS = 0; iS < MAGS_N_SNAPS; ++iS) {
-    if (snapshot == targetSnap[iS])
-      break;
-    else {
-      pInBCFlux += MAGS_N_BANDS;
-      pOutBCFlux += MAGS_N_BANDS;
-    }
+  for (int i_band = 0; i_band < MAGS_N_BANDS; ++i_band) {
+    wave_ISM[i_band] = pow(centre_waves[i_band] / 1600., nISM);
+    wave_BC[i_band] = pow(centre_waves[i_band] / 1600., nBC);
   }
-  // Correct the unit of SFRs and convert fluxes to magnitudes
-  if (iS != MAGS_N_SNAPS) {
-    double redshift = run_globals.ZZ[snapshot];
-    double sfr_unit =
-      -2.5 * log10(run_globals.units.UnitMass_in_g / run_globals.units.UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS);
-    for (int i_band = 0; i_band < MAGS_N_BANDS; ++i_band) {
-      mags[i_band] = (float)(-2.5 * log10(pInBCFlux[i_band] + pOutBCFlux[i_band]) + 8.9 + sfr_unit);
-    }
 
-    // Best fit dust--gas model from Qiu, Mutch, da Cunha et al. 2019, MNRAS, 489, 1357
+  double* tau_ISM = malloc(sizeof(double) * (size_t)n_gals * 4);
+  double* tau_BC = tau_ISM + n_gals;
+  double* in_bc = tau_BC + n_gals;
+  double* out_bc = in_bc + n_gals;
+
+  for (int i_gal = 0; i_gal < n_gals; ++i_gal) {
+    galaxy_t* gal = gals[i_gal];
     double factor = pow(calc_metallicity(gal->ColdGas, gal->MetalsColdGas) / 0.02, 1.2) * gal->ColdGas *
                     pow(gal->DiskScaleLength * 1e3, -2.0) * exp(-0.35 * redshift);
-    dust_params_t dust_params = { .tauUV_ISM = 13.5 * factor,
-                                  .nISM = -1.6,
-                                  .tauUV_BC = 381.3 * factor,
-                                  .nBC = -1.6,
+    tau_ISM[i_gal] = 13.5 * factor;
+    tau_BC[i_gal] = 381.3 * factor;
+  }
+
+  for (int i_band = 0; i_band < MAGS_N_BANDS; ++i_band) {
+    for (int i_gal = 0; i_gal < n_gals; ++i_gal)
+      load_fluxes(gals[i_gal], iS, i_band, &in_bc[i_gal], &out_bc[i_gal]);
+
+    double w_ISM = wave_ISM[i_band];
+    double w_BC = wave_BC[i_band];
+    float* pMags = dusty_mags + i_band;
+    for (int i_gal = 0; i_gal < n_gals; ++i_gal) {
+      double trans_ISM = exp(-tau_ISM[i_gal] * w_ISM);
+      double flux = (in_bc[i_gal] * exp(-tau_BC[i_gal] * w_BC) + out_bc[i_gal]) * trans_ISM;
+      pMags[i_gal * MAGS_N_BANDS] = (float)(-2.5 * log10(flux) + mag_offset);
+    }
+  }
+
+#ifdef DEBUG
+  // check that we still agree with sector's implementation
+  if (n_gals > 0) {
+    dust_params_t dust_params = { .tauUV_ISM = tau_ISM[0],
+                                  .nISM = nISM,
+                                  .tauUV_BC = tau_BC[0],
+                                  .nBC = nBC,
                                   .tBC = run_globals.mag_params.tBC };
+    double check_in[MAGS_N_BANDS], check_out[MAGS_N_BANDS];
+    for (int i_band = 0; i_band < MAGS_N_BANDS; ++i_band)
+      load_fluxes(gals[0], iS, i_band, &check_in[i_band], &check_out[i_band]);
+    dust_absorption_approx(check_in, check_out, centre_waves, MAGS_N_BANDS, &dust_params);
+    for (int i_band = 0; i_band < MAGS_N_BANDS; ++i_band) {
+      float check = (float)(-2.5 * log10(check_in[i_band] + check_out[i_band]) + mag_offset);
+      if (fabsf(check - dusty_mags[i_band]) > 1e-3f)
+        mlog_error("Batched dust attenuation disagrees with sector (band %d: %g vs %g)!",
+                   i_band,
+                   dusty_mags[i_band],
+                   check);
+    }
+  }
+#endif
 
-    double local_InBCFlux[MAGS_N_BANDS], local_OutBCFlux[MAGS_N_BANDS];
-    memcpy(local_InBCFlux, pInBCFlux, sizeof(local_InBCFlux));
-    memcpy(local_OutBCFlux, pOutBCFlux, sizeof(local_OutBCFlux));
+  free(tau_ISM);
+}
 
-    dust_absorption_approx(
-      local_InBCFlux, local_OutBCFlux, run_globals.mag_params.allcentreWaves[iS], MAGS_N_BANDS, &dust_params);
+void get_output_magnitudes(float* mags, float* dusty_mags, galaxy_t* gal, int snapshot)
+{
+  // Convert fluxes to AB magnitudes at all target snapshots.  The dust attenuated magnitudes are only calculated if
+  // dusty_mags is not NULL (see get_output_dusty_magnitudes for calculating them in batches).
 
+  // Check if ``snapshot`` is a target snapshot
+  int iS = target_snap_index(snapshot);
+
+  // Correct the unit of SFRs and convert fluxes to magnitudes
+  if (iS > -1) {
+    double mag_offset = 8.9 + sfr_unit_mag();
     for (int i_band = 0; i_band < MAGS_N_BANDS; ++i_band) {
-      dusty_mags[i_band] = (float)(-2.5 * log10(local_InBCFlux[i_band] + local_OutBCFlux[i_band]) + 8.9 + sfr_unit);
+      double in_bc, out_bc;
+      load_fluxes(gal, iS, i_band, &in_bc, &out_bc);
+      mags[i_band] = (float)(-2.5 * log10(in_bc + out_bc) + mag_offset);
     }
-
   } else {
     for (int i_band = 0; i_band < MAGS_N_BANDS; ++i_band) {
       mags[i_band] = 999.999f;
-      dusty_mags[i_band] = 999.999f;
     }
   }
+
+  if (dusty_mags != NULL)
+    get_output_dusty_magnitudes(dusty_mags, &gal, 1, snapshot);
 }
 #endif
@@ -8,6 +8,13 @@
 
 #define TOL 1e-30 // Minimum Flux
 
+// Storage type of the galaxy fluxes (see the DOUBLE_LUMINOSITIES build option)
+#ifdef DOUBLE_LUMINOSITIES
+typedef double luminosity_t;
+#else
+typedef float luminosity_t;
+#endif
+
 enum core
 {
   MASTER
@@ -19,6 +26,7 @@ extern "C"
 #endif
 
   void init_luminosities(struct galaxy_t* gal);
+  void free_luminosities(struct galaxy_t* gal);
   void add_luminosities(mag_params_t* miniSpectra,
                         struct galaxy_t* gal,
                         int snapshot,
@@ -26,6 +34,8 @@ extern "C"
                         double sfr,
                         double new_stars);
   void merge_luminosities(struct galaxy_t* target, struct galaxy_t* gal);
+  size_t save_luminosity_store(void** buffer);
+  void restore_luminosity_store(const void* buffer);
   void init_templates_mini(mag_params_t* miniSpectra,
                            char* fName,
                            char* fNameIII,
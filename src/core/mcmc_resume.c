@@ -0,0 +1,496 @@
+#include <assert.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "magnitudes.h"
+#include "mcmc_resume.h"
+#include "memory_budget.h"
+#include "meraxes.h"
+#include "parse_paramfile.h"
+#include "reionization.h"
+
+/*
+ * Snapshot-level memoization for MCMC runs.
+ *
+ * Every MCMCResumeInterval snapshots we keep a copy of the full model state (the galaxy list, the reionization grids
+ * which carry information between snapshots and the random number generator).  At the start of the next call we
+ * compare the parameters with those of the previous call, work out the first snapshot which the changes can influence
+ * and restart from the latest state saved before it.
+ *
+ * N.B. The mhysa hook is only called for the snapshots which are actually evolved (i.e. from
+ * run_globals.FirstEvolvedSnapshot onwards).  The caller should reuse its results from the previous call for the
+ * earlier snapshots.
+ */
+
+typedef struct mcmc_resume_state_t
+{
+  int snapshot;
+  int n_gals;
+  galaxy_t* gals;
+  gsl_rng* random_generator;
+  reion_grids_t reion_grids;
+  float* grids;
+#ifdef CALC_MAGS
+  void* luminosities;
+#endif
+} mcmc_resume_state_t;
+
+static mcmc_resume_state_t* states = NULL;
+static int n_states = 0;
+static int states_interval = 0;
+static run_params_t prev_params;
+static bool have_prev_params = false;
+static int first_ionized_snapshot = INT_MAX;
+
+//! Do the current run settings allow us to resume?
+bool check_mcmc_resume_enabled()
+{
+  static bool warned = false;
+  run_params_t* params = &(run_globals.params);
+
+  if (!params->FlagMCMC || (params->MCMCResumeInterval < 1))
+    return false;
+
+  // These all carry state between snapshots which we don't save
+  bool supported = !params->Flag_ConstructLightcone && !params->Flag_IncludeSpinTemp;
+#if USE_MINI_HALOS
+  supported = supported && !params->Flag_IncludeMetalEvo;
+#endif
+
+  if (!supported && !warned) {
+    mlog("MCMCResumeInterval is not supported with light-cones, spin temperature or metal evolution. Ignoring.",
+         MLOG_MESG);
+    warned = true;
+  }
+
+  return supported;
+}
+
+// The reionization grids which carry information from one snapshot to the next
+static int collect_state_grids(float** grids, size_t* n_floats)
+{
+  reion_grids_t* reion_grids = &(run_globals.reion_grids);
+  run_params_t* params = &(run_globals.params);
+  int ReionGridDim = params->ReionGridDim;
+  size_t slab_n_real = (size_t)reion_grids->slab_nix[run_globals.mpi_rank] * ReionGridDim * ReionGridDim;
+  size_t slab_n_padded = (size_t)reion_grids->slab_n_complex[run_globals.mpi_rank] * 2;
+  int n_grids = 0;
+
+  if (!params->Flag_PatchyReion)
+    return 0;
+
+  grids[n_grids] = reion_grids->xH;
+  n_floats[n_grids++] = slab_n_real;
+  grids[n_grids] = reion_grids->z_at_ionization;
+  n_floats[n_grids++] = slab_n_real;
+  grids[n_grids] = reion_grids->r_bubble;
+  n_floats[n_grids++] = slab_n_real;
+
+  if (params->ReionUVBFlag) {
+    grids[n_grids] = reion_grids->J_21_at_ionization;
+    n_floats[n_grids++] = slab_n_real;
+    grids[n_grids] = reion_grids->J_21;
+    n_floats[n_grids++] = slab_n_real;
+    grids[n_grids] = reion_grids->Mvir_crit;
+    n_floats[n_grids++] = slab_n_real;
+#if USE_MINI_HALOS
+    if (params->Flag_IncludeLymanWerner) {
+      grids[n_grids] = reion_grids->Mvir_crit_MC;
+      n_floats[n_grids++] = slab_n_real;
+    }
+#endif
+  }
+
+#if USE_MINI_HALOS
+  if (params->Flag_IncludeLymanWerner) {
+    grids[n_grids] = reion_grids->JLW_box;
+    n_floats[n_grids++] = slab_n_real;
+    grids[n_grids] = reion_grids->JLW_boxII;
+    n_floats[n_grids++] = slab_n_real;
+  }
+#endif
+
+  if (params->Flag_IncludeRecombinations) {
+    grids[n_grids] = reion_grids->z_re;
+    n_floats[n_grids++] = slab_n_real;
+    grids[n_grids] = reion_grids->Gamma12;
+    n_floats[n_grids++] = slab_n_real;
+    grids[n_grids] = reion_grids->N_rec;
+    n_floats[n_grids++] = slab_n_padded;
+  }
+
+  return n_grids;
+}
+
+#define MAX_STATE_GRIDS 16
+
+static size_t state_grids_size()
+{
+  float* grids[MAX_STATE_GRIDS];
+  size_t n_floats[MAX_STATE_GRIDS];
+  int n_grids = collect_state_grids(grids, n_floats);
+  size_t total = 0;
+
+  for (int ii = 0; ii < n_grids; ii++)
+    total += n_floats[ii];
+
+  return total;
+}
+
+static void copy_state_grids(float* store, bool restore)
+{
+  float* grids[MAX_STATE_GRIDS];
+  size_t n_floats[MAX_STATE_GRIDS];
+  int n_grids = collect_state_grids(grids, n_floats);
+
+  for (int ii = 0; ii < n_grids; ii++) {
+    if (restore)
+      memcpy(grids[ii], store, sizeof(float) * n_floats[ii]);
+    else
+      memcpy(store, grids[ii], sizeof(float) * n_floats[ii]);
+    store += n_floats[ii];
+  }
+}
+
+// Parameters whose influence is limited.  Any change to a parameter not listed here is assumed to affect every
+// snapshot.
+typedef struct param_influence_t
+{
+  size_t offset;
+  int (*first_snapshot)(const run_params_t* old_params, const run_params_t* new_params);
+} param_influence_t;
+
+static int never_used(const run_params_t* old_params, const run_params_t* new_params)
+{
+  (void)old_params;
+  (void)new_params;
+  return INT_MAX;
+}
+
+// The global reionization prescriptions are replaced by the local UVB feedback when both are on (see
+// reionization_modifier)
+static bool uses_local_uvb_feedback(const run_params_t* params)
+{
+  return params->ReionUVBFlag && params->Flag_PatchyReion;
+}
+
+// The first snapshot at or below the given redshift
+static int first_snapshot_below(double redshift)
+{
+  for (int snapshot = 0; snapshot < run_globals.params.SnaplistLength; snapshot++)
+    if (run_globals.ZZ[snapshot] <= redshift)
+      return snapshot;
+
+  return INT_MAX;
+}
+
+// The Gnedin (2000) filtering mass only depends on the redshift of reionization once z <= zr (see gnedin2000_modifer)
+static int gnedin_zr_first_use(const run_params_t* old_params, const run_params_t* new_params)
+{
+  if (uses_local_uvb_feedback(new_params) || (new_params->physics.Flag_ReionizationModifier != 2))
+    return INT_MAX;
+
+  double old_zr = old_params->physics.ReionGnedin_zr;
+  double new_zr = new_params->physics.ReionGnedin_zr;
+  return first_snapshot_below(old_zr > new_zr ? old_zr : new_zr);
+}
+
+// The filtering mass fit of the local UVB feedback is only evaluated for cells which were ionized at an earlier
+// snapshot (see calculate_Mvir_crit).  Up to then the run is independent of these parameters, so the previous call
+// gives the first snapshot at which any cell was ionized.
+static int sm_params_first_use(const run_params_t* old_params, const run_params_t* new_params)
+{
+  (void)old_params;
+  if (!uses_local_uvb_feedback(new_params) || (first_ionized_snapshot == INT_MAX))
+    return INT_MAX;
+
+  return first_ionized_snapshot + 1;
+}
+
+#define PARAM_INFLUENCE(field, func)                                                                                   \
+  {                                                                                                                    \
+    offsetof(run_params_t, field), func                                                                                \
+  }
+
+static const param_influence_t param_influence[] = {
+  // output, logging and performance settings which don't change the model
+  PARAM_INFLUENCE(OutputDir, never_used),
+  PARAM_INFLUENCE(FileNameGalaxies, never_used),
+  PARAM_INFLUENCE(FFTW3WisdomDir, never_used),
+  PARAM_INFLUENCE(FFTW3PlanRigor, never_used),
+  PARAM_INFLUENCE(Flag_OutputGrids, never_used),
+  PARAM_INFLUENCE(Flag_OutputGridsPostReion, never_used),
+  PARAM_INFLUENCE(FlagMemoryReport, never_used),
+  PARAM_INFLUENCE(FlagMemoryDryRun, never_used),
+  PARAM_INFLUENCE(FlagSharedGridsCache, never_used),
+  PARAM_INFLUENCE(FlagSharedHaloCache, never_used),
+  PARAM_INFLUENCE(MCMCResumeInterval, never_used),
+  PARAM_INFLUENCE(FlagColumnarOutput, never_used),
+  PARAM_INFLUENCE(OutputCompressionLevel, never_used),
+  PARAM_INFLUENCE(OutputFields, never_used),
+  PARAM_INFLUENCE(GridChunkNx, never_used),
+  PARAM_INFLUENCE(GridCompressionLevel, never_used),
+  PARAM_INFLUENCE(GridScaleOffsetDigits, never_used),
+  PARAM_INFLUENCE(ForestCacheDir, never_used),
+  PARAM_INFLUENCE(FlagSharedTables, never_used),
+
+  // X-ray heating is only calculated as part of the spin temperature, with which we can't resume
+  PARAM_INFLUENCE(physics.LXrayGal, never_used),
+  PARAM_INFLUENCE(physics.NuXrayGalThreshold, never_used),
+  PARAM_INFLUENCE(physics.SpecIndexXrayGal, never_used),
+  PARAM_INFLUENCE(physics.LXrayGalIII, never_used),
+  PARAM_INFLUENCE(physics.SpecIndexXrayIII, never_used),
+  PARAM_INFLUENCE(physics.NuXraySoftCut, never_used),
+  PARAM_INFLUENCE(physics.NuXrayMax, never_used),
+  PARAM_INFLUENCE(physics.ReionMaxHeatingRedshift, never_used),
+
+  PARAM_INFLUENCE(physics.ReionGnedin_zr, gnedin_zr_first_use),
+
+  PARAM_INFLUENCE(physics.ReionSMParam_m0, sm_params_first_use),
+  PARAM_INFLUENCE(physics.ReionSMParam_a, sm_params_first_use),
+  PARAM_INFLUENCE(physics.ReionSMParam_b, sm_params_first_use),
+  PARAM_INFLUENCE(physics.ReionSMParam_c, sm_params_first_use),
+  PARAM_INFLUENCE(physics.ReionSMParam_d, sm_params_first_use),
+};
+
+static bool param_changed(const void* old_value, const void* new_value, int type)
+{
+  switch (type) {
+    case PARAM_TYPE_INT:
+      return *(const int*)old_value != *(const int*)new_value;
+    case PARAM_TYPE_FLOAT:
+      return *(const float*)old_value != *(const float*)new_value;
+    case PARAM_TYPE_DOUBLE:
+      return *(const double*)old_value != *(const double*)new_value;
+    case PARAM_TYPE_LONGLONG:
+      return *(const long long*)old_value != *(const long long*)new_value;
+    case PARAM_TYPE_STRING:
+      return strncmp(old_value, new_value, STRLEN) != 0;
+    default:
+      return true;
+  }
+}
+
+// N.B. The parameters are compared one by one using the table built by read_parameter_file, which only exists on rank
+// 0.  Derived values (e.g. SnaplistLength) and runtime state (e.g. CurrentLCPos) are not in the table and are ignored.
+static int first_affected_snapshot(const run_params_t* old_params, const run_params_t* new_params)
+{
+  const int n_entries = (int)(sizeof(param_influence) / sizeof(param_influence_t));
+  int first_snapshot = INT_MAX;
+
+  if (run_globals.mpi_rank == 0) {
+    hdf5_output_t* hdf5props = &(run_globals.hdf5props);
+    const char* params_start = (const char*)&(run_globals.params);
+
+    for (int ii = 0; (ii < hdf5props->params_count) && (hdf5props->params_type[ii] != PARAM_TYPE_UNUSED); ii++) {
+      // skip the entries which don't live in run_params_t (e.g. the units)
+      const char* addr = hdf5props->params_addr[ii];
+      if ((addr < params_start) || (addr >= params_start + sizeof(run_params_t)))
+        continue;
+
+      size_t offset = (size_t)(addr - params_start);
+      int type = hdf5props->params_type[ii];
+      if (!param_changed((const char*)old_params + offset, (const char*)new_params + offset, type))
+        continue;
+
+      int snapshot = 0;
+      for (int jj = 0; jj < n_entries; jj++)
+        if (param_influence[jj].offset == offset) {
+          snapshot = param_influence[jj].first_snapshot(old_params, new_params);
+          break;
+        }
+
+      if (snapshot < first_snapshot)
+        first_snapshot = snapshot;
+    }
+  }
+
+  MPI_Bcast(&first_snapshot, 1, MPI_INT, 0, run_globals.mpi_comm);
+  return first_snapshot;
+}
+
+//! Restore the latest saved state which is unaffected by any parameter changes and return the snapshot to start from
+int restore_mcmc_resume_state(int* NGal)
+{
+  int first_snapshot = 0;
+
+  if (have_prev_params)
+    first_snapshot = first_affected_snapshot(&prev_params, &(run_globals.params));
+  prev_params = run_globals.params;
+  have_prev_params = true;
+
+  // find the latest state saved before the first affected snapshot
+  int restore_snapshot = -1;
+  int i_restore = -1;
+  for (int ii = 0; ii < n_states; ii++)
+    if ((states[ii].snapshot < first_snapshot) && (states[ii].snapshot > restore_snapshot)) {
+      restore_snapshot = states[ii].snapshot;
+      i_restore = ii;
+    }
+
+  // all ranks must agree on where to start
+  int agreed_snapshot = restore_snapshot;
+  MPI_Allreduce(MPI_IN_PLACE, &agreed_snapshot, 1, MPI_INT, MPI_MIN, run_globals.mpi_comm);
+  if (agreed_snapshot != restore_snapshot)
+    i_restore = -1;
+  int any_missing = (i_restore < 0);
+  MPI_Allreduce(MPI_IN_PLACE, &any_missing, 1, MPI_INT, MPI_LOR, run_globals.mpi_comm);
+
+  if (any_missing) {
+    // start from scratch with the same random numbers as every other call
+    gsl_rng_set(run_globals.random_generator, (unsigned long)run_globals.params.RandomSeed);
+    first_ionized_snapshot = INT_MAX;
+    return 0;
+  }
+
+  mcmc_resume_state_t* state = &states[i_restore];
+  if (first_ionized_snapshot > state->snapshot)
+    first_ionized_snapshot = INT_MAX;
+
+  mlog("Resuming from the saved state of snapshot %d.", MLOG_MESG, state->snapshot);
+
+  // rebuild the galaxy list, converting the stored indices back into pointers
+  galaxy_t** gals = malloc(sizeof(galaxy_t*) * (size_t)(state->n_gals > 0 ? state->n_gals : 1));
+  for (int ii = 0; ii < state->n_gals; ii++) {
+    gals[ii] = malloc(sizeof(galaxy_t));
+    mem_track(MEM_GALAXIES, (ptrdiff_t)sizeof(galaxy_t));
+    memcpy(gals[ii], &state->gals[ii], sizeof(galaxy_t));
+  }
+
+#define INDEX_TO_GAL(ptr) ((ptr) = ((ptr) == NULL) ? NULL : gals[(intptr_t)(ptr)-1])
+  for (int ii = 0; ii < state->n_gals; ii++) {
+    galaxy_t* gal = gals[ii];
+    INDEX_TO_GAL(gal->FirstGalInHalo);
+    INDEX_TO_GAL(gal->NextGalInHalo);
+    INDEX_TO_GAL(gal->Next);
+    INDEX_TO_GAL(gal->MergerTarget);
+  }
+#undef INDEX_TO_GAL
+
+  run_globals.FirstGal = (state->n_gals > 0) ? gals[0] : NULL;
+  run_globals.LastGal = (state->n_gals > 0) ? gals[state->n_gals - 1] : NULL;
+  *NGal = state->n_gals;
+  free(gals);
+
+  gsl_rng_memcpy(run_globals.random_generator, state->random_generator);
+
+#ifdef CALC_MAGS
+  // the galaxies refer to entries of the luminosity store by index
+  restore_luminosity_store(state->luminosities);
+#endif
+
+  // N.B. The grids are never reallocated between calls, so restoring the struct only changes its scalar members
+  if (run_globals.params.Flag_PatchyReion) {
+    run_globals.reion_grids = state->reion_grids;
+    copy_state_grids(state->grids, true);
+  }
+
+  return state->snapshot + 1;
+}
+
+//! Save the model state at the end of this snapshot if it is one of the resume points
+void save_mcmc_resume_state(int snapshot, int NGal)
+{
+  int interval = run_globals.params.MCMCResumeInterval;
+
+  if (run_globals.params.Flag_PatchyReion && (run_globals.reion_grids.volume_weighted_global_xH < 1.0) &&
+      (snapshot < first_ionized_snapshot))
+    first_ionized_snapshot = snapshot;
+
+  if ((snapshot + 1) % interval != 0)
+    return;
+
+  // the saved states are laid out for a fixed interval
+  if ((states != NULL) && (states_interval != interval))
+    free_mcmc_resume_states();
+
+  if (states == NULL) {
+    int last_snap = 0;
+    for (int ii = 0; ii < run_globals.NOutputSnaps; ii++)
+      if (run_globals.ListOutputSnaps[ii] > last_snap)
+        last_snap = run_globals.ListOutputSnaps[ii];
+
+    n_states = (last_snap + 1) / interval;
+    states = calloc((size_t)n_states, sizeof(mcmc_resume_state_t));
+    for (int ii = 0; ii < n_states; ii++)
+      states[ii].snapshot = -1;
+    states_interval = interval;
+  }
+
+  int i_state = (snapshot + 1) / interval - 1;
+  if (i_state >= n_states)
+    return;
+
+  mcmc_resume_state_t* state = &states[i_state];
+
+  // copy the galaxies, storing the galaxy pointers as (1 based) indices into the saved list
+  int n_gals = 0;
+  for (galaxy_t* gal = run_globals.FirstGal; gal != NULL; gal = gal->Next)
+    n_gals++;
+  assert(n_gals == NGal);
+
+  if ((state->gals == NULL) || (n_gals > state->n_gals))
+    state->gals = realloc(state->gals, sizeof(galaxy_t) * (size_t)(n_gals > 0 ? n_gals : 1));
+  state->n_gals = n_gals;
+
+  // we temporarily use the output_index to find the index of each galaxy
+  int ii = 0;
+  for (galaxy_t* gal = run_globals.FirstGal; gal != NULL; gal = gal->Next) {
+    memcpy(&state->gals[ii], gal, sizeof(galaxy_t));
+    gal->output_index = ii++;
+  }
+
+#define GAL_TO_INDEX(ptr) ((ptr) = ((ptr) == NULL) ? NULL : (galaxy_t*)(intptr_t)((ptr)->output_index + 1))
+  ii = 0;
+  for (galaxy_t* gal = run_globals.FirstGal; gal != NULL; gal = gal->Next) {
+    galaxy_t* saved = &state->gals[ii++];
+    saved->FirstGalInHalo = gal->FirstGalInHalo;
+    saved->NextGalInHalo = gal->NextGalInHalo;
+    saved->Next = gal->Next;
+    saved->MergerTarget = gal->MergerTarget;
+    GAL_TO_INDEX(saved->FirstGalInHalo);
+    GAL_TO_INDEX(saved->NextGalInHalo);
+    GAL_TO_INDEX(saved->Next);
+    GAL_TO_INDEX(saved->MergerTarget);
+  }
+#undef GAL_TO_INDEX
+
+  ii = 0;
+  for (galaxy_t* gal = run_globals.FirstGal; gal != NULL; gal = gal->Next)
+    gal->output_index = state->gals[ii++].output_index;
+
+#ifdef CALC_MAGS
+  save_luminosity_store(&state->luminosities);
+#endif
+
+  if (state->random_generator == NULL)
+    state->random_generator = gsl_rng_clone(run_globals.random_generator);
+  else
+    gsl_rng_memcpy(state->random_generator, run_globals.random_generator);
+
+  if (run_globals.params.Flag_PatchyReion) {
+    state->reion_grids = run_globals.reion_grids;
+    if (state->grids == NULL)
+      state->grids = malloc(sizeof(float) * state_grids_size());
+    copy_state_grids(state->grids, false);
+  }
+
+  state->snapshot = snapshot;
+}
+
+void free_mcmc_resume_states()
+{
+  for (int ii = 0; ii < n_states; ii++) {
+    free(states[ii].grids);
+#ifdef CALC_MAGS
+    free(states[ii].luminosities);
+#endif
+    if (states[ii].random_generator != NULL)
+      gsl_rng_free(states[ii].random_generator);
+    free(states[ii].gals);
+  }
+  free(states);
+  states = NULL;
+  n_states = 0;
+}
@@ -0,0 +1,20 @@
+#ifndef MCMC_RESUME_H
+#define MCMC_RESUME_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  bool check_mcmc_resume_enabled(void);
+  int restore_mcmc_resume_state(int* NGal);
+  void save_mcmc_resume_state(int snapshot, int NGal);
+  void free_mcmc_resume_states(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
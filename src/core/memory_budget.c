@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "meraxes.h"
+#include "memory_budget.h"
+#include "read_halos.h"
+#include "reionization.h"
+#include "save.h"
+
+#define MB (1024. * 1024.)
+
+static const char* category_names[N_MEM_CATEGORIES] = { "halos", "grids", "lightcone", "galaxies", "output" };
+static const char* phase_names[N_MEM_PHASES] = { "read_halos", "evolve", "reionization", "output" };
+
+static size_t current_bytes[N_MEM_CATEGORIES] = { 0 };
+static size_t peak_bytes[N_MEM_CATEGORIES] = { 0 };
+
+// the peak tracked allocations of each category, along with the peak and current resident set size of the process,
+// recorded at the end of each phase
+static double phase_record[N_MEM_PHASES][N_MEM_CATEGORIES + 2] = { { 0 } };
+
+static size_t peak_rss(void)
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  // ru_maxrss is in kilobytes on Linux, but bytes on macOS
+#ifdef __APPLE__
+  return (size_t)usage.ru_maxrss;
+#else
+  return (size_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+static size_t current_rss(void)
+{
+  long pages = 0;
+  FILE* fd = fopen("/proc/self/statm", "r");
+
+  if (fd == NULL)
+    return 0;
+
+  if (fscanf(fd, "%*s %ld", &pages) != 1)
+    pages = 0;
+  fclose(fd);
+
+  return (size_t)pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+//! Record an allocation (n_bytes > 0) or deallocation (n_bytes < 0) against a category
+void mem_track(mem_category category, ptrdiff_t n_bytes)
+{
+  if ((n_bytes < 0) && ((size_t)(-n_bytes) > current_bytes[category]))
+    current_bytes[category] = 0;
+  else
+    current_bytes[category] = (size_t)((ptrdiff_t)current_bytes[category] + n_bytes);
+
+  if (current_bytes[category] > peak_bytes[category])
+    peak_bytes[category] = current_bytes[category];
+}
+
+size_t mem_current(mem_category category)
+{
+  return current_bytes[category];
+}
+
+//! Store the high-water marks reached since the end of the previous phase
+void mem_end_phase(mem_phase phase)
+{
+  for (int ii = 0; ii < N_MEM_CATEGORIES; ii++) {
+    phase_record[phase][ii] = (double)peak_bytes[ii] / MB;
+    peak_bytes[ii] = current_bytes[ii];
+  }
+  phase_record[phase][N_MEM_CATEGORIES] = (double)peak_rss() / MB;
+  phase_record[phase][N_MEM_CATEGORIES + 1] = (double)current_rss() / MB;
+}
+
+//! Log the per-phase high-water marks of this snapshot (min / max over all ranks)
+void mem_report(int snapshot)
+{
+  const int n_vals = N_MEM_PHASES * (N_MEM_CATEGORIES + 2);
+  double min_vals[N_MEM_PHASES][N_MEM_CATEGORIES + 2];
+  double max_vals[N_MEM_PHASES][N_MEM_CATEGORIES + 2];
+
+  MPI_Reduce(phase_record, min_vals, n_vals, MPI_DOUBLE, MPI_MIN, 0, run_globals.mpi_comm);
+  MPI_Reduce(phase_record, max_vals, n_vals, MPI_DOUBLE, MPI_MAX, 0, run_globals.mpi_comm);
+
+  if (run_globals.mpi_rank != 0)
+    return;
+
+  char line[512];
+  int len = 0;
+
+  mlog("Memory high-water marks for snapshot %d (MB per rank; min / max over ranks):", MLOG_MESG, snapshot);
+
+  len = sprintf(line, "%-14s", "phase");
+  for (int ii = 0; ii < N_MEM_CATEGORIES; ii++)
+    len += sprintf(line + len, " %21s", category_names[ii]);
+  sprintf(line + len, " %21s %21s", "peak rss", "rss");
+  mlog("%s", MLOG_MESG, line);
+
+  for (int i_phase = 0; i_phase < N_MEM_PHASES; i_phase++) {
+    len = sprintf(line, "%-14s", phase_names[i_phase]);
+    for (int ii = 0; ii < N_MEM_CATEGORIES + 2; ii++)
+      len += sprintf(line + len, " %10.1f/%10.1f", min_vals[i_phase][ii], max_vals[i_phase][ii]);
+    mlog("%s", MLOG_MESG, line);
+  }
+}
+
+//! Estimate the memory required by the largest allocations on each rank before anything is read or allocated
+void estimate_memory_budget(void)
+{
+  int n_store_snapshots = 1;
+  int last_snap = 0;
+
+  mlog("Estimating memory budget...", MLOG_OPEN | MLOG_TIMERSTART);
+
+  for (int ii = 0; ii < run_globals.NOutputSnaps; ii++)
+    if (run_globals.ListOutputSnaps[ii] > last_snap)
+      last_snap = run_globals.ListOutputSnaps[ii];
+
+  if (run_globals.params.FlagInteractive || run_globals.params.FlagMCMC)
+    n_store_snapshots = last_snap + 1;
+
+  // The number of halos held by each rank is only known once the forests have been distributed.
+  int n_halos_max = 0;
+  size_t halo_bytes = estimate_halo_storage_bytes(&n_halos_max) * (size_t)n_store_snapshots;
+
+  // FFTW distributes the x-axis in blocks, so the largest slab is ceil(ReionGridDim / mpi_size) cells wide
+  size_t grid_bytes = 0;
+  size_t lightcone_bytes = 0;
+  if (run_globals.params.Flag_PatchyReion) {
+    int ReionGridDim = run_globals.params.ReionGridDim;
+    ptrdiff_t slab_nix = (ReionGridDim + run_globals.mpi_size - 1) / run_globals.mpi_size;
+    ptrdiff_t slab_n_complex = slab_nix * ReionGridDim * (ReionGridDim / 2 + 1);
+    reion_grids_footprint(slab_nix, slab_n_complex, &grid_bytes, &lightcone_bytes);
+  }
+
+  // There are typically no more galaxies than halos, and every one of them may be written in a single chunk
+  size_t galaxy_bytes = (size_t)n_halos_max * sizeof(galaxy_t);
+  if (run_globals.params.Flag_PatchyReion)
+    galaxy_bytes += galaxy_to_slab_map_bytes(n_halos_max);
+  size_t output_bytes = (size_t)n_halos_max * sizeof(galaxy_output_t);
+
+  double estimate[N_MEM_CATEGORIES];
+  estimate[MEM_HALOS] = (double)halo_bytes / MB;
+  estimate[MEM_REION_GRIDS] = (double)grid_bytes / MB;
+  estimate[MEM_LIGHTCONE] = (double)lightcone_bytes / MB;
+  estimate[MEM_GALAXIES] = (double)galaxy_bytes / MB;
+  estimate[MEM_OUTPUT] = (double)output_bytes / MB;
+
+  MPI_Allreduce(MPI_IN_PLACE, estimate, N_MEM_CATEGORIES, MPI_DOUBLE, MPI_MAX, run_globals.mpi_comm);
+
+  MPI_Allreduce(MPI_IN_PLACE, &n_halos_max, 1, MPI_INT, MPI_MAX, run_globals.mpi_comm);
+
+  double total = 0.0;
+  for (int ii = 0; ii < N_MEM_CATEGORIES; ii++) {
+    mlog("%-10s : %10.1f MB", MLOG_MESG, category_names[ii], estimate[ii]);
+    total += estimate[ii];
+  }
+  mlog("%-10s : %10.1f MB per rank (%d snapshot(s) of halos, %d halos and galaxies on the largest rank)",
+       MLOG_MESG,
+       "total",
+       total,
+       n_store_snapshots,
+       n_halos_max);
+
+  mlog("...done", MLOG_CLOSE | MLOG_TIMERSTOP);
+}
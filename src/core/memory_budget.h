@@ -0,0 +1,42 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <stddef.h>
+
+//! Categories of the large allocations which we keep a tally of
+typedef enum mem_category
+{
+  MEM_HALOS,
+  MEM_REION_GRIDS,
+  MEM_LIGHTCONE,
+  MEM_GALAXIES,
+  MEM_OUTPUT,
+  N_MEM_CATEGORIES
+} mem_category;
+
+//! Phases of a snapshot for which high-water marks are recorded
+typedef enum mem_phase
+{
+  MEM_PHASE_READ_HALOS,
+  MEM_PHASE_EVOLVE,
+  MEM_PHASE_REIONIZATION,
+  MEM_PHASE_OUTPUT,
+  N_MEM_PHASES
+} mem_phase;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  void mem_track(mem_category category, ptrdiff_t n_bytes);
+  size_t mem_current(mem_category category);
+  void mem_end_phase(mem_phase phase);
+  void mem_report(int snapshot);
+  void estimate_memory_budget(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
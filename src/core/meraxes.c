@@ -41,6 +41,14 @@ int main(int argc, char** argv)
 
   // initiate meraxes
   init_meraxes();
+
+  if (run_globals.params.FlagMemoryDryRun) {
+    mlog("Memory dry run requested. Exiting without running the model.", MLOG_MESG);
+    cleanup();
+    MPI_Finalize();
+    return EXIT_SUCCESS;
+  }
+
   init_storage();
 
   // Run the model!
@@ -342,8 +342,7 @@ void save_metal_input_grids(int snapshot)
   H5Sselect_hyperslab(fspace_id, H5S_SELECT_SET, start, NULL, count, NULL);
 
   // set the dataset creation property list to use chunking along x-axis
-  hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
-  H5Pset_chunk(dcpl_id, 3, (hsize_t[3]){ 1, (hsize_t)MetalGridDim, (hsize_t)MetalGridDim });
+  hid_t dcpl_id = create_grid_dcpl(MetalGridDim, MetalGridDim);
 
   // fftw padded grids
   float* grid = (float*)calloc((size_t)local_nix_metals * (size_t)MetalGridDim * (size_t)MetalGridDim, sizeof(float));
@@ -518,6 +517,10 @@ int map_galaxies_to_slabs_metals(int ngals)
 
   gal_to_slab_t* galaxy_to_slab_map_metals = run_globals.metal_grids.galaxy_to_slab_map_metals;
   ptrdiff_t* slab_ix_start_metals = run_globals.metal_grids.slab_ix_start_metals;
+  bool sort_by_cell = run_globals.params.FlagSortGalaxiesByCell;
+
+  int* slab_of_ix = malloc(sizeof(int) * MetalGridDim);
+  fill_slab_lookup(slab_of_ix, slab_ix_start_metals, run_globals.metal_grids.slab_nix_metals, run_globals.mpi_size);
 
   galaxy_t* gal = run_globals.FirstGal;
   int gal_counter = 0;
@@ -528,18 +531,23 @@ int map_galaxies_to_slabs_metals(int ngals)
 
       assert((ix >= 0) && (ix < MetalGridDim));
 
+      int slab_ind = slab_of_ix[ix];
+
       galaxy_to_slab_map_metals[gal_counter].index = gal_counter;
-      galaxy_to_slab_map_metals[gal_counter].slab_ind =
-        searchsorted(&ix, slab_ix_start_metals, run_globals.mpi_size, sizeof(ptrdiff_t), compare_ptrdiff, -1, -1);
+      galaxy_to_slab_map_metals[gal_counter].slab_ind = slab_ind;
+      galaxy_to_slab_map_metals[gal_counter].cell =
+        sort_by_cell ? galaxy_slab_cell(gal, (int)(ix - slab_ix_start_metals[slab_ind]), MetalGridDim) : 0;
       galaxy_to_slab_map_metals[gal_counter++].galaxy = gal;
     }
 
     gal = gal->Next;
   }
 
-  // sort the slab indices IN PLACE (n.b. compare_slab_assign is a stable comparison)
+  free(slab_of_ix);
+
+  // sort the slab indices IN PLACE
   if (galaxy_to_slab_map_metals != NULL)
-    qsort(galaxy_to_slab_map_metals, (size_t)gal_counter, sizeof(gal_to_slab_t), compare_slab_assign);
+    sort_slab_assignments(galaxy_to_slab_map_metals, gal_counter, run_globals.mpi_size);
 
   assert(gal_counter == ngals);
 
@@ -548,318 +556,119 @@ int map_galaxies_to_slabs_metals(int ngals)
   return gal_counter;
 }
 
-void assign_probability_to_galaxies(int ngals_in_metal_slabs, int snapshot, int flag_property)
+void assign_probability_to_galaxies(int ngals_in_metal_slabs, int snapshot)
 {
-  // Same way in which we assing Mcrit due to Reio and LW feedback in reionization.c
+  // Assign the metal bubble probability, IGM metal and gas masses, and average and maximum bubble radii to every
+  // galaxy at once.  Rather than passing whole slabs of each grid around all ranks, we send the cell index of each
+  // galaxy to the rank which owns that cell and receive back the values of all of the properties in a single exchange.
+  // N.B. We are assuming here that the galaxy_to_slab mapping has been sorted by slab index...
 
   gal_to_slab_t* galaxy_to_slab_map_metals = run_globals.metal_grids.galaxy_to_slab_map_metals;
-  float* buffer_metals = run_globals.metal_grids.buffer_metals;
-  ptrdiff_t* slab_nix_metals = run_globals.metal_grids.slab_nix_metals;
   ptrdiff_t* slab_ix_start_metals = run_globals.metal_grids.slab_ix_start_metals;
+  ptrdiff_t* slab_nix_metals = run_globals.metal_grids.slab_nix_metals;
   int MetalGridDim = run_globals.params.MetalGridDim;
   double box_size = run_globals.params.BoxSize;
-  float* Probability_metals = run_globals.metal_grids.Probability_metals;
-  float* mass_metals = run_globals.metal_grids.mass_metals;
-  float* mass_IGM = run_globals.metal_grids.mass_IGM;
-  float* Rave_metals = run_globals.metal_grids.R_ave;
-  float* Rmax_metals = run_globals.metal_grids.R_max;
-  int total_assigned = 0;
-
-  if (flag_property == 0)
-    mlog("Assigning probability for metals...", MLOG_OPEN);
-
-  if (flag_property == 1)
-    mlog("Assigning metals IGM for metals...", MLOG_OPEN);
-
-  if (flag_property == 2)
-    mlog("Assigning gas IGM for metals...", MLOG_OPEN);
-
-  if (flag_property == 3)
-    mlog("Assigning Rave for metals...", MLOG_OPEN);
-
-  if (flag_property == 4)
-    mlog("Assigning Rmax for metals...", MLOG_OPEN);
-
-  int slab_map_offsets[run_globals.mpi_size];
-  for (int ii = 0, i_gal = 0; ii < run_globals.mpi_size; ii++) {
-    if (galaxy_to_slab_map_metals != NULL) {
-      while ((i_gal < (ngals_in_metal_slabs - 1)) && (galaxy_to_slab_map_metals[i_gal].slab_ind < ii))
-        i_gal++;
-
-      if (galaxy_to_slab_map_metals[i_gal].slab_ind == ii)
-        slab_map_offsets[ii] = i_gal;
-      else
-        slab_map_offsets[ii] = -1;
-    } else
-      slab_map_offsets[ii] = -1;
-  }
+  int mpi_size = run_globals.mpi_size;
 
-  for (int i_skip = 0; i_skip < run_globals.mpi_size; i_skip++) {
-    int recv_from_rank = (run_globals.mpi_rank + i_skip) % run_globals.mpi_size;
-    int send_to_rank = (run_globals.mpi_rank - i_skip + run_globals.mpi_size) % run_globals.mpi_size;
-
-    bool send_flag = false;
-    bool recv_flag = (slab_map_offsets[recv_from_rank] > -1);
-
-    if (flag_property == 0) {
-
-      if (i_skip > 0) {
-        MPI_Sendrecv(&recv_flag,
-                     sizeof(bool),
-                     MPI_BYTE,
-                     recv_from_rank,
-                     6393762,
-                     &send_flag,
-                     sizeof(bool),
-                     MPI_BYTE,
-                     send_to_rank,
-                     6393762,
-                     run_globals.mpi_comm,
-                     MPI_STATUS_IGNORE);
-
-        // need to ensure sends and receives do not clash!
-        if (send_to_rank > run_globals.mpi_rank) {
-          if (send_flag) {
-            int n_cells = (int)(slab_nix_metals[run_globals.mpi_rank] * MetalGridDim * MetalGridDim);
-            MPI_Send(Probability_metals, n_cells, MPI_FLOAT, send_to_rank, 793710, run_globals.mpi_comm);
-          }
-          if (recv_flag) {
-            int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-            MPI_Recv(
-              buffer_metals, n_cells, MPI_FLOAT, recv_from_rank, 793710, run_globals.mpi_comm, MPI_STATUS_IGNORE);
-          }
-        } else {
-          if (recv_flag) {
-            int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-            MPI_Recv(
-              buffer_metals, n_cells, MPI_FLOAT, recv_from_rank, 793710, run_globals.mpi_comm, MPI_STATUS_IGNORE);
-          }
-          if (send_flag) {
-            int n_cells = (int)(slab_nix_metals[run_globals.mpi_rank] * MetalGridDim * MetalGridDim);
-            MPI_Send(Probability_metals, n_cells, MPI_FLOAT, send_to_rank, 793710, run_globals.mpi_comm);
-          }
-        }
-      } else {
-        int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-        memcpy(buffer_metals, Probability_metals, sizeof(float) * n_cells);
-      }
-    }
+  enum metal_property
+  {
+    prop_probability,
+    prop_metals_IGM,
+    prop_gas_IGM,
+    prop_Rave,
+    prop_Rmax,
+    n_metal_props
+  };
 
-    if (flag_property == 1) {
-
-      if (i_skip > 0) {
-        MPI_Sendrecv(&recv_flag,
-                     sizeof(bool),
-                     MPI_BYTE,
-                     recv_from_rank,
-                     6393762,
-                     &send_flag,
-                     sizeof(bool),
-                     MPI_BYTE,
-                     send_to_rank,
-                     6393762,
-                     run_globals.mpi_comm,
-                     MPI_STATUS_IGNORE);
-
-        // need to ensure sends and receives do not clash!
-        if (send_to_rank > run_globals.mpi_rank) {
-          if (send_flag) {
-            int n_cells = (int)(slab_nix_metals[run_globals.mpi_rank] * MetalGridDim * MetalGridDim);
-            MPI_Send(mass_metals, n_cells, MPI_FLOAT, send_to_rank, 793710, run_globals.mpi_comm);
-          }
-          if (recv_flag) {
-            int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-            MPI_Recv(
-              buffer_metals, n_cells, MPI_FLOAT, recv_from_rank, 793710, run_globals.mpi_comm, MPI_STATUS_IGNORE);
-          }
-        } else {
-          if (recv_flag) {
-            int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-            MPI_Recv(
-              buffer_metals, n_cells, MPI_FLOAT, recv_from_rank, 793710, run_globals.mpi_comm, MPI_STATUS_IGNORE);
-          }
-          if (send_flag) {
-            int n_cells = (int)(slab_nix_metals[run_globals.mpi_rank] * MetalGridDim * MetalGridDim);
-            MPI_Send(mass_metals, n_cells, MPI_FLOAT, send_to_rank, 793710, run_globals.mpi_comm);
-          }
-        }
-      } else {
-        int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-        memcpy(buffer_metals, mass_metals, sizeof(float) * n_cells);
-      }
-    }
+  float* grids[n_metal_props];
+  grids[prop_probability] = run_globals.metal_grids.Probability_metals;
+  grids[prop_metals_IGM] = run_globals.metal_grids.mass_metals;
+  grids[prop_gas_IGM] = run_globals.metal_grids.mass_IGM;
+  grids[prop_Rave] = run_globals.metal_grids.R_ave;
+  grids[prop_Rmax] = run_globals.metal_grids.R_max;
 
-    if (flag_property == 2) {
-
-      if (i_skip > 0) {
-        MPI_Sendrecv(&recv_flag,
-                     sizeof(bool),
-                     MPI_BYTE,
-                     recv_from_rank,
-                     6393762,
-                     &send_flag,
-                     sizeof(bool),
-                     MPI_BYTE,
-                     send_to_rank,
-                     6393762,
-                     run_globals.mpi_comm,
-                     MPI_STATUS_IGNORE);
-
-        // need to ensure sends and receives do not clash!
-        if (send_to_rank > run_globals.mpi_rank) {
-          if (send_flag) {
-            int n_cells = (int)(slab_nix_metals[run_globals.mpi_rank] * MetalGridDim * MetalGridDim);
-            MPI_Send(mass_IGM, n_cells, MPI_FLOAT, send_to_rank, 793710, run_globals.mpi_comm);
-          }
-          if (recv_flag) {
-            int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-            MPI_Recv(
-              buffer_metals, n_cells, MPI_FLOAT, recv_from_rank, 793710, run_globals.mpi_comm, MPI_STATUS_IGNORE);
-          }
-        } else {
-          if (recv_flag) {
-            int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-            MPI_Recv(
-              buffer_metals, n_cells, MPI_FLOAT, recv_from_rank, 793710, run_globals.mpi_comm, MPI_STATUS_IGNORE);
-          }
-          if (send_flag) {
-            int n_cells = (int)(slab_nix_metals[run_globals.mpi_rank] * MetalGridDim * MetalGridDim);
-            MPI_Send(mass_IGM, n_cells, MPI_FLOAT, send_to_rank, 793710, run_globals.mpi_comm);
-          }
-        }
-      } else {
-        int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-        memcpy(buffer_metals, mass_IGM, sizeof(float) * n_cells);
-      }
-    }
+  mlog("Assigning probability, IGM metals & gas, Rave and Rmax for metals (snapshot %d)...", MLOG_OPEN, snapshot);
 
-    if (flag_property == 3) {
-
-      if (i_skip > 0) {
-        MPI_Sendrecv(&recv_flag,
-                     sizeof(bool),
-                     MPI_BYTE,
-                     recv_from_rank,
-                     6393762,
-                     &send_flag,
-                     sizeof(bool),
-                     MPI_BYTE,
-                     send_to_rank,
-                     6393762,
-                     run_globals.mpi_comm,
-                     MPI_STATUS_IGNORE);
-
-        // need to ensure sends and receives do not clash!
-        if (send_to_rank > run_globals.mpi_rank) {
-          if (send_flag) {
-            int n_cells = (int)(slab_nix_metals[run_globals.mpi_rank] * MetalGridDim * MetalGridDim);
-            MPI_Send(Rave_metals, n_cells, MPI_FLOAT, send_to_rank, 793710, run_globals.mpi_comm);
-          }
-          if (recv_flag) {
-            int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-            MPI_Recv(
-              buffer_metals, n_cells, MPI_FLOAT, recv_from_rank, 793710, run_globals.mpi_comm, MPI_STATUS_IGNORE);
-          }
-        } else {
-          if (recv_flag) {
-            int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-            MPI_Recv(
-              buffer_metals, n_cells, MPI_FLOAT, recv_from_rank, 793710, run_globals.mpi_comm, MPI_STATUS_IGNORE);
-          }
-          if (send_flag) {
-            int n_cells = (int)(slab_nix_metals[run_globals.mpi_rank] * MetalGridDim * MetalGridDim);
-            MPI_Send(Rave_metals, n_cells, MPI_FLOAT, send_to_rank, 793710, run_globals.mpi_comm);
-          }
-        }
-      } else {
-        int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-        memcpy(buffer_metals, Rave_metals, sizeof(float) * n_cells);
-      }
-    }
+  int* send_counts = calloc((size_t)mpi_size * 4, sizeof(int));
+  int* send_displs = send_counts + mpi_size;
+  int* recv_counts = send_counts + 2 * mpi_size;
+  int* recv_displs = send_counts + 3 * mpi_size;
 
-    if (flag_property == 4) {
-
-      if (i_skip > 0) {
-        MPI_Sendrecv(&recv_flag,
-                     sizeof(bool),
-                     MPI_BYTE,
-                     recv_from_rank,
-                     6393762,
-                     &send_flag,
-                     sizeof(bool),
-                     MPI_BYTE,
-                     send_to_rank,
-                     6393762,
-                     run_globals.mpi_comm,
-                     MPI_STATUS_IGNORE);
-
-        // need to ensure sends and receives do not clash!
-        if (send_to_rank > run_globals.mpi_rank) {
-          if (send_flag) {
-            int n_cells = (int)(slab_nix_metals[run_globals.mpi_rank] * MetalGridDim * MetalGridDim);
-            MPI_Send(Rmax_metals, n_cells, MPI_FLOAT, send_to_rank, 793710, run_globals.mpi_comm);
-          }
-          if (recv_flag) {
-            int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-            MPI_Recv(
-              buffer_metals, n_cells, MPI_FLOAT, recv_from_rank, 793710, run_globals.mpi_comm, MPI_STATUS_IGNORE);
-          }
-        } else {
-          if (recv_flag) {
-            int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-            MPI_Recv(
-              buffer_metals, n_cells, MPI_FLOAT, recv_from_rank, 793710, run_globals.mpi_comm, MPI_STATUS_IGNORE);
-          }
-          if (send_flag) {
-            int n_cells = (int)(slab_nix_metals[run_globals.mpi_rank] * MetalGridDim * MetalGridDim);
-            MPI_Send(Rmax_metals, n_cells, MPI_FLOAT, send_to_rank, 793710, run_globals.mpi_comm);
-          }
-        }
-      } else {
-        int n_cells = (int)(slab_nix_metals[recv_from_rank] * MetalGridDim * MetalGridDim);
-        memcpy(buffer_metals, Rmax_metals, sizeof(float) * n_cells);
-      }
-    }
+  // work out which cell of which slab each galaxy requires
+  int* request_cells = malloc(sizeof(int) * (size_t)(ngals_in_metal_slabs > 0 ? ngals_in_metal_slabs : 1));
+  for (int i_gal = 0; i_gal < ngals_in_metal_slabs; i_gal++) {
+    galaxy_t* gal = galaxy_to_slab_map_metals[i_gal].galaxy;
+    int i_r = galaxy_to_slab_map_metals[i_gal].slab_ind;
 
-    if (recv_flag) {
-      int i_gal = slab_map_offsets[recv_from_rank];
-      int ix_start_metals = (int)slab_ix_start_metals[recv_from_rank];
-      while ((i_gal < ngals_in_metal_slabs) && (galaxy_to_slab_map_metals[i_gal].slab_ind == recv_from_rank)) {
-        // TODO: We should use the position of the FOF group here...
-        galaxy_t* gal = galaxy_to_slab_map_metals[i_gal].galaxy;
-        int ix = pos_to_ngp(gal->Pos[0], box_size, MetalGridDim) - ix_start_metals;
-        int iy = pos_to_ngp(gal->Pos[1], box_size, MetalGridDim);
-        int iz = pos_to_ngp(gal->Pos[2], box_size, MetalGridDim);
+    // TODO: We should use the position of the FOF group here...
+    int ix = (int)(pos_to_ngp(gal->Pos[0], box_size, MetalGridDim) - slab_ix_start_metals[i_r]);
+    int iy = pos_to_ngp(gal->Pos[1], box_size, MetalGridDim);
+    int iz = pos_to_ngp(gal->Pos[2], box_size, MetalGridDim);
 
-        assert(ix >= 0);
-        assert(ix < slab_nix_metals[recv_from_rank]);
+    assert(ix >= 0);
+    assert(ix < slab_nix_metals[i_r]);
 
-        if (flag_property == 0) //{
-          gal->Metal_Probability = (double)buffer_metals[grid_index(ix, iy, iz, MetalGridDim, INDEX_REAL)];
+    request_cells[i_gal] = grid_index(ix, iy, iz, MetalGridDim, INDEX_REAL);
+    send_counts[i_r]++;
+  }
 
-        if (flag_property == 1)
-          gal->Metals_IGM = (double)buffer_metals[grid_index(ix, iy, iz, MetalGridDim, INDEX_REAL)];
+  MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, run_globals.mpi_comm);
 
-        if (flag_property == 2) {
-          gal->Gas_IGM = (double)buffer_metals[grid_index(ix, iy, iz, MetalGridDim, INDEX_REAL)];
-          gal->Metallicity_IGM = calc_metallicity(gal->Gas_IGM, gal->Metals_IGM);
-        }
+  int n_requested = 0;
+  for (int ii = 0; ii < mpi_size; ii++) {
+    send_displs[ii] = (ii > 0) ? send_displs[ii - 1] + send_counts[ii - 1] : 0;
+    recv_displs[ii] = n_requested;
+    n_requested += recv_counts[ii];
+  }
 
-        if (flag_property == 3)
-          gal->AveBubble = (double)buffer_metals[grid_index(ix, iy, iz, MetalGridDim, INDEX_REAL)];
+  int* requested_cells = malloc(sizeof(int) * (size_t)(n_requested > 0 ? n_requested : 1));
+  MPI_Alltoallv(request_cells,
+                send_counts,
+                send_displs,
+                MPI_INT,
+                requested_cells,
+                recv_counts,
+                recv_displs,
+                MPI_INT,
+                run_globals.mpi_comm);
 
-        if (flag_property == 4)
-          gal->MaxBubble = (double)buffer_metals[grid_index(ix, iy, iz, MetalGridDim, INDEX_REAL)];
+  // gather the values of every property for each of the requested cells of our slab
+  float* reply = malloc(sizeof(float) * n_metal_props * (size_t)(n_requested > 0 ? n_requested : 1));
+  for (int ii = 0; ii < n_requested; ii++)
+    for (int prop = 0; prop < n_metal_props; prop++)
+      reply[ii * n_metal_props + prop] = grids[prop][requested_cells[ii]];
 
-        // increment counters
-        i_gal++;
-        total_assigned++;
-      }
-    }
+  free(requested_cells);
+
+  // and send them back to where they were requested from
+  for (int ii = 0; ii < mpi_size; ii++) {
+    send_counts[ii] *= n_metal_props;
+    send_displs[ii] *= n_metal_props;
+    recv_counts[ii] *= n_metal_props;
+    recv_displs[ii] *= n_metal_props;
+  }
+
+  float* values = malloc(sizeof(float) * n_metal_props * (size_t)(ngals_in_metal_slabs > 0 ? ngals_in_metal_slabs : 1));
+  MPI_Alltoallv(
+    reply, recv_counts, recv_displs, MPI_FLOAT, values, send_counts, send_displs, MPI_FLOAT, run_globals.mpi_comm);
+
+  free(reply);
+
+  for (int i_gal = 0; i_gal < ngals_in_metal_slabs; i_gal++) {
+    galaxy_t* gal = galaxy_to_slab_map_metals[i_gal].galaxy;
+    float* gal_values = &values[i_gal * n_metal_props];
+
+    gal->Metal_Probability = (double)gal_values[prop_probability];
+    gal->Metals_IGM = (double)gal_values[prop_metals_IGM];
+    gal->Gas_IGM = (double)gal_values[prop_gas_IGM];
+    gal->Metallicity_IGM = calc_metallicity(gal->Gas_IGM, gal->Metals_IGM);
+    gal->AveBubble = (double)gal_values[prop_Rave];
+    gal->MaxBubble = (double)gal_values[prop_Rmax];
   }
 
-  if (total_assigned != ngals_in_metal_slabs)
-    ABORT(EXIT_FAILURE);
+  free(values);
+  free(request_cells);
+  free(send_counts);
 
   mlog("...done.", MLOG_CLOSE);
 }
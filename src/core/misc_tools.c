@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 
 #include "cn_exceptions.h"
 #include "debug.h"
@@ -94,11 +95,74 @@ int compare_int_long(const void* a, const void* b)
     return 0;
 }
 
-int compare_slab_assign(const void* a, const void* b)
+//! Fill a lookup table of the slab which owns each x index of a grid
+void fill_slab_lookup(int* slab_of_ix, const ptrdiff_t* slab_ix_start, const ptrdiff_t* slab_nix, int n_slabs)
 {
-  int value = ((gal_to_slab_t*)a)->slab_ind - ((gal_to_slab_t*)b)->slab_ind;
+  for (int i_slab = 0; i_slab < n_slabs; i_slab++)
+    for (ptrdiff_t ix = slab_ix_start[i_slab]; ix < slab_ix_start[i_slab] + slab_nix[i_slab]; ix++)
+      slab_of_ix[ix] = i_slab;
+}
+
+#define SLAB_SORT_DIGIT_BITS 16
+#define SLAB_SORT_N_DIGITS (1 << SLAB_SORT_DIGIT_BITS)
+
+// One stable counting sort pass, keyed on either the slab index (shift < 0) or a digit of the cell index
+static void slab_sort_pass(const gal_to_slab_t* src, gal_to_slab_t* dest, int n, int* offsets, int n_keys, int shift)
+{
+  memset(offsets, 0, sizeof(int) * n_keys);
+
+  for (int ii = 0; ii < n; ii++) {
+    int key = (shift < 0) ? src[ii].slab_ind : (int)(((unsigned)src[ii].cell >> shift) & (SLAB_SORT_N_DIGITS - 1));
+    offsets[key]++;
+  }
+
+  for (int ii = 0, total = 0; ii < n_keys; ii++) {
+    int count = offsets[ii];
+    offsets[ii] = total;
+    total += count;
+  }
+
+  for (int ii = 0; ii < n; ii++) {
+    int key = (shift < 0) ? src[ii].slab_ind : (int)(((unsigned)src[ii].cell >> shift) & (SLAB_SORT_N_DIGITS - 1));
+    dest[offsets[key]++] = src[ii];
+  }
+}
+
+//! Sort a galaxy to slab mapping by slab, cell and then galaxy index in linear time
+void sort_slab_assignments(gal_to_slab_t* map, int n_gals, int n_slabs)
+{
+  // N.B. The mapping is built in galaxy index order, so a stable (LSD radix) sort on the cell and then the slab gives
+  // exactly the same order as a full comparison sort.
+  if (n_gals < 2)
+    return;
+
+  int max_cell = 0;
+  for (int ii = 0; ii < n_gals; ii++)
+    if (map[ii].cell > max_cell)
+      max_cell = map[ii].cell;
+
+  gal_to_slab_t* buffer = malloc(sizeof(gal_to_slab_t) * (size_t)n_gals);
+  int* offsets = malloc(sizeof(int) * (size_t)(n_slabs > SLAB_SORT_N_DIGITS ? n_slabs : SLAB_SORT_N_DIGITS));
+  gal_to_slab_t* src = map;
+  gal_to_slab_t* dest = buffer;
+
+  int n_cell_passes = 0;
+  for (unsigned remaining = (unsigned)max_cell; remaining > 0; remaining >>= SLAB_SORT_DIGIT_BITS)
+    n_cell_passes++;
+
+  for (int i_pass = 0; i_pass < n_cell_passes; i_pass++) {
+    slab_sort_pass(src, dest, n_gals, offsets, SLAB_SORT_N_DIGITS, i_pass * SLAB_SORT_DIGIT_BITS);
+    gal_to_slab_t* tmp = src;
+    src = dest;
+    dest = tmp;
+  }
+  slab_sort_pass(src, dest, n_gals, offsets, n_slabs, -1);
+
+  if (dest != map)
+    memcpy(map, dest, sizeof(gal_to_slab_t) * (size_t)n_gals);
 
-  return value != 0 ? value : ((gal_to_slab_t*)a)->index - ((gal_to_slab_t*)b)->index;
+  free(offsets);
+  free(buffer);
 }
 
 static inline float apply_pbc_disp(float delta)
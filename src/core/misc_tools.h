@@ -2,6 +2,7 @@
 #define MISC_TOOLS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 typedef enum index_type
@@ -11,6 +12,8 @@ typedef enum index_type
   INDEX_COMPLEX_HERM,
 } index_type;
 
+struct gal_to_slab_t;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -22,7 +25,8 @@ extern "C"
   int compare_floats(const void* a, const void* b);
   int compare_ptrdiff(const void* a, const void* b);
   int compare_int_long(const void* a, const void* b);
-  int compare_slab_assign(const void* a, const void* b);
+  void fill_slab_lookup(int* slab_of_ix, const ptrdiff_t* slab_ix_start, const ptrdiff_t* slab_nix, int n_slabs);
+  void sort_slab_assignments(struct gal_to_slab_t* map, int n_gals, int n_slabs);
   float apply_pbc_pos(float x);
   int searchsorted(void* val,
                    void* arr,
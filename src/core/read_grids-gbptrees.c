@@ -52,10 +52,17 @@ static long read_header(const char* fname,
       return EXIT_FAILURE;
     }
 
-    fread(n_cell, sizeof(int), 3, fd);
-    fread(box_size, sizeof(double), 3, fd);
-    fread(n_grids, sizeof(int), 1, fd);
-    fread(ma_scheme, sizeof(int), 1, fd);
+    // read the fixed size part of the header in one go: n_cell[3], box_size[3], n_grids, ma_scheme
+    char header[sizeof(int) * 5 + sizeof(double) * 3];
+    if (fread(header, sizeof(header), 1, fd) != 1) {
+      mlog_error("Failed to read header of %s", fname);
+      fclose(fd);
+      ABORT(EXIT_FAILURE);
+    }
+    memcpy(n_cell, header, sizeof(int) * 3);
+    memcpy(box_size, header + sizeof(int) * 3, sizeof(double) * 3);
+    memcpy(n_grids, header + sizeof(int) * 3 + sizeof(double) * 3, sizeof(int));
+    memcpy(ma_scheme, header + sizeof(int) * 4 + sizeof(double) * 3, sizeof(int));
 
     mlog("Reading grid for snapshot %d", MLOG_OPEN | MLOG_TIMERSTART, snapshot);
     mlog("n_cell = [%d, %d, %d]", MLOG_MESG, n_cell[0], n_cell[1], n_cell[2]);
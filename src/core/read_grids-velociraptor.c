@@ -5,6 +5,7 @@
 #include <gsl/gsl_sort_int.h>
 #include <hdf5_hl.h>
 #include <math.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "meraxes.h"
@@ -12,6 +13,7 @@
 #include "read_grids.h"
 
 #define MIN(i, j) ((i) < (j) ? (i) : (j))
+#define MAX(i, j) ((i) > (j) ? (i) : (j))
 
 /** \brief Use naming conventions to determine input file type for grids.
  *
@@ -104,7 +106,6 @@ static int read_swift(const enum grid_prop property, const int snapshot, float*
     status = H5LTget_attribute_double(file_id, "/Header", "BoxSize", box_size);
     assert(status >= 0);
   }
-  // TODO: If this fix works then apply it to read_vr_multi below
   MPI_Bcast(&grid_dim, 1, MPI_INT, 0, run_globals.mpi_comm);
   MPI_Bcast(box_size, 3, MPI_DOUBLE, 0, run_globals.mpi_comm);
 
@@ -239,7 +240,46 @@ static int read_swift(const enum grid_prop property, const int snapshot, float*
 // which is then used for reading the velocity files.
 static int vr_num_files_hack_ = 0;
 
+static void vr_grid_fname(char* fname, const enum grid_prop property, const int snapshot, const int i_file)
+{
+  const char fname_base[] = { "%s/grids/snapshot_%03d.%s.%d" };
+
+  switch (property) {
+    case X_VELOCITY:
+    case Y_VELOCITY:
+    case Z_VELOCITY:
+      sprintf(fname, fname_base, run_globals.params.SimulationDir, snapshot, "vel", i_file);
+      break;
+    case DENSITY:
+      sprintf(fname, fname_base, run_globals.params.SimulationDir, snapshot, "den", i_file);
+      break;
+    default:
+      mlog_error("Unrecognised grid property in read_grid__velociraptor!");
+      ABORT(EXIT_FAILURE);
+  }
+}
+
+//! Each grid file is read by exactly one rank, with contiguous blocks of files (and so x-planes) going to each rank
+static inline int vr_file_owner(const int i_file, const int n_files)
+{
+  return (int)(((long)i_file * run_globals.mpi_size) / n_files);
+}
+
+//! The number of x-planes shared by a grid file and a rank's slab (starting at *ix_start)
+static inline int vr_overlap(int file_ix_start, int file_nx, ptrdiff_t rank_ix_start, ptrdiff_t rank_nx, int* ix_start)
+{
+  int lo = (int)MAX((ptrdiff_t)file_ix_start, rank_ix_start);
+  int hi = (int)MIN((ptrdiff_t)(file_ix_start + file_nx), rank_ix_start + rank_nx);
+  *ix_start = lo;
+  return (hi > lo) ? hi - lo : 0;
+}
+
 /** \brief Read in VELOCIraptor grids spanning multiple files per snapshot.
+ *
+ * Each file is opened by only one rank, which reads the x-planes needed by every other rank straight into a float
+ * send buffer (HDF5 converts the doubles as it reads).  The planes are then routed to the ranks which own them in
+ * the fftw slab decomposition with an all-to-all.  This is done in rounds which each cover a window of x-planes as
+ * wide as the largest slab, so that the buffers never hold more than about one slab, however few files there are.
  *
  * \param property  the grid property (e.g. density, x-velocity, etc.) to be read
  * \param snapshot  the requested snapshot
@@ -250,91 +290,85 @@ static int vr_num_files_hack_ = 0;
 static int read_vr_multi(const enum grid_prop property, const int snapshot, float* slab)
 {
   run_params_t* params = &(run_globals.params);
-  const char fname_base[] = { "%s/grids/snapshot_%03d.%s.%d" };
+  int mpi_size = run_globals.mpi_size;
+  int mpi_rank = run_globals.mpi_rank;
 
-  // read in the number of x values and offsets from every grid file
-  // nx : number of x-dim values
-  // ix_start : first x index
+  // read the global properties of the grid from the first file
   // n_cell : number of values in each dim
-  int* file_nx = NULL;
-  int* file_ix_start = NULL;
   int file_n_cell[3] = { 0, 0, 0 };
-  double box_size;
-  int n_files = 999;
-
-  {
-    hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
-    H5Pset_fapl_mpio(plist_id, run_globals.mpi_comm, MPI_INFO_NULL);
-
-    for (int ii = 0; ii < n_files; ii++) {
-
-      char fname[STRLEN];
-      switch (property) {
-        case X_VELOCITY:
-        case Y_VELOCITY:
-        case Z_VELOCITY:
-          sprintf(fname, fname_base, params->SimulationDir, snapshot, "vel", ii);
-          break;
-        case DENSITY:
-          sprintf(fname, fname_base, params->SimulationDir, snapshot, "den", ii);
-          break;
-        default:
-          mlog_error("Unrecognised grid property in read_grid__velociraptor!");
-          break;
-      }
-
-      hid_t file_id = H5Fopen(fname, H5F_ACC_RDONLY, plist_id);
-
-      if (ii == 0) {
-
-        // save current error stack
-        herr_t (*old_func)(long long, void*);
-        void* old_client_data;
-        hid_t error_stack = 0;
-        H5Eget_auto(error_stack, &old_func, &old_client_data);
-
-        // turn off error handling
-        H5Eset_auto(error_stack, NULL, NULL);
+  double box_size = 0;
+  int n_files = 0;
+
+  if (mpi_rank == 0) {
+    char fname[STRLEN];
+    vr_grid_fname(fname, property, snapshot, 0);
+    hid_t file_id = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
+
+    // save current error stack
+    herr_t (*old_func)(long long, void*);
+    void* old_client_data;
+    hid_t error_stack = 0;
+    H5Eget_auto(error_stack, &old_func, &old_client_data);
+
+    // turn off error handling
+    H5Eset_auto(error_stack, NULL, NULL);
+
+    herr_t status = H5LTget_attribute_int(file_id, "/", "Num_files", &n_files);
+
+    // restore error handling
+    H5Eset_auto(error_stack, old_func, old_client_data);
+
+    // WARNING: This is a hack!  See the `vr_num_files_hack_`
+    // declaration above for details.
+    if (status >= 0) {
+      vr_num_files_hack_ = n_files;
+    } else {
+      assert(vr_num_files_hack_ > 0);
+      n_files = vr_num_files_hack_;
+    }
 
-        herr_t status = H5LTget_attribute_int(file_id, "/", "Num_files", &n_files);
+    status = H5LTget_attribute_double(file_id, "/", "BoxSize", &box_size);
+    assert(status >= 0);
 
-        // restore error handling
-        H5Eset_auto(error_stack, old_func, old_client_data);
+    status = H5LTget_attribute_int(file_id, "/", "Ngrid_X", file_n_cell);
+    assert(status >= 0);
+    status = H5LTget_attribute_int(file_id, "/", "Ngrid_Y", file_n_cell + 1);
+    assert(status >= 0);
+    status = H5LTget_attribute_int(file_id, "/", "Ngrid_Z", file_n_cell + 2);
+    assert(status >= 0);
 
-        // WARNING: This is a hack!  See the `vr_num_files_hack_`
-        // declaration above for details.
-        if (status >= 0) {
-          vr_num_files_hack_ = n_files;
-        } else {
-          assert(vr_num_files_hack_ > 0);
-          n_files = vr_num_files_hack_;
-        }
+    H5Fclose(file_id);
+  }
 
-        file_nx = calloc(n_files, sizeof(int));
-        file_ix_start = calloc(n_files, sizeof(int));
+  MPI_Bcast(&n_files, 1, MPI_INT, 0, run_globals.mpi_comm);
+  MPI_Bcast(&box_size, 1, MPI_DOUBLE, 0, run_globals.mpi_comm);
+  MPI_Bcast(file_n_cell, 3, MPI_INT, 0, run_globals.mpi_comm);
 
-        status = H5LTget_attribute_double(file_id, "/", "BoxSize", &box_size);
-        assert(status >= 0);
+  // read in the number of x values and offsets from the grid files this rank owns and share them
+  // nx : number of x-dim values
+  // ix_start : first x index
+  int* file_nx = calloc((size_t)n_files, sizeof(int));
+  int* file_ix_start = calloc((size_t)n_files, sizeof(int));
 
-        status = H5LTget_attribute_int(file_id, "/", "Ngrid_X", file_n_cell);
-        assert(status >= 0);
-        status = H5LTget_attribute_int(file_id, "/", "Ngrid_Y", file_n_cell + 1);
-        assert(status >= 0);
-        status = H5LTget_attribute_int(file_id, "/", "Ngrid_Z", file_n_cell + 2);
-        assert(status >= 0);
-      }
+  for (int ii = 0; ii < n_files; ii++) {
+    if (vr_file_owner(ii, n_files) != mpi_rank)
+      continue;
 
-      herr_t status = H5LTget_attribute_int(file_id, "/", "Local_x_start", file_ix_start + ii);
-      assert(status >= 0);
-      status = H5LTget_attribute_int(file_id, "/", "Local_nx", file_nx + ii);
-      assert(status >= 0);
+    char fname[STRLEN];
+    vr_grid_fname(fname, property, snapshot, ii);
+    hid_t file_id = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
 
-      H5Fclose(file_id);
-    }
+    herr_t status = H5LTget_attribute_int(file_id, "/", "Local_x_start", file_ix_start + ii);
+    assert(status >= 0);
+    status = H5LTget_attribute_int(file_id, "/", "Local_nx", file_nx + ii);
+    assert(status >= 0);
 
-    H5Pclose(plist_id);
+    H5Fclose(file_id);
   }
 
+  MPI_Allreduce(MPI_IN_PLACE, file_nx, n_files, MPI_INT, MPI_SUM, run_globals.mpi_comm);
+  MPI_Allreduce(MPI_IN_PLACE, file_ix_start, n_files, MPI_INT, MPI_SUM, run_globals.mpi_comm);
+
   assert((file_n_cell[0] == file_n_cell[1]) && (file_n_cell[1] == file_n_cell[2]) && "Input grids are not cubic!");
 
   mlog("Reading VELOCIraptor grid for snapshot %d", MLOG_OPEN | MLOG_TIMERSTART, snapshot);
@@ -343,9 +377,6 @@ static int read_vr_multi(const enum grid_prop property, const int snapshot, floa
 
   double resample_factor = calc_resample_factor(file_n_cell);
 
-  int mpi_size = run_globals.mpi_size;
-  int mpi_rank = run_globals.mpi_rank;
-
   // Malloc the slab for this rank we need given the dimensionality of the input file grid.
   // nI : total number of complex values in slab on this rank
   // nR : total number of real values in slab on this rank
@@ -379,42 +410,27 @@ static int read_vr_multi(const enum grid_prop property, const int snapshot, floa
   for (int ii = 0; ii < rank_nI[mpi_rank]; ii++)
     rank_slab[ii] = 0 + 0 * I;
 
-  MPI_Group run_group;
-  MPI_Comm_group(MPI_COMM_WORLD, &run_group);
-
-  // We are currently assuming the grids to be float, but the VELOCIraptor
-  // grids are doubles.  For the moment, let's just read the doubles into a
-  // buffer and change them to float appropriately.
-  double* local_buffer = calloc((size_t)(rank_nx[mpi_rank] * file_n_cell[1] * file_n_cell[2]), sizeof(double));
-
-  // loop through each file and work out what cores are needed
-  int n_required_ranks[n_files];
-  bool rank_used[n_files];
-  int required_ranks[n_files * mpi_size];
+  // Both the senders and receivers walk through the files in x order, so that the planes from each file arrive in
+  // the order they were packed.
+  size_t* file_order = malloc(sizeof(size_t) * (size_t)n_files);
+  gsl_sort_int_index(file_order, file_ix_start, 1, (const size_t)n_files);
 
-#define rr_index(ii, jj) ((ii) * (mpi_size) + (jj))
-
-  for (int ii = 0; ii < n_files; ii++) {
+  // All counts are in x-planes
+  size_t plane_size = (size_t)file_n_cell[1] * (size_t)file_n_cell[2];
+  int sendcounts[mpi_size];
+  int sdispls[mpi_size];
+  int recvcounts[mpi_size];
+  int rdispls[mpi_size];
 
-    n_required_ranks[ii] = 0;
-    rank_used[ii] = false;
+  // Any rank sends or receives at most window_nx planes in each round
+  int window_nx = 1;
+  for (int ii = 0; ii < mpi_size; ii++)
+    if (rank_nx[ii] > window_nx)
+      window_nx = (int)rank_nx[ii];
+  int n_rounds = (file_n_cell[0] + window_nx - 1) / window_nx;
 
-    for (int jj = 0; jj < mpi_size; jj++)
-      required_ranks[rr_index(ii, jj)] = -1;
-
-    for (int jj = 0; jj < mpi_size; jj++) {
-      if ((rank_ix_start[jj] < (file_ix_start[ii] + file_nx[ii])) &&
-          (file_ix_start[ii] < (rank_ix_start[jj] + rank_nx[jj]))) {
-        required_ranks[rr_index(ii, n_required_ranks[ii]++)] = jj;
-        if (jj == mpi_rank)
-          rank_used[ii] = true;
-      }
-    }
-  }
-
-  // sort the files by n_required_ranks
-  size_t sort_ind[n_files];
-  gsl_sort_int_index(sort_ind, n_required_ranks, 1, (const size_t)n_files);
+  float* send_buffer = malloc(sizeof(float) * plane_size * (size_t)window_nx);
+  float* recv_buffer = malloc(sizeof(float) * plane_size * (size_t)window_nx);
 
   char dset_name[32];
   switch (property) {
@@ -435,100 +451,125 @@ static int read_vr_multi(const enum grid_prop property, const int snapshot, floa
       break;
   }
 
-  for (int jj = 0; jj < n_files; jj++) {
-    int ii = (int)sort_ind[jj];
-
-    // read in the data
-    // create an mpi communicator with the required ranks
-    if (rank_used[ii]) {
-      MPI_Group file_group;
-      MPI_Group_incl(run_group, n_required_ranks[ii], required_ranks + rr_index(ii, 0), &file_group);
-
-      MPI_Comm file_comm;
-      MPI_Comm_create_group(MPI_COMM_WORLD, file_group, ii, &file_comm);
-
-      // There must be a tidier work out these indices...
-      int file_start = 0;
-      int rank_start = 0;
-      int ix_diff = (int)(rank_ix_start[mpi_rank] - file_ix_start[ii]);
-      if (ix_diff >= 0) {
-        file_start = ix_diff;
-      } else {
-        rank_start = -ix_diff;
-      }
-      int nx = (int)MIN(file_nx[ii] - file_start, rank_nx[mpi_rank] - rank_start);
-
-      // select a hyperslab in the filespace
-      hid_t fspace_id =
-        H5Screate_simple(1, (hsize_t[1]){ (hsize_t)(file_nx[ii] * file_n_cell[1] * file_n_cell[2]) }, NULL);
-      H5Sselect_hyperslab(fspace_id,
-                          H5S_SELECT_SET,
-                          (hsize_t[1]){ (hsize_t)(file_start * file_n_cell[1] * file_n_cell[2]) },
-                          NULL,
-                          (hsize_t[1]){ (hsize_t)(nx * file_n_cell[1] * file_n_cell[2]) },
-                          NULL);
-
-      // create the memspace
-      hid_t memspace_id =
-        H5Screate_simple(1, (hsize_t[1]){ (hsize_t)(rank_nx[mpi_rank] * file_n_cell[1] * file_n_cell[1]) }, NULL);
-      H5Sselect_hyperslab(memspace_id,
-                          H5S_SELECT_SET,
-                          (hsize_t[1]){ (hsize_t)(rank_start * file_n_cell[1] * file_n_cell[2]) },
-                          NULL,
-                          (hsize_t[1]){ (hsize_t)(nx * file_n_cell[1] * file_n_cell[2]) },
-                          NULL);
-
-      hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
-      H5Pset_fapl_mpio(plist_id, file_comm, MPI_INFO_NULL);
-
-      char fname[STRLEN];
-      switch (property) {
-        case X_VELOCITY:
-        case Y_VELOCITY:
-        case Z_VELOCITY:
-          sprintf(fname, fname_base, params->SimulationDir, snapshot, "vel", ii);
-          break;
-        case DENSITY:
-          sprintf(fname, fname_base, params->SimulationDir, snapshot, "den", ii);
-          break;
-        default:
-          mlog_error("Unrecognised grid property in read_grid__velociraptor!");
-          break;
-      }
-
-      hid_t file_id = H5Fopen(fname, H5F_ACC_RDONLY, plist_id);
-      H5Pclose(plist_id);
+  MPI_Datatype plane_type;
+  MPI_Type_contiguous((int)plane_size, MPI_FLOAT, &plane_type);
+  MPI_Type_commit(&plane_type);
 
-      hid_t dset_id = H5Dopen(file_id, dset_name, H5P_DEFAULT);
+  for (int i_round = 0; i_round < n_rounds; i_round++) {
+    int window_ix_start = i_round * window_nx;
 
-      plist_id = H5Pcreate(H5P_DATASET_XFER);
+    for (int ii = 0; ii < mpi_size; ii++) {
+      sendcounts[ii] = 0;
+      recvcounts[ii] = 0;
+    }
 
-      H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE);
+    for (int ii = 0; ii < n_files; ii++) {
+      int owner = vr_file_owner(ii, n_files);
+      int ix_start;
+      int nx = vr_overlap(file_ix_start[ii], file_nx[ii], window_ix_start, window_nx, &ix_start);
+      if (nx == 0)
+        continue;
+
+      int unused;
+      if (owner == mpi_rank)
+        for (int jj = 0; jj < mpi_size; jj++)
+          sendcounts[jj] += vr_overlap(ix_start, nx, rank_ix_start[jj], rank_nx[jj], &unused);
+      recvcounts[owner] += vr_overlap(ix_start, nx, rank_ix_start[mpi_rank], rank_nx[mpi_rank], &unused);
+    }
 
-      H5Dread(dset_id, H5T_NATIVE_DOUBLE, memspace_id, fspace_id, plist_id, local_buffer);
+    sdispls[0] = 0;
+    rdispls[0] = 0;
+    for (int ii = 1; ii < mpi_size; ii++) {
+      sdispls[ii] = sdispls[ii - 1] + sendcounts[ii - 1];
+      rdispls[ii] = rdispls[ii - 1] + recvcounts[ii - 1];
+    }
 
-      H5Pclose(plist_id);
+    // read the planes in this window needed by each rank from the files we own directly into the send buffer
+    {
+      int offset[mpi_size];
+      memcpy(offset, sdispls, sizeof(int) * mpi_size);
+
+      for (int i_order = 0; i_order < n_files; i_order++) {
+        int ii = (int)file_order[i_order];
+        int window_start;
+        int window_n = vr_overlap(file_ix_start[ii], file_nx[ii], window_ix_start, window_nx, &window_start);
+        if ((vr_file_owner(ii, n_files) != mpi_rank) || (window_n == 0))
+          continue;
+
+        char fname[STRLEN];
+        vr_grid_fname(fname, property, snapshot, ii);
+        hid_t file_id = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
+        hid_t dset_id = H5Dopen(file_id, dset_name, H5P_DEFAULT);
+        hid_t fspace_id = H5Screate_simple(1, (hsize_t[1]){ (hsize_t)file_nx[ii] * plane_size }, NULL);
+
+        for (int jj = 0; jj < mpi_size; jj++) {
+          int ix_start;
+          int nx = vr_overlap(window_start, window_n, rank_ix_start[jj], rank_nx[jj], &ix_start);
+          if (nx == 0)
+            continue;
+
+          H5Sselect_hyperslab(fspace_id,
+                              H5S_SELECT_SET,
+                              (hsize_t[1]){ (hsize_t)(ix_start - file_ix_start[ii]) * plane_size },
+                              NULL,
+                              (hsize_t[1]){ (hsize_t)nx * plane_size },
+                              NULL);
+          hid_t memspace_id = H5Screate_simple(1, (hsize_t[1]){ (hsize_t)nx * plane_size }, NULL);
+
+          float* dest = send_buffer + (size_t)offset[jj] * plane_size;
+          H5Dread(dset_id, H5T_NATIVE_FLOAT, memspace_id, fspace_id, H5P_DEFAULT, dest);
+
+          H5Sclose(memspace_id);
+          offset[jj] += nx;
+        }
 
-      H5Dclose(dset_id);
-      H5Fclose(file_id);
-      H5Sclose(memspace_id);
-      H5Sclose(fspace_id);
+        H5Sclose(fspace_id);
+        H5Dclose(dset_id);
+        H5Fclose(file_id);
+      }
+    }
 
-      MPI_Comm_free(&file_comm);
-      MPI_Group_free(&file_group);
+    // route the planes to their owners
+    MPI_Alltoallv(send_buffer,
+                  sendcounts,
+                  sdispls,
+                  plane_type,
+                  recv_buffer,
+                  recvcounts,
+                  rdispls,
+                  plane_type,
+                  run_globals.mpi_comm);
+
+    // unpack the received planes into the slab, with inplace fftw padding
+    {
+      int offset[mpi_size];
+      memcpy(offset, rdispls, sizeof(int) * mpi_size);
+
+      for (int i_order = 0; i_order < n_files; i_order++) {
+        int ii = (int)file_order[i_order];
+        int owner = vr_file_owner(ii, n_files);
+        int window_start;
+        int window_n = vr_overlap(file_ix_start[ii], file_nx[ii], window_ix_start, window_nx, &window_start);
+        int ix_start;
+        int nx = vr_overlap(window_start, window_n, rank_ix_start[mpi_rank], rank_nx[mpi_rank], &ix_start);
+
+        for (int i_plane = 0; i_plane < nx; i_plane++) {
+          const float* src = recv_buffer + (size_t)(offset[owner] + i_plane) * plane_size;
+          int ix = ix_start - (int)rank_ix_start[mpi_rank] + i_plane;
+          for (int jj = 0; jj < file_n_cell[1]; ++jj)
+            memcpy((float*)rank_slab + grid_index(ix, jj, 0, file_n_cell[1], INDEX_PADDED),
+                   src + (size_t)jj * (size_t)file_n_cell[2],
+                   sizeof(float) * (size_t)file_n_cell[2]);
+        }
+        offset[owner] += nx;
+      }
     }
   }
 
-  MPI_Group_free(&run_group);
-
-  // move the doubles into the float array, with inplace fftw padding
-  for (int ii = 0; ii < rank_nx[mpi_rank]; ++ii)
-    for (int jj = 0; jj < file_n_cell[1]; ++jj)
-      for (int kk = 0; kk < file_n_cell[2]; ++kk)
-        ((float*)rank_slab)[grid_index(ii, jj, kk, file_n_cell[1], INDEX_PADDED)] =
-          (float)(local_buffer[grid_index(ii, jj, kk, file_n_cell[1], INDEX_REAL)]);
-
-  free(local_buffer);
+  MPI_Type_free(&plane_type);
+  free(send_buffer);
+  free(recv_buffer);
+  free(file_order);
   free(file_ix_start);
   free(file_nx);
 
@@ -2,10 +2,13 @@
 #include <complex.h>
 #include <fftw3-mpi.h>
 
+#include "cache_codec.h"
+#include "fft_plans.h"
 #include "meraxes.h"
 #include "misc_tools.h"
 #include "read_grids.h"
 #include "reionization.h"
+#include "shared_tables.h"
 #include <string.h>
 
 #if USE_MINI_HALOS
@@ -132,14 +135,9 @@ void smooth_grid(double resample_factor,
                  ptrdiff_t slab_ix_start,
                  ptrdiff_t slab_nix)
 {
-  // TODO: Use wisdom and FFTW_PATIENT planning for this if requested (cf. malloc_reionisation_grids())
-
   if (resample_factor < 1.0) {
     mlog("Smoothing hi-res grid...", MLOG_OPEN | MLOG_TIMERSTART);
-    fftwf_plan plan = fftwf_mpi_plan_dft_r2c_3d(
-      n_cell[0], n_cell[1], n_cell[2], (float*)slab, slab, run_globals.mpi_comm, FFTW_ESTIMATE);
-    fftwf_execute(plan);
-    fftwf_destroy_plan(plan);
+    fft_execute_r2c_3d(n_cell[0], n_cell[1], n_cell[2], (float*)slab, slab);
 
     // Remember to add the factor of VOLUME/TOT_NUM_PIXELS when converting from
     // real space to k-space.
@@ -156,10 +154,7 @@ void smooth_grid(double resample_factor,
            (float)(run_globals.params.BoxSize / (double)run_globals.params.ReionGridDim / 2.0),
            0); // NOTE: Real space top-hat hard-coded for this
 
-    plan = fftwf_mpi_plan_dft_c2r_3d(
-      n_cell[0], n_cell[1], n_cell[2], slab, (float*)slab, run_globals.mpi_comm, FFTW_ESTIMATE);
-    fftwf_execute(plan);
-    fftwf_destroy_plan(plan);
+    fft_execute_c2r_3d(n_cell[0], n_cell[1], n_cell[2], slab, (float*)slab);
     mlog("...done", MLOG_CLOSE | MLOG_TIMERSTOP);
   }
 }
@@ -286,8 +281,33 @@ void subsample_grid(double resample_factor, int n_cell[3], int ix_hi_start, int
   free(ix_hi_start_allranks);
 }
 
+// When FlagSharedGridsCache is set, the cached slabs live in MPI-3 shared memory windows which are shared between
+// all of the processes on a node which hold an identical slab (i.e. the same rank of independent model instances
+// running on the same simulation, as is typical for MCMC campaigns).
+static MPI_Comm grids_cache_comm = MPI_COMM_NULL;
+static MPI_Win* grids_cache_windows = NULL;
+
+// When FlagCompressCaches is set, the cached slabs are stored compressed (see CacheGridsTolerance) instead.
+static void** grids_cache_blocks = NULL;
+
+static inline int cache_window_index(int snapshot, const enum grid_prop property)
+{
+  return snapshot * 2 + (property == DENSITY ? 0 : 1);
+}
+
 int load_cached_slab(float* slab, int snapshot, const enum grid_prop property)
 {
+  if (grids_cache_blocks != NULL) {
+    void* block = grids_cache_blocks[cache_window_index(snapshot, property)];
+    if (block == NULL)
+      return 1;
+
+    ptrdiff_t slab_n_complex = run_globals.reion_grids.slab_n_complex[run_globals.mpi_rank];
+    decompress_cache_floats(block, slab, (size_t)(slab_n_complex * 2));
+    mlog("Loaded compressed slab from cache.", MLOG_MESG);
+    return 0;
+  }
+
   float* cache = NULL;
   switch (property) {
     case DENSITY:
@@ -312,8 +332,75 @@ int load_cached_slab(float* slab, int snapshot, const enum grid_prop property)
     return 1;
 }
 
+// N.B. Only the data of the first process in the group is used, so the others may pass NULL
+static void* alloc_shared_cache(const void* data, ptrdiff_t mem_size, MPI_Win* win)
+{
+  int share_rank = 0;
+  void* cache = NULL;
+
+  MPI_Comm_rank(grids_cache_comm, &share_rank);
+
+  // only the first process in each group holds the memory
+  MPI_Aint win_size = (share_rank == 0) ? (MPI_Aint)mem_size : 0;
+  MPI_Win_allocate_shared(win_size, sizeof(float), MPI_INFO_NULL, grids_cache_comm, &cache, win);
+
+  if (share_rank != 0) {
+    int disp_unit = 0;
+    MPI_Win_shared_query(*win, 0, &win_size, &disp_unit, &cache);
+  }
+
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+  if (share_rank == 0)
+    memcpy(cache, data, (size_t)mem_size);
+  MPI_Win_sync(*win);
+  MPI_Barrier(grids_cache_comm);
+  MPI_Win_sync(*win);
+  MPI_Win_unlock_all(*win);
+
+  return cache;
+}
+
+static int cache_compressed_slab(float* slab, int snapshot, const enum grid_prop property)
+{
+  int i_block = cache_window_index(snapshot, property);
+  if (grids_cache_blocks[i_block] != NULL)
+    return 1;
+
+  ptrdiff_t slab_n_complex = run_globals.reion_grids.slab_n_complex[run_globals.mpi_rank];
+  int share_rank = 0;
+  if (grids_cache_comm != MPI_COMM_NULL)
+    MPI_Comm_rank(grids_cache_comm, &share_rank);
+
+  // only the process which holds the shared memory needs to compress the slab
+  void* block = NULL;
+  size_t block_size = 0;
+  if (share_rank == 0)
+    block_size =
+      compress_cache_floats(slab, (size_t)(slab_n_complex * 2), run_globals.params.CacheGridsTolerance, &block);
+
+  if (grids_cache_comm != MPI_COMM_NULL) {
+    grids_cache_blocks[i_block] = alloc_shared_cache(block, (ptrdiff_t)block_size, &grids_cache_windows[i_block]);
+    free(block);
+  } else
+    grids_cache_blocks[i_block] = block;
+
+  if (share_rank != 0)
+    return 0;
+
+  mlog("Compressed cached slab by a factor of %.1f.",
+       MLOG_MESG,
+       (double)(sizeof(float) * slab_n_complex * 2) / (double)block_size);
+  return 0;
+}
+
 int cache_slab(float* slab, int snapshot, const enum grid_prop property)
 {
+  if (run_globals.params.FlagCompressCaches) {
+    if (grids_cache_blocks == NULL)
+      grids_cache_blocks = calloc(2 * (size_t)run_globals.NStoreSnapshots, sizeof(void*));
+    return cache_compressed_slab(slab, snapshot, property);
+  }
+
   float** cache = NULL;
   switch (property) {
     case DENSITY:
@@ -328,29 +415,141 @@ int cache_slab(float* slab, int snapshot, const enum grid_prop property)
       mlog_error("Unrecognised grid property in load_cached_slab!");
       break;
   }
-  if (cache == NULL) {
+  if ((cache != NULL) && (*cache == NULL)) {
     ptrdiff_t slab_n_complex = run_globals.reion_grids.slab_n_complex[run_globals.mpi_rank];
     ptrdiff_t mem_size = sizeof(float) * slab_n_complex * 2;
 
-    *cache = fftwf_alloc_real((size_t)mem_size);
-    memcpy(*cache, slab, mem_size);
+    if (grids_cache_comm != MPI_COMM_NULL)
+      *cache = alloc_shared_cache(slab, mem_size, &grids_cache_windows[cache_window_index(snapshot, property)]);
+    else {
+      *cache = fftwf_alloc_real((size_t)(slab_n_complex * 2));
+      memcpy(*cache, slab, mem_size);
+    }
     return 0;
   } else
     return 1;
 }
 
+// Everything which determines the contents of a cached slab.  Processes only share a cache if these agree exactly.
+typedef struct
+{
+  char SimulationDir[STRLEN];
+  int TreesID;
+  int ReionGridDim;
+  int mpi_size;
+  int mpi_rank;
+  int n_store_snapshots;
+  int velocity_component;
+  int FlagCompressCaches;
+  double CacheGridsTolerance;
+  double BoxSize;
+  double Hubble_h;
+  double PartMass;
+  long long NPart;
+} grids_cache_key_t;
+
+static void set_grids_cache_key(grids_cache_key_t* key)
+{
+  run_params_t* params = &(run_globals.params);
+  bool cache_vel = params->Flag_IncludeSpinTemp && (params->Flag_IncludePecVelsFor21cm > 0);
+
+  // N.B. zeroed first so that the unused bytes of the string are identical on every process
+  memset(key, 0, sizeof(grids_cache_key_t));
+  strncpy(key->SimulationDir, params->SimulationDir, STRLEN - 1);
+  key->TreesID = (int)params->TreesID;
+  key->ReionGridDim = params->ReionGridDim;
+  key->mpi_size = run_globals.mpi_size;
+  key->mpi_rank = run_globals.mpi_rank;
+  key->n_store_snapshots = run_globals.NStoreSnapshots;
+  key->velocity_component = cache_vel ? params->TsVelocityComponent : 0;
+  key->FlagCompressCaches = params->FlagCompressCaches;
+  key->CacheGridsTolerance = params->FlagCompressCaches ? params->CacheGridsTolerance : 0.0;
+  key->BoxSize = params->BoxSize;
+  key->Hubble_h = params->Hubble_h;
+  key->PartMass = params->PartMass;
+  key->NPart = params->NPart;
+}
+
+//! Split the processes on this node into groups which hold exactly the same slabs
+static void create_grids_cache_comm()
+{
+  grids_cache_key_t key;
+  set_grids_cache_key(&key);
+  grids_cache_comm = create_shared_cache_comm(&key, sizeof(grids_cache_key_t));
+}
+
+//! Read and cache the grids of every snapshot in node-shared memory
+void preload_shared_grids_cache()
+{
+  run_params_t* params = &(run_globals.params);
+  int n_store_snapshots = run_globals.NStoreSnapshots;
+  bool cache_vel = params->Flag_IncludeSpinTemp && (params->Flag_IncludePecVelsFor21cm > 0);
+
+  mlog("Preloading grids into node-shared cache...", MLOG_OPEN | MLOG_TIMERSTART);
+
+  // Processes can only share a cache if they hold exactly the same slabs, i.e. the same rank of independent model
+  // instances running on the same simulation.  The ranks of a single instance hold different slabs, so a lone
+  // instance has nothing to share.
+  create_grids_cache_comm();
+
+  int share_rank = 0;
+  int n_sharing = 0;
+  MPI_Comm_rank(grids_cache_comm, &share_rank);
+  MPI_Comm_size(grids_cache_comm, &n_sharing);
+  MPI_Allreduce(MPI_IN_PLACE, &n_sharing, 1, MPI_INT, MPI_MAX, run_globals.mpi_comm);
+  mlog("Up to %d processes share each cached slab.", MLOG_MESG, n_sharing);
+
+  // Only the first process of each group reads its slab from disk, and the rest of the group picks it up through the
+  // shared window.  N.B. Reading is collective over the whole model instance, so an instance reads if any one of its
+  // processes heads a group.
+  int instance_reads = (share_rank == 0);
+  MPI_Allreduce(MPI_IN_PLACE, &instance_reads, 1, MPI_INT, MPI_LOR, run_globals.mpi_comm);
+
+  grids_cache_windows = malloc(sizeof(MPI_Win) * 2 * (size_t)n_store_snapshots);
+  for (int ii = 0; ii < 2 * n_store_snapshots; ii++)
+    grids_cache_windows[ii] = MPI_WIN_NULL;
+
+  // read_grid will cache every slab as it is read
+  float* slab = fftwf_alloc_real((size_t)run_globals.reion_grids.slab_n_complex[run_globals.mpi_rank] * 2);
+  for (int snapshot = 0; snapshot < n_store_snapshots; snapshot++) {
+    if (instance_reads) {
+      read_grid(DENSITY, snapshot, slab);
+      if (cache_vel)
+        read_grid(params->TsVelocityComponent, snapshot, slab);
+    } else {
+      cache_slab(NULL, snapshot, DENSITY);
+      if (cache_vel)
+        cache_slab(NULL, snapshot, params->TsVelocityComponent);
+    }
+  }
+  fftwf_free(slab);
+
+  mlog("...done", MLOG_CLOSE | MLOG_TIMERSTOP);
+}
+
 void free_grids_cache()
 {
   if (run_globals.params.Flag_PatchyReion) {
     float** snapshot_vel = run_globals.SnapshotVel;
     float** snapshot_deltax = run_globals.SnapshotDeltax;
 
-    if (run_globals.params.FlagInteractive)
+    if (grids_cache_comm != MPI_COMM_NULL) {
+      for (int ii = 0; ii < 2 * run_globals.NStoreSnapshots; ii++)
+        if (grids_cache_windows[ii] != MPI_WIN_NULL)
+          MPI_Win_free(&grids_cache_windows[ii]);
+      free(grids_cache_windows);
+      MPI_Comm_free(&grids_cache_comm);
+    } else if (grids_cache_blocks != NULL) {
+      for (int ii = 0; ii < 2 * run_globals.NStoreSnapshots; ii++)
+        free(grids_cache_blocks[ii]);
+    } else if (run_globals.params.FlagInteractive || run_globals.params.FlagMCMC)
       for (int ii = 0; ii < run_globals.NStoreSnapshots; ii++) {
         fftwf_free(snapshot_vel[ii]);
         fftwf_free(snapshot_deltax[ii]);
       }
 
+    free(grids_cache_blocks);
+    grids_cache_blocks = NULL;
     free(snapshot_vel);
     free(snapshot_deltax);
   }
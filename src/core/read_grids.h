@@ -38,6 +38,7 @@ extern "C"
   int cache_slab(float* slab, int snapshot, const enum grid_prop property);
   int read_grid__gbptrees(const enum grid_prop property, const int snapshot, float* slab);
   int read_grid__velociraptor(const enum grid_prop property, const int snapshot, float* slab);
+  void preload_shared_grids_cache(void);
   void free_grids_cache(void);
 
 #ifdef __cplusplus
@@ -1,7 +1,11 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <hdf5_hl.h>
 #include <math.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "meraxes.h"
 #include "misc_tools.h"
@@ -107,12 +111,106 @@ static void halo_catalog_filename(char* simulation_dir,
       fname, "%s/catalogs/%s_%03d.catalog_%s_properties", simulation_dir, catalog_file_prefix, snapshot, group_type);
 }
 
-static void inline read_catalogs_header(FILE* fin, int* i_file, int* n_files, int* n_halos_file, int* n_halos_total)
+/*
+ * Catalogue files are mapped into memory (or, if that isn't possible, read with a single large read) and then copied
+ * from in large blocks, rather than being read with many small freads.  When a file is opened, the kernel is asked
+ * to start reading the next one in the background.
+ */
+typedef struct catalog_file_t
 {
-  fread(i_file, sizeof(int), 1, fin);
-  fread(n_files, sizeof(int), 1, fin);
-  fread(n_halos_file, sizeof(int), 1, fin);
-  fread(n_halos_total, sizeof(int), 1, fin);
+  char* data;
+  size_t size;
+  size_t pos;
+  bool mapped;
+} catalog_file_t;
+
+static void open_catalog_file(catalog_file_t* file, const char* fname)
+{
+  int fd = open(fname, O_RDONLY);
+  struct stat file_stat;
+  if ((fd < 0) || (fstat(fd, &file_stat) != 0)) {
+    mlog("Failed to open file %s", MLOG_MESG, fname);
+    ABORT(34494);
+  }
+
+  file->size = (size_t)file_stat.st_size;
+  file->pos = 0;
+  file->mapped = false;
+
+  if (file->size > 0) {
+    void* data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      madvise(data, file->size, MADV_SEQUENTIAL);
+      file->data = data;
+      file->mapped = true;
+    }
+  }
+
+  if (!file->mapped) {
+    file->data = malloc(file->size > 0 ? file->size : 1);
+    size_t n_read = 0;
+    while (n_read < file->size) {
+      ssize_t n_bytes = read(fd, file->data + n_read, file->size - n_read);
+      if (n_bytes <= 0) {
+        mlog_error("Failed to read file %s", fname);
+        ABORT(EXIT_FAILURE);
+      }
+      n_read += (size_t)n_bytes;
+    }
+  }
+
+  close(fd);
+}
+
+static void close_catalog_file(catalog_file_t* file)
+{
+  if (file->mapped)
+    munmap(file->data, file->size);
+  else
+    free(file->data);
+
+  file->data = NULL;
+  file->size = 0;
+  file->pos = 0;
+  file->mapped = false;
+}
+
+static void prefetch_catalog_file(const char* fname)
+{
+  int fd = open(fname, O_RDONLY);
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+}
+
+static void read_catalog_bytes(catalog_file_t* file, void* dest, size_t n_bytes)
+{
+  if (file->pos + n_bytes > file->size) {
+    mlog_error("Unexpected end of catalogue file (wanted %zu bytes at offset %zu of %zu)!",
+               n_bytes,
+               file->pos,
+               file->size);
+    ABORT(EXIT_FAILURE);
+  }
+
+  memcpy(dest, file->data + file->pos, n_bytes);
+  file->pos += n_bytes;
+}
+
+static void inline read_catalogs_header(catalog_file_t* fin,
+                                        int* i_file,
+                                        int* n_files,
+                                        int* n_halos_file,
+                                        int* n_halos_total)
+{
+  int header[4];
+  read_catalog_bytes(fin, header, sizeof(header));
+
+  *i_file = header[0];
+  *n_files = header[1];
+  *n_halos_file = header[2];
+  *n_halos_total = header[3];
 }
 
 //! This is the structure for a halo in the catalog files
@@ -137,7 +235,31 @@ typedef struct catalog_halo_t
   char padding[8];                 //!< Alignment padding
 } catalog_halo_t;
 
-static void read_catalog_halos(FILE** fin,
+static void open_next_catalog_file(catalog_file_t* fin,
+                                   char* simulation_dir,
+                                   char* catalog_file_prefix,
+                                   int snapshot,
+                                   char* halo_type,
+                                   int* flayout_switch,
+                                   int i_file,
+                                   int* n_halos_file)
+{
+  char fname[STRLEN];
+  int dummy;
+  int n_files;
+
+  halo_catalog_filename(simulation_dir, catalog_file_prefix, snapshot, halo_type, i_file, flayout_switch, fname);
+  open_catalog_file(fin, fname);
+  read_catalogs_header(fin, &dummy, &n_files, n_halos_file, &dummy);
+
+  // read-ahead the next file (only layouts 0 and 2 are split over multiple files)
+  if (((*flayout_switch == 0) || (*flayout_switch == 2)) && (i_file + 1 < n_files)) {
+    halo_catalog_filename(simulation_dir, catalog_file_prefix, snapshot, halo_type, i_file + 1, flayout_switch, fname);
+    prefetch_catalog_file(fname);
+  }
+}
+
+static void read_catalog_halos(catalog_file_t* fin,
                                char* simulation_dir,
                                char* catalog_file_prefix,
                                int snapshot,
@@ -150,9 +272,7 @@ static void read_catalog_halos(FILE** fin,
                                int n_to_read,
                                int type_flag)
 {
-  char fname[STRLEN];
   char halo_type[10];
-  int dummy;
   int n_from_this_file;
 
   switch (type_flag) {
@@ -170,40 +290,29 @@ static void read_catalog_halos(FILE** fin,
   }
 
   // Is this the first read?
-  if ((*fin) == NULL) {
-    halo_catalog_filename(simulation_dir, catalog_file_prefix, snapshot, halo_type, *i_file, flayout_switch, fname);
-    *fin = fopen(fname, "rb");
-    if (*fin == NULL) {
-      mlog("Failed to open file %s", MLOG_MESG, fname);
-      ABORT(34494);
-    }
-    read_catalogs_header(*fin, &dummy, &dummy, n_halos_file, &dummy);
-  }
+  if (fin->data == NULL)
+    open_next_catalog_file(
+      fin, simulation_dir, catalog_file_prefix, snapshot, halo_type, flayout_switch, *i_file, n_halos_file);
 
   // Have we already read all the halos in this file?
   if ((*i_halo_in_file) >= (*n_halos_file)) {
-    fclose(*fin);
+    close_catalog_file(fin);
     (*i_file)++;
     (*i_halo_in_file) = 0;
-    halo_catalog_filename(simulation_dir, catalog_file_prefix, snapshot, halo_type, *i_file, flayout_switch, fname);
-    *fin = fopen(fname, "rb");
-    if (*fin == NULL) {
-      mlog("Failed to open file %s", MLOG_MESG, fname);
-      ABORT(34494);
-    }
-    read_catalogs_header(*fin, &dummy, &dummy, n_halos_file, &dummy);
+    open_next_catalog_file(
+      fin, simulation_dir, catalog_file_prefix, snapshot, halo_type, flayout_switch, *i_file, n_halos_file);
   }
 
   // Read in as many halos as we can from this file
   if ((*i_halo_in_file + n_to_read) <= *n_halos_file) {
-    fread(&(halo[*i_halo]), sizeof(catalog_halo_t), (size_t)n_to_read, *fin);
+    read_catalog_bytes(fin, &(halo[*i_halo]), sizeof(catalog_halo_t) * (size_t)n_to_read);
     *i_halo += n_to_read;
     *i_halo_in_file += n_to_read;
   } else {
     // read in as many as we can from this file and then get the rest from the next file
     n_from_this_file = (*n_halos_file) - *i_halo_in_file;
 
-    fread(&(halo[*i_halo]), sizeof(catalog_halo_t), (size_t)n_from_this_file, *fin);
+    read_catalog_bytes(fin, &(halo[*i_halo]), sizeof(catalog_halo_t) * (size_t)n_from_this_file);
     *i_halo += n_from_this_file;
     *i_halo_in_file += n_from_this_file;
     n_to_read -= n_from_this_file;
@@ -264,7 +373,7 @@ void read_trees__gbptrees(int snapshot,
   int n_to_read = 0;
   bool keep_flag;
 
-  FILE* fin_catalogs = NULL;
+  catalog_file_t fin_catalogs = { NULL, 0, 0, false };
   int flayout_switch = -1;
   int i_catalog_file = 0;
   int n_halos_in_catalog_file = 0;
@@ -272,7 +381,7 @@ void read_trees__gbptrees(int snapshot,
   int i_halo = 0;
   int Len;
 
-  FILE* fin_groups = NULL;
+  catalog_file_t fin_groups = { NULL, 0, 0, false };
   int group_flayout_switch = -1;
   int i_group_file = 0;
   int n_groups_in_catalog_file = 0;
@@ -319,8 +428,8 @@ void read_trees__gbptrees(int snapshot,
   sprintf(simulation_dir, "%s", run_globals.params.SimulationDir);
 
   tree_entry_t* tree_buffer;
-  tree_buffer = malloc(sizeof(tree_entry_t) * buffer_size);
-  catalog_buffer = malloc(sizeof(catalog_halo_t) * buffer_size);
+  tree_buffer = get_halo_read_buffer(HALO_BUFFER_TREES, sizeof(tree_entry_t) * buffer_size);
+  catalog_buffer = get_halo_read_buffer(HALO_BUFFER_CATALOG, sizeof(catalog_halo_t) * buffer_size);
 
   *n_halos_kept = 0;
   *n_fof_groups_kept = 0;
@@ -367,7 +476,7 @@ void read_trees__gbptrees(int snapshot,
     }
   MPI_Bcast(&group_buffer_size, 1, MPI_INT, 0, run_globals.mpi_comm);
   mlog("Using group buffer size = %d", MLOG_MESG, group_buffer_size);
-  group_buffer = malloc(sizeof(catalog_halo_t) * group_buffer_size);
+  group_buffer = get_halo_read_buffer(HALO_BUFFER_GROUPS, sizeof(catalog_halo_t) * group_buffer_size);
 
   // Now actually do the buffered read...
   n_read = 0;
@@ -522,15 +631,12 @@ void read_trees__gbptrees(int snapshot,
   if (run_globals.mpi_rank == 0) {
     H5Fclose(fd);
 
-    if (fin_catalogs)
-      fclose(fin_catalogs);
+    if (fin_catalogs.data != NULL)
+      close_catalog_file(&fin_catalogs);
+    if (fin_groups.data != NULL)
+      close_catalog_file(&fin_groups);
   }
 
-  // free the buffers
-  free(group_buffer);
-  free(catalog_buffer);
-  free(tree_buffer);
-
   mlog(" ...done", MLOG_CLOSE);
 }
 
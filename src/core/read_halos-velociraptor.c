@@ -1,8 +1,13 @@
 #include <assert.h>
 #include <hdf5_hl.h>
 #include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "debug.h"
+#include "memory_budget.h"
 #include "meraxes.h"
 #include "misc_tools.h"
 #include "modifiers.h"
@@ -95,6 +100,439 @@ inline static void convert_input_virial_props(double* Mvir,
     *Vvir = calculate_Vvir(*Mvir, *Rvir);
 }
 
+/*
+ * The forest cache.
+ *
+ * Reading the trees of a snapshot means reading every entry of the HDF5 trees, filtering them by forest and
+ * converting their virial properties, which is identical work for every run on the same simulation.  If
+ * ForestCacheDir is set, the first run to read each snapshot also converts every entry (on rank 0) and writes them to
+ * a binary file in forest order, along with an index of where each forest starts.  Later runs then only read the byte
+ * ranges of the forests they were assigned.
+ *
+ * A cache file is only used if it was built from the same trees file (path, size, modification time and the NHalos,
+ * mass unit and scale factor attributes) and if the parameters that the conversion depends on match those it was
+ * written with.  It is not used at all when mass ratio modifiers are applied.
+ */
+
+#define FOREST_CACHE_MAGIC "MRXFC02"
+#define N_FOREST_CACHE_KEYS 10
+
+//! A converted tree entry (everything needed to add it to the halo and fof group arrays)
+typedef struct forest_cache_halo_t
+{
+  double Mvir;
+  double Rvir;
+  double Vvir;
+  double FOFMvir;
+  double FOFRvir;
+  double FOFVvir;
+  double FOFMvirModifier;
+  float Pos[3];
+  float Vel[3];
+  float AngMom;
+  float Vmax;
+  unsigned long ID;
+  int FileIndex; //!< index of the entry in the input trees
+  int HostIndex; //!< index of the host halo in the input trees (-1 for centrals)
+  int DescIndex;
+  int SnapOffset;
+  int TreeFlags;
+  int Len;
+} forest_cache_halo_t;
+
+//! Identifies the trees file (and snapshot) that a cache was built from
+typedef struct forest_cache_source_t
+{
+  char trees_fname[STRLEN * 2 + 8];
+  long long file_size;
+  long long file_mtime;
+  int n_tree_entries;
+  double mass_unit_to_solarmass;
+  double scale_factor;
+} forest_cache_source_t;
+
+typedef struct forest_cache_header_t
+{
+  char magic[8];
+  int snapshot;
+  int n_forests;
+  long n_halos;
+  double key[N_FOREST_CACHE_KEYS];
+  forest_cache_source_t source;
+} forest_cache_header_t;
+
+typedef struct forest_cache_index_t
+{
+  long ForestID;
+  long first;
+  long n_halos;
+} forest_cache_index_t;
+
+typedef struct forest_cache_sort_t
+{
+  long ForestID;
+  int FileIndex;
+} forest_cache_sort_t;
+
+static bool forest_cache_enabled(void)
+{
+  return (strlen(run_globals.params.ForestCacheDir) > 0) && (run_globals.RequestedMassRatioModifier != 1);
+}
+
+static void forest_cache_fname(char* fname, int snapshot)
+{
+  sprintf(fname, "%s/forests_snap_%03d.bin", run_globals.params.ForestCacheDir, snapshot);
+}
+
+static void trees_fname(char* fname)
+{
+  switch (run_globals.params.TreesID) {
+    case VELOCIRAPTOR_TREES:
+      sprintf(fname, "%s/trees/%s", run_globals.params.SimulationDir, run_globals.params.CatalogFilePrefix);
+      break;
+    case VELOCIRAPTOR_TREES_AUG:
+      sprintf(fname, "%s/augmented_trees/%s", run_globals.params.SimulationDir, run_globals.params.CatalogFilePrefix);
+      break;
+    default:
+      mlog_error("Unrecognised input trees identifier (TreesID).");
+      break;
+  }
+}
+
+static void set_forest_cache_source(forest_cache_source_t* source,
+                                    const char* fname,
+                                    int n_tree_entries,
+                                    double mass_unit_to_solarmass,
+                                    double scale_factor)
+{
+  // N.B. zeroed first so that the unused bytes of the file name are identical in every cache
+  memset(source, 0, sizeof(forest_cache_source_t));
+  strncpy(source->trees_fname, fname, sizeof(source->trees_fname) - 1);
+
+  struct stat filestatus;
+  if (stat(fname, &filestatus) == 0) {
+    source->file_size = (long long)filestatus.st_size;
+    source->file_mtime = (long long)filestatus.st_mtime;
+  }
+
+  source->n_tree_entries = n_tree_entries;
+  source->mass_unit_to_solarmass = mass_unit_to_solarmass;
+  source->scale_factor = scale_factor;
+}
+
+//! Describe the current trees file (rank 0 only, as this opens the file serially)
+static void read_forest_cache_source(forest_cache_source_t* source, int snapshot)
+{
+  char fname[STRLEN * 2 + 8];
+  int n_tree_entries = -1;
+
+  // N.B. the same defaults as read_trees__velociraptor
+  double mass_unit_to_solarmass = 1.0e10;
+  double scale_factor = -999.;
+
+  trees_fname(fname);
+
+  hid_t fd = H5Fopen(fname, H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (fd >= 0) {
+    n_tree_entries = 0;
+    char snap_group_name[9];
+    sprintf(snap_group_name, "Snap_%03d", snapshot);
+    H5LTget_attribute_int(fd, snap_group_name, "NHalos", &n_tree_entries);
+    H5LTget_attribute_double(fd, "Header/Units", "Mass_unit_to_solarmass", &mass_unit_to_solarmass);
+    H5LTget_attribute_double(fd, snap_group_name, "scalefactor", &scale_factor);
+    H5Fclose(fd);
+  }
+
+  set_forest_cache_source(source, fname, n_tree_entries, mass_unit_to_solarmass, scale_factor);
+}
+
+static bool forest_cache_sources_equal(const forest_cache_source_t* a, const forest_cache_source_t* b)
+{
+  return (strcmp(a->trees_fname, b->trees_fname) == 0) && (a->file_size == b->file_size) &&
+         (a->file_mtime == b->file_mtime) && (a->n_tree_entries == b->n_tree_entries) &&
+         (a->mass_unit_to_solarmass == b->mass_unit_to_solarmass) && (a->scale_factor == b->scale_factor);
+}
+
+//! The parameters that the converted halo properties depend on
+static void forest_cache_key(double* key, int snapshot)
+{
+  run_params_t* params = &(run_globals.params);
+
+  key[0] = (double)params->TreesID;
+  key[1] = params->Hubble_h;
+  key[2] = params->BoxSize;
+  key[3] = params->OmegaM;
+  key[4] = params->OmegaK;
+  key[5] = params->OmegaLambda;
+  key[6] = params->PartMass;
+  key[7] = run_globals.ZZ[snapshot];
+  key[8] = (double)params->FlagIgnoreProgIndex;
+  key[9] = (double)sizeof(forest_cache_halo_t);
+}
+
+static int compare_forest_cache_sort(const void* a, const void* b)
+{
+  const forest_cache_sort_t* x = a;
+  const forest_cache_sort_t* y = b;
+
+  if (x->ForestID != y->ForestID)
+    return (x->ForestID > y->ForestID) - (x->ForestID < y->ForestID);
+  return (x->FileIndex > y->FileIndex) - (x->FileIndex < y->FileIndex);
+}
+
+static int compare_forest_cache_index(const void* a, const void* b)
+{
+  long id = *(const long*)a;
+  long other = ((const forest_cache_index_t*)b)->ForestID;
+
+  return (id > other) - (id < other);
+}
+
+static int compare_forest_cache_halos(const void* a, const void* b)
+{
+  int x = ((const forest_cache_halo_t*)a)->FileIndex;
+  int y = ((const forest_cache_halo_t*)b)->FileIndex;
+
+  return (x > y) - (x < y);
+}
+
+//! Write all of the converted entries of a snapshot in forest order (rank 0 only)
+static void write_forest_cache(int snapshot,
+                               const forest_cache_source_t* source,
+                               forest_cache_halo_t* records,
+                               const long* forest_ids,
+                               int n_halos)
+{
+  char fname[STRLEN + 32];
+  char tmp_fname[STRLEN + 40];
+
+  struct stat filestatus;
+  if (stat(run_globals.params.ForestCacheDir, &filestatus) != 0)
+    mkdir(run_globals.params.ForestCacheDir, 02755);
+
+  forest_cache_sort_t* order = malloc(sizeof(forest_cache_sort_t) * (size_t)(n_halos > 0 ? n_halos : 1));
+  for (int ii = 0; ii < n_halos; ii++)
+    order[ii] = (forest_cache_sort_t){ forest_ids[ii], ii };
+  qsort(order, (size_t)n_halos, sizeof(forest_cache_sort_t), compare_forest_cache_sort);
+
+  forest_cache_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FOREST_CACHE_MAGIC, sizeof(header.magic));
+  header.snapshot = snapshot;
+  header.n_halos = n_halos;
+  forest_cache_key(header.key, snapshot);
+  header.source = *source;
+
+  forest_cache_index_t* index = malloc(sizeof(forest_cache_index_t) * (size_t)(n_halos > 0 ? n_halos : 1));
+  for (int ii = 0; ii < n_halos; ii++) {
+    if ((ii == 0) || (order[ii].ForestID != order[ii - 1].ForestID))
+      index[header.n_forests++] = (forest_cache_index_t){ order[ii].ForestID, ii, 0 };
+    index[header.n_forests - 1].n_halos++;
+  }
+
+  // write to a temporary file first so that other runs never see a partial cache
+  forest_cache_fname(fname, snapshot);
+  sprintf(tmp_fname, "%s.%d", fname, (int)getpid());
+
+  FILE* fout = fopen(tmp_fname, "wb");
+  if (fout == NULL) {
+    mlog("Failed to open file %s (the forest cache will not be written).", MLOG_MESG, tmp_fname);
+    free(index);
+    free(order);
+    return;
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, fout) == 1;
+  ok = ok && (fwrite(index, sizeof(forest_cache_index_t), (size_t)header.n_forests, fout) == (size_t)header.n_forests);
+  for (int ii = 0; ok && (ii < n_halos); ii++)
+    ok = fwrite(&records[order[ii].FileIndex], sizeof(forest_cache_halo_t), 1, fout) == 1;
+  ok = (fclose(fout) == 0) && ok;
+
+  if (ok && (rename(tmp_fname, fname) == 0))
+    mlog("Wrote forest cache %s", MLOG_MESG, fname);
+  else {
+    mlog("Failed to write forest cache %s", MLOG_MESG, fname);
+    remove(tmp_fname);
+  }
+
+  free(index);
+  free(order);
+}
+
+//! Add a converted tree entry to the halo and fof group arrays
+static void add_tree_entry(const forest_cache_halo_t* entry,
+                           halo_t* halos,
+                           int* n_halos,
+                           fof_group_t* fof_groups,
+                           int* n_fof_groups,
+                           int* index_lookup)
+{
+  halo_t* halo = &(halos[*n_halos]);
+
+  halo->ID = entry->ID;
+  halo->DescIndex = entry->DescIndex;
+  halo->ProgIndex = -1;
+  halo->NextHaloInFOFGroup = NULL;
+  halo->Type = entry->HostIndex == -1 ? 0 : 1;
+  halo->SnapOffset = entry->SnapOffset;
+  halo->TreeFlags = entry->TreeFlags;
+
+  if (index_lookup)
+    index_lookup[*n_halos] = entry->FileIndex;
+
+  if (halo->Type == 0) {
+    fof_group_t* fof_group = &fof_groups[*n_fof_groups];
+
+    fof_group->Mvir = entry->FOFMvir;
+    fof_group->Rvir = entry->FOFRvir;
+    fof_group->Vvir = entry->FOFVvir;
+    fof_group->FOFMvirModifier = entry->FOFMvirModifier;
+
+    halo->FOFGroup = fof_group;
+    fof_groups[(*n_fof_groups)++].FirstHalo = halo;
+  } else {
+    // We can take advantage of the fact that host halos always
+    // seem to appear before their subhalos (checked below) in the
+    // trees to immediately connect FOF group members.
+    int host_index = entry->HostIndex;
+
+    if (index_lookup)
+      host_index = find_original_index(host_index, index_lookup, *n_halos);
+
+    assert(host_index > -1);
+    assert(host_index < *n_halos);
+
+    halo_t* prev_halo = &halos[host_index];
+    halo->FOFGroup = prev_halo->FOFGroup;
+
+    while (prev_halo->NextHaloInFOFGroup != NULL)
+      prev_halo = prev_halo->NextHaloInFOFGroup;
+
+    prev_halo->NextHaloInFOFGroup = halo;
+  }
+
+  halo->Len = entry->Len;
+  memcpy(halo->Pos, entry->Pos, sizeof(float) * 3);
+  memcpy(halo->Vel, entry->Vel, sizeof(float) * 3);
+  halo->Vmax = entry->Vmax;
+  halo->Mvir = entry->Mvir;
+  halo->Rvir = entry->Rvir;
+  halo->Vvir = entry->Vvir;
+  halo->AngMom = entry->AngMom;
+  halo->Galaxy = NULL;
+
+  (*n_halos)++;
+}
+
+//! Read this rank's forests from the forest cache (collective; returns false if there is no usable cache)
+static bool read_forest_cache(int snapshot,
+                              halo_t* halos,
+                              int* n_halos,
+                              fof_group_t* fof_groups,
+                              int* n_fof_groups,
+                              int* index_lookup)
+{
+  char fname[STRLEN + 32];
+  forest_cache_header_t header;
+  double key[N_FOREST_CACHE_KEYS];
+  bool usable = false;
+
+  forest_cache_fname(fname, snapshot);
+  forest_cache_key(key, snapshot);
+
+  forest_cache_source_t source;
+  if (run_globals.mpi_rank == 0)
+    read_forest_cache_source(&source, snapshot);
+  MPI_Bcast(&source, sizeof(forest_cache_source_t), MPI_BYTE, 0, run_globals.mpi_comm);
+
+  FILE* fin = fopen(fname, "rb");
+  if (fin != NULL)
+    usable = (fread(&header, sizeof(header), 1, fin) == 1) &&
+             (memcmp(header.magic, FOREST_CACHE_MAGIC, sizeof(header.magic)) == 0) && (header.snapshot == snapshot) &&
+             (memcmp(header.key, key, sizeof(key)) == 0) && forest_cache_sources_equal(&header.source, &source);
+
+  // the trees reader is collective, so either all ranks use the cache or none do
+  MPI_Allreduce(MPI_IN_PLACE, &usable, 1, MPI_C_BOOL, MPI_LAND, run_globals.mpi_comm);
+  if (!usable) {
+    if (fin != NULL) {
+      mlog("Forest cache %s was written from different trees or parameters and will be rewritten.", MLOG_MESG, fname);
+      fclose(fin);
+    }
+    return false;
+  }
+
+  forest_cache_index_t* index = malloc(sizeof(forest_cache_index_t) * (size_t)header.n_forests);
+  if (fread(index, sizeof(forest_cache_index_t), (size_t)header.n_forests, fin) != (size_t)header.n_forests) {
+    mlog_error("Failed to read the index of forest cache %s", fname);
+    ABORT(EXIT_FAILURE);
+  }
+  long records_start = (long)(sizeof(header) + sizeof(forest_cache_index_t) * (size_t)header.n_forests);
+
+  // flag the forests to be read
+  char* wanted = calloc((size_t)header.n_forests, sizeof(char));
+  long n_wanted = 0;
+  if (run_globals.RequestedForestId == NULL) {
+    memset(wanted, 1, (size_t)header.n_forests);
+    n_wanted = header.n_halos;
+  } else
+    for (int ii = 0; ii < run_globals.NRequestedForests; ii++) {
+      forest_cache_index_t* forest = bsearch(&(run_globals.RequestedForestId[ii]),
+                                             index,
+                                             (size_t)header.n_forests,
+                                             sizeof(forest_cache_index_t),
+                                             compare_forest_cache_index);
+      if (forest != NULL) {
+        wanted[forest - index] = 1;
+        n_wanted += forest->n_halos;
+      }
+    }
+
+  if (n_wanted > run_globals.NHalosMax) {
+    mlog_error("Forest cache %s holds more halos for this rank than expected (%ld > %d)!",
+               fname,
+               n_wanted,
+               run_globals.NHalosMax);
+    ABORT(EXIT_FAILURE);
+  }
+
+  // read each run of consecutive wanted forests in one go
+  forest_cache_halo_t* records =
+    get_halo_read_buffer(HALO_BUFFER_TREES, sizeof(forest_cache_halo_t) * (size_t)(n_wanted > 0 ? n_wanted : 1));
+  long n_read = 0;
+  for (int ii = 0; ii < header.n_forests;) {
+    if (!wanted[ii]) {
+      ii++;
+      continue;
+    }
+
+    long first = index[ii].first;
+    long n_to_read = 0;
+    for (; (ii < header.n_forests) && wanted[ii]; ii++)
+      n_to_read += index[ii].n_halos;
+
+    if ((fseek(fin, records_start + first * (long)sizeof(forest_cache_halo_t), SEEK_SET) != 0) ||
+        (fread(&records[n_read], sizeof(forest_cache_halo_t), (size_t)n_to_read, fin) != (size_t)n_to_read)) {
+      mlog_error("Failed to read forest cache %s", fname);
+      ABORT(EXIT_FAILURE);
+    }
+    n_read += n_to_read;
+  }
+
+  free(wanted);
+  free(index);
+  fclose(fin);
+
+  // the halos must be stored in the order of the input trees (index_lookup is searched with bsearch)
+  qsort(records, (size_t)n_read, sizeof(forest_cache_halo_t), compare_forest_cache_halos);
+
+  *n_halos = 0;
+  *n_fof_groups = 0;
+  for (long ii = 0; ii < n_read; ii++)
+    add_tree_entry(&records[ii], halos, n_halos, fof_groups, n_fof_groups, index_lookup);
+
+  return true;
+}
+
 void read_trees__velociraptor(int snapshot,
                               halo_t* halos,
                               int* n_halos,
@@ -113,6 +551,11 @@ void read_trees__velociraptor(int snapshot,
       mlog_error("Unrecognised input trees identifier (TreesID).");
       break;
   }
+
+  if (forest_cache_enabled() && read_forest_cache(snapshot, halos, n_halos, fof_groups, n_fof_groups, index_lookup)) {
+    mlog("...done (read from the forest cache)", MLOG_CLOSE);
+    return;
+  }
   
   int n_tree_entries = 0;
   hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
@@ -125,18 +568,8 @@ void read_trees__velociraptor(int snapshot,
   *n_fof_groups = 0;
 
   char fname[STRLEN * 2 + 8];
-  switch (run_globals.params.TreesID) {
-    case VELOCIRAPTOR_TREES:
-      sprintf(fname, "%s/trees/%s", run_globals.params.SimulationDir, run_globals.params.CatalogFilePrefix);
-      break;
-    case VELOCIRAPTOR_TREES_AUG:
-      sprintf(fname, "%s/augmented_trees/%s", run_globals.params.SimulationDir, run_globals.params.CatalogFilePrefix);
-      break;
-    default:
-      mlog_error("Unrecognised input trees identifier (TreesID).");
-      break;
-  }
-    
+  trees_fname(fname);
+
   hid_t fd = H5Fopen(fname, H5F_ACC_RDONLY, plist_id);
   if (fd < 0) {
     mlog("Failed to open file %s", MLOG_MESG, fname);
@@ -154,30 +587,35 @@ void read_trees__velociraptor(int snapshot,
   H5LTget_attribute_int(fd, snap_group_name, "NHalos", &n_tree_entries);
 
   // check the units
-  H5LTget_attribute_double(fd, "Header/Units", "Mass_unit_to_solarmass", &mass_unit_to_internal);
-  mass_unit_to_internal /= 1.0e10;
+  double mass_unit_to_solarmass = 1.0e10;
+  H5LTget_attribute_double(fd, "Header/Units", "Mass_unit_to_solarmass", &mass_unit_to_solarmass);
+  mass_unit_to_internal = mass_unit_to_solarmass / 1.0e10;
   H5LTget_attribute_double(fd, snap_group_name, "scalefactor", &scale_factor);
 
   // Currently the chunk size is 10000, improving ~10% w.r.t. no chunk or 1k chunk
   int buffer_size = (n_tree_entries > 100000) ? n_tree_entries / 10 : 10000;
   buffer_size = buffer_size > n_tree_entries ? n_tree_entries : buffer_size;
 
-  long* ForestID = malloc(sizeof(long) * buffer_size);
-  long* Head = malloc(sizeof(long) * buffer_size);
-  long* hostHaloID = malloc(sizeof(long) * buffer_size);
-  float* Mass_200crit = malloc(sizeof(float) * buffer_size);
-  float* Mass_tot = malloc(sizeof(float) * buffer_size);
-  float* R_200crit = malloc(sizeof(float) * buffer_size);
-  float* Vmax = malloc(sizeof(float) * buffer_size);
-  float* Xc = malloc(sizeof(float) * buffer_size);
-  float* Yc = malloc(sizeof(float) * buffer_size);
-  float* Zc = malloc(sizeof(float) * buffer_size);
-  float* VXc = malloc(sizeof(float) * buffer_size);
-  float* VYc = malloc(sizeof(float) * buffer_size);
-  float* VZc = malloc(sizeof(float) * buffer_size);
-  float* AngMom = malloc(sizeof(float) * buffer_size);
-  unsigned long* ID = malloc(sizeof(unsigned long) * buffer_size); 
-  unsigned long* npart = malloc(sizeof(unsigned long) * buffer_size);
+  // All of the columns are carved out of a single buffer which is reused for every snapshot.  The 8 byte columns come
+  // first so that all of them are suitably aligned.
+  size_t n_rows = (size_t)buffer_size;
+  size_t row_size = 3 * sizeof(long) + 2 * sizeof(unsigned long) + 11 * sizeof(float);
+  long* ForestID = get_halo_read_buffer(HALO_BUFFER_TREES, row_size * n_rows);
+  long* Head = ForestID + n_rows;
+  long* hostHaloID = Head + n_rows;
+  unsigned long* ID = (unsigned long*)(hostHaloID + n_rows);
+  unsigned long* npart = ID + n_rows;
+  float* Mass_200crit = (float*)(npart + n_rows);
+  float* Mass_tot = Mass_200crit + n_rows;
+  float* R_200crit = Mass_tot + n_rows;
+  float* Vmax = R_200crit + n_rows;
+  float* Xc = Vmax + n_rows;
+  float* Yc = Xc + n_rows;
+  float* Zc = Yc + n_rows;
+  float* VXc = Zc + n_rows;
+  float* VYc = VXc + n_rows;
+  float* VZc = VYc + n_rows;
+  float* AngMom = VZc + n_rows;
 
   plist_id = H5Pcreate(H5P_DATASET_XFER);
   H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_INDEPENDENT); // or H5FD_MPIO_COLLECTIVE?
@@ -186,6 +624,16 @@ void read_trees__velociraptor(int snapshot,
   double hubble_h = run_globals.params.Hubble_h;
   double box_size = run_globals.params.BoxSize;
 
+  // If we are building the forest cache then rank 0 converts every entry, not just the ones it keeps
+  forest_cache_halo_t* cache_records = NULL;
+  long* cache_forest_ids = NULL;
+  if (forest_cache_enabled() && (mpi_rank == 0)) {
+    mlog("Building forest cache for snapshot %d...", MLOG_MESG, snapshot);
+    cache_records = malloc(sizeof(forest_cache_halo_t) * (size_t)n_tree_entries);
+    cache_forest_ids = malloc(sizeof(long) * (size_t)n_tree_entries);
+    mem_track(MEM_HALOS, (ptrdiff_t)((sizeof(forest_cache_halo_t) + sizeof(long)) * (size_t)n_tree_entries));
+  }
+
   int n_read = 0;
   int n_to_read = buffer_size;
   while (n_read < n_tree_entries) {
@@ -238,134 +686,100 @@ void read_trees__velociraptor(int snapshot,
                                                               compare_longs)) == NULL)
         keep_this_halo = false;
 
-      if (keep_this_halo) {
-        halo_t* halo = &(halos[*n_halos]);
-
-        halo->ID = ID[ii];
-        halo->DescIndex = id_to_ind(Head[ii]);
-
-        if (run_globals.params.FlagIgnoreProgIndex)
-          halo->ProgIndex = -1;
-        //else
-        //  halo->ProgIndex = id_to_ind(Tail[ii]);
-
-        halo->NextHaloInFOFGroup = NULL;
-        halo->Type = hostHaloID[ii] == -1 ? 0 : 1;
-        halo->SnapOffset = id_to_snap(Head[ii]) - snapshot;
-
-        // Any other tree flags need to be set using both the current and
-        // progenitor halo information (stored in the galaxy), therefore we
-        // need to leave setting those until later...
-        if (run_globals.params.FlagIgnoreProgIndex)
-          halo->TreeFlags = TREE_CASE_NO_PROGENITORS;
-        //else
-        //  halo->TreeFlags = (unsigned long)Tail[ii] != ID[ii] ? 0 : TREE_CASE_NO_PROGENITORS;
-
-        // Here we have a cyclic pointer, indicating that this halo's life ends here
-        if ((unsigned long)Head[ii] == ID[ii])
-          halo->DescIndex = -1;
-
-        if (index_lookup)
-          index_lookup[*n_halos] = ii + n_read;
-
-        // TODO: What masses and radii should I use for centrals (inclusive vs. exclusive etc.)?
-        if (halo->Type == 0) {
-          fof_group_t* fof_group = &fof_groups[*n_fof_groups];
-          
-          // This check is to ensure sensible values of mass_200crit and avoid having 
-          // very weird halos. Put this check back if you feel that the N-body is weird.
-          
-          /*if ((Mass_200crit[ii] < 5 * Mass_tot[ii])) {
-              fof_group->Mvir = Mass_200crit[ii] * hubble_h * mass_unit_to_internal;;
-              fof_group->Rvir = R_200crit[ii] * hubble_h;
-          }*/
-          //else {
-            // BELOW_VIRIAL_THRESHOLD merger halo swammping
-          if (Mass_200crit[ii] <= 0) {
-            halo->TreeFlags |= TREE_CASE_BELOW_VIRIAL_THRESHOLD;
-            fof_group->Mvir = Mass_tot[ii] * hubble_h * mass_unit_to_internal;  
-            fof_group->Rvir = -1;
-          }
-          
-          else {
-            fof_group->Mvir = (double)Mass_200crit[ii] * hubble_h * mass_unit_to_internal;
-            fof_group->Rvir = (double)R_200crit[ii] * hubble_h;
-          }
-          
-          fof_group->Vvir = -1;
-          fof_group->FOFMvirModifier = 1.0;
-
-          convert_input_virial_props(
-            &fof_group->Mvir, &fof_group->Rvir, &fof_group->Vvir, &fof_group->FOFMvirModifier, -1, snapshot, true);
-
-          halo->FOFGroup = &(fof_groups[*n_fof_groups]);
-          fof_groups[(*n_fof_groups)++].FirstHalo = halo;
-        } else {
-          // We can take advantage of the fact that host halos always
-          // seem to appear before their subhalos (checked below) in the
-          // trees to immediately connect FOF group members.
-          int host_index = id_to_ind(hostHaloID[ii]);
-
-          if (index_lookup)
-            host_index = find_original_index(host_index, index_lookup, *n_halos);
-
-          assert(host_index > -1);
-          assert(host_index < *n_halos);
-
-          halo_t* prev_halo = &halos[host_index];
-          halo->FOFGroup = prev_halo->FOFGroup;
-
-          while (prev_halo->NextHaloInFOFGroup != NULL)
-            prev_halo = prev_halo->NextHaloInFOFGroup;
-
-          prev_halo->NextHaloInFOFGroup = halo;
+      if (!keep_this_halo && (cache_records == NULL))
+        continue;
+
+      forest_cache_halo_t entry;
+
+      entry.ID = ID[ii];
+      entry.FileIndex = ii + n_read;
+      entry.DescIndex = id_to_ind(Head[ii]);
+      entry.HostIndex = hostHaloID[ii] == -1 ? -1 : id_to_ind(hostHaloID[ii]);
+      entry.SnapOffset = id_to_snap(Head[ii]) - snapshot;
+
+      // Any other tree flags need to be set using both the current and
+      // progenitor halo information (stored in the galaxy), therefore we
+      // need to leave setting those until later...
+      entry.TreeFlags = run_globals.params.FlagIgnoreProgIndex ? TREE_CASE_NO_PROGENITORS : 0;
+
+      // Here we have a cyclic pointer, indicating that this halo's life ends here
+      if ((unsigned long)Head[ii] == ID[ii])
+        entry.DescIndex = -1;
+
+      // TODO: What masses and radii should I use for centrals (inclusive vs. exclusive etc.)?
+      if (entry.HostIndex == -1) {
+        // This check is to ensure sensible values of mass_200crit and avoid having
+        // very weird halos. Put this check back if you feel that the N-body is weird.
+
+        /*if ((Mass_200crit[ii] < 5 * Mass_tot[ii])) {
+            entry.FOFMvir = Mass_200crit[ii] * hubble_h * mass_unit_to_internal;;
+            entry.FOFRvir = R_200crit[ii] * hubble_h;
+        }*/
+        //else {
+          // BELOW_VIRIAL_THRESHOLD merger halo swammping
+        if (Mass_200crit[ii] <= 0) {
+          entry.TreeFlags |= TREE_CASE_BELOW_VIRIAL_THRESHOLD;
+          entry.FOFMvir = Mass_tot[ii] * hubble_h * mass_unit_to_internal;
+          entry.FOFRvir = -1;
         }
 
-        halo->Len = (int)npart[ii];
-        halo->Pos[0] = fmax(0.0, fmin(Xc[ii] * hubble_h / scale_factor, box_size));
-        halo->Pos[1] = fmax(0.0, fmin(Yc[ii] * hubble_h / scale_factor, box_size));
-        halo->Pos[2] = fmax(0.0, fmin(Zc[ii] * hubble_h / scale_factor, box_size));
-        halo->Vel[0] = VXc[ii] / scale_factor;
-        halo->Vel[1] = VYc[ii] / scale_factor;
-        halo->Vel[2] = VZc[ii] / scale_factor;
-        halo->Vmax = Vmax[ii]; 
-
-        // TODO: What masses and radii should I use for satellites (inclusive vs. exclusive etc.)?
-        halo->Mvir = (double)Mass_tot[ii] * hubble_h * mass_unit_to_internal;
-        halo->Rvir = -1;
-        halo->Vvir = -1;
-        convert_input_virial_props(&halo->Mvir, &halo->Rvir, &halo->Vvir, NULL, -1, snapshot, false);
-
-        halo->AngMom = AngMom[ii] * hubble_h;
-        halo->Galaxy = NULL;
-
-        (*n_halos)++;
+        else {
+          entry.FOFMvir = (double)Mass_200crit[ii] * hubble_h * mass_unit_to_internal;
+          entry.FOFRvir = (double)R_200crit[ii] * hubble_h;
+        }
+
+        entry.FOFVvir = -1;
+        entry.FOFMvirModifier = 1.0;
+
+        convert_input_virial_props(
+          &entry.FOFMvir, &entry.FOFRvir, &entry.FOFVvir, &entry.FOFMvirModifier, -1, snapshot, true);
+      } else {
+        entry.FOFMvir = entry.FOFRvir = entry.FOFVvir = 0.0;
+        entry.FOFMvirModifier = 1.0;
+      }
+
+      entry.Len = (int)npart[ii];
+      entry.Pos[0] = fmax(0.0, fmin(Xc[ii] * hubble_h / scale_factor, box_size));
+      entry.Pos[1] = fmax(0.0, fmin(Yc[ii] * hubble_h / scale_factor, box_size));
+      entry.Pos[2] = fmax(0.0, fmin(Zc[ii] * hubble_h / scale_factor, box_size));
+      entry.Vel[0] = VXc[ii] / scale_factor;
+      entry.Vel[1] = VYc[ii] / scale_factor;
+      entry.Vel[2] = VZc[ii] / scale_factor;
+      entry.Vmax = Vmax[ii];
+
+      // TODO: What masses and radii should I use for satellites (inclusive vs. exclusive etc.)?
+      entry.Mvir = (double)Mass_tot[ii] * hubble_h * mass_unit_to_internal;
+      entry.Rvir = -1;
+      entry.Vvir = -1;
+      convert_input_virial_props(&entry.Mvir, &entry.Rvir, &entry.Vvir, NULL, -1, snapshot, false);
+
+      entry.AngMom = AngMom[ii] * hubble_h;
+
+      if (cache_records != NULL) {
+        cache_records[entry.FileIndex] = entry;
+        cache_forest_ids[entry.FileIndex] = ForestID[ii];
       }
+
+      if (keep_this_halo)
+        add_tree_entry(&entry, halos, n_halos, fof_groups, n_fof_groups, index_lookup);
     }
 
     n_read += n_to_read;
   }
 
-  free(ForestID);
-  free(Head);
-  free(hostHaloID);
-  free(Mass_200crit);
-  free(Mass_tot);
-  free(R_200crit);
-  free(Vmax);
-  free(Xc);
-  free(Yc);
-  free(Zc);
-  free(VXc);
-  free(VYc);
-  free(VZc);
-  free(AngMom);
-  free(ID);
-  free(npart);
   H5Pclose(plist_id);
   H5Sclose(fspace_id);
   H5Gclose(snap_group);
   H5Fclose(fd);
 
+  if (cache_records != NULL) {
+    forest_cache_source_t source;
+    set_forest_cache_source(&source, fname, n_tree_entries, mass_unit_to_solarmass, scale_factor);
+    write_forest_cache(snapshot, &source, cache_records, cache_forest_ids, n_tree_entries);
+    free(cache_forest_ids);
+    free(cache_records);
+    mem_track(MEM_HALOS, -(ptrdiff_t)((sizeof(forest_cache_halo_t) + sizeof(long)) * (size_t)n_tree_entries));
+  }
+
   mlog("...done", MLOG_CLOSE);
 }
@@ -1,11 +1,15 @@
 #include <assert.h>
 #include <gsl/gsl_sort_int.h>
 #include <hdf5_hl.h>
+#include <stdint.h>
 
+#include "cache_codec.h"
 #include "meraxes.h"
+#include "memory_budget.h"
 #include "misc_tools.h"
 #include "modifiers.h"
 #include "read_halos.h"
+#include "shared_tables.h"
 
 inline static void update_pointers_from_offsets(int n_fof_groups_kept,
                                                 fof_group_t* fof_group,
@@ -26,10 +30,265 @@ inline static void update_pointers_from_offsets(int n_fof_groups_kept,
     fof_group[ii].FirstHalo = &(halo[fof_FirstHalo_os[ii]]);
 }
 
+// The scratch buffers of the tree readers are sized by the number of halos in each snapshot.  Rather than allocating
+// them for every snapshot we keep them for the whole run, growing them geometrically when required, so that reading
+// the trees of most snapshots requires no new memory.
+typedef struct halo_read_buffer_t
+{
+  void* data;
+  size_t capacity;
+} halo_read_buffer_t;
+
+static halo_read_buffer_t halo_read_buffers[N_HALO_BUFFERS];
+
+//! Get a scratch buffer of at least n_bytes (its contents are not preserved from previous calls)
+void* get_halo_read_buffer(enum halo_read_buffer which, size_t n_bytes)
+{
+  halo_read_buffer_t* buffer = &halo_read_buffers[which];
+
+  if (n_bytes > buffer->capacity) {
+    size_t capacity = (buffer->capacity > 0) ? buffer->capacity : 1024;
+    while (capacity < n_bytes)
+      capacity *= 2;
+
+    // N.B. no need to realloc as the old contents aren't needed
+    free(buffer->data);
+    buffer->data = malloc(capacity);
+    if (buffer->data == NULL) {
+      mlog_error("Failed to allocate %zu byte tree reading buffer!", capacity);
+      ABORT(EXIT_FAILURE);
+    }
+    mem_track(MEM_HALOS, (ptrdiff_t)(capacity - buffer->capacity));
+    buffer->capacity = capacity;
+  }
+
+  return buffer->data;
+}
+
+// When FlagCompressCaches or FlagSharedHaloCache is set in interactive / MCMC mode, the halos of each snapshot are
+// cached outside of the halo arrays and copied into a single set of working arrays (those of the first stored
+// snapshot) when they are needed.  FlagCompressCaches stores them compressed, and FlagSharedHaloCache stores them in
+// MPI-3 shared memory windows which are shared between all of the processes on a node which hold identical halos (i.e.
+// the same rank of independent model instances running on the same trees).  The cached records hold offsets rather
+// than pointers, and the fields which are set during a run (Galaxy, FirstOccupiedHalo and TotalSubhaloLen) are only
+// ever written to the working arrays, so the cache itself is read-only.
+typedef struct halo_cache_block_t
+{
+  int n_halos;
+  int n_fof_groups;
+  void* halos;
+  void* fof_groups;
+  void* index_lookup;
+  MPI_Win window;
+} halo_cache_block_t;
+
+static halo_cache_block_t* halo_cache = NULL;
+static MPI_Comm halo_cache_comm = MPI_COMM_NULL;
+
+// Everything which determines the halos held by a process.  Processes only share a cache if these agree exactly.
+typedef struct
+{
+  char SimulationDir[STRLEN];
+  char CatalogFilePrefix[STRLEN];
+  char ForestIDFile[STRLEN];
+  char MassRatioModifier[STRLEN];
+  int TreesID;
+  int mpi_size;
+  int mpi_rank;
+  int n_store_snapshots;
+  int FlagIgnoreProgIndex;
+  int FlagSubhaloVirialProps;
+  int FlagCompressCaches;
+  double BoxSize;
+  double Hubble_h;
+  double OmegaM;
+  double OmegaK;
+  double OmegaLambda;
+  double PartMass;
+  long long NPart;
+} halo_cache_key_t;
+
+static void create_halo_cache_comm()
+{
+  run_params_t* params = &(run_globals.params);
+  halo_cache_key_t key;
+
+  // N.B. zeroed first so that the unused bytes of the strings are identical on every process
+  memset(&key, 0, sizeof(halo_cache_key_t));
+  strncpy(key.SimulationDir, params->SimulationDir, STRLEN - 1);
+  strncpy(key.CatalogFilePrefix, params->CatalogFilePrefix, STRLEN - 1);
+  strncpy(key.ForestIDFile, params->ForestIDFile, STRLEN - 1);
+  strncpy(key.MassRatioModifier, params->MassRatioModifier, STRLEN - 1);
+  key.TreesID = (int)params->TreesID;
+  key.mpi_size = run_globals.mpi_size;
+  key.mpi_rank = run_globals.mpi_rank;
+  key.n_store_snapshots = run_globals.NStoreSnapshots;
+  key.FlagIgnoreProgIndex = params->FlagIgnoreProgIndex;
+  key.FlagSubhaloVirialProps = params->FlagSubhaloVirialProps;
+  key.FlagCompressCaches = params->FlagCompressCaches;
+  key.BoxSize = params->BoxSize;
+  key.Hubble_h = params->Hubble_h;
+  key.OmegaM = params->OmegaM;
+  key.OmegaK = params->OmegaK;
+  key.OmegaLambda = params->OmegaLambda;
+  key.PartMass = params->PartMass;
+  key.NPart = params->NPart;
+
+  halo_cache_comm = create_shared_cache_comm(&key, sizeof(halo_cache_key_t));
+
+  int n_sharing = 0;
+  MPI_Comm_size(halo_cache_comm, &n_sharing);
+  MPI_Allreduce(MPI_IN_PLACE, &n_sharing, 1, MPI_INT, MPI_MAX, run_globals.mpi_comm);
+  mlog("Up to %d processes share each cached set of halos.", MLOG_MESG, n_sharing);
+}
+
+#define PTR_TO_INDEX(ptr, base) ((ptr) == NULL ? NULL : (void*)((intptr_t)((ptr) - (base)) + 1))
+#define INDEX_TO_PTR(ptr, base) ((ptr) == NULL ? NULL : &(base)[(intptr_t)(ptr)-1])
+
+static void restore_halo_pointers(halo_t* halos, int n_halos, fof_group_t* fof_groups, int n_fof_groups)
+{
+  for (int ii = 0; ii < n_halos; ii++) {
+    halos[ii].FOFGroup = INDEX_TO_PTR(halos[ii].FOFGroup, fof_groups);
+    halos[ii].NextHaloInFOFGroup = INDEX_TO_PTR(halos[ii].NextHaloInFOFGroup, halos);
+  }
+  for (int ii = 0; ii < n_fof_groups; ii++)
+    fof_groups[ii].FirstHalo = INDEX_TO_PTR(fof_groups[ii].FirstHalo, halos);
+}
+
+// Copy the cached records of a snapshot into a window held by the first process in the group, and return its address
+// N.B. Only the data of the first process in the group is used, so the others may pass NULL
+static char* alloc_shared_halo_cache(void* const data[3], const size_t n_bytes[3], MPI_Win* win)
+{
+  int share_rank = 0;
+  void* cache = NULL;
+
+  MPI_Comm_rank(halo_cache_comm, &share_rank);
+
+  MPI_Aint win_size = (share_rank == 0) ? (MPI_Aint)(n_bytes[0] + n_bytes[1] + n_bytes[2]) : 0;
+  MPI_Win_allocate_shared(win_size, 1, MPI_INFO_NULL, halo_cache_comm, &cache, win);
+
+  if (share_rank != 0) {
+    int disp_unit = 0;
+    MPI_Win_shared_query(*win, 0, &win_size, &disp_unit, &cache);
+  }
+
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+  if (share_rank == 0) {
+    size_t offset = 0;
+    for (int ii = 0; ii < 3; ii++) {
+      if (n_bytes[ii] > 0)
+        memcpy((char*)cache + offset, data[ii], n_bytes[ii]);
+      offset += n_bytes[ii];
+    }
+  }
+  MPI_Win_sync(*win);
+  MPI_Barrier(halo_cache_comm);
+  MPI_Win_sync(*win);
+  MPI_Win_unlock_all(*win);
+
+  return cache;
+}
+
+static void cache_halos(int snapshot,
+                        halo_t* halos,
+                        int n_halos,
+                        fof_group_t* fof_groups,
+                        int n_fof_groups,
+                        int* index_lookup)
+{
+  halo_cache_block_t* block = &halo_cache[snapshot];
+  bool compress = run_globals.params.FlagCompressCaches;
+  int share_rank = 0;
+  if (halo_cache_comm != MPI_COMM_NULL)
+    MPI_Comm_rank(halo_cache_comm, &share_rank);
+
+  // Store the pointers as offsets.  The per-run fields are reset every time the halos are loaded.
+  for (int ii = 0; ii < n_halos; ii++) {
+    halos[ii].FOFGroup = PTR_TO_INDEX(halos[ii].FOFGroup, fof_groups);
+    halos[ii].NextHaloInFOFGroup = PTR_TO_INDEX(halos[ii].NextHaloInFOFGroup, halos);
+    halos[ii].Galaxy = NULL;
+  }
+  for (int ii = 0; ii < n_fof_groups; ii++) {
+    fof_groups[ii].FirstHalo = PTR_TO_INDEX(fof_groups[ii].FirstHalo, halos);
+    fof_groups[ii].FirstOccupiedHalo = NULL;
+    fof_groups[ii].TotalSubhaloLen = 0;
+  }
+
+  void* data[3] = { halos, fof_groups, index_lookup };
+  const size_t elem_size[3] = { sizeof(halo_t), sizeof(fof_group_t), sizeof(int) };
+  size_t n_bytes[3] = { sizeof(halo_t) * n_halos, sizeof(fof_group_t) * n_fof_groups, 0 };
+  if (index_lookup != NULL)
+    n_bytes[2] = sizeof(int) * n_halos;
+  size_t raw_bytes = n_bytes[0] + n_bytes[1] + n_bytes[2];
+
+  // only the process which holds the shared memory needs to compress the halos
+  if (compress && (share_rank == 0))
+    for (int ii = 0; ii < 3; ii++)
+      if (data[ii] != NULL)
+        n_bytes[ii] = compress_cache_block(data[ii], n_bytes[ii], elem_size[ii], &data[ii]);
+
+  block->n_halos = n_halos;
+  block->n_fof_groups = n_fof_groups;
+  if (halo_cache_comm != MPI_COMM_NULL) {
+    MPI_Bcast(n_bytes, 3 * (int)sizeof(size_t), MPI_BYTE, 0, halo_cache_comm);
+    char* cache = alloc_shared_halo_cache(data, n_bytes, &block->window);
+    block->halos = cache;
+    block->fof_groups = cache + n_bytes[0];
+    block->index_lookup = (index_lookup != NULL) ? cache + n_bytes[0] + n_bytes[1] : NULL;
+    if (compress && (share_rank == 0))
+      for (int ii = 0; ii < 3; ii++)
+        free(data[ii]);
+  } else {
+    block->halos = data[0];
+    block->fof_groups = data[1];
+    block->index_lookup = data[2];
+  }
+
+  restore_halo_pointers(halos, n_halos, fof_groups, n_fof_groups);
+
+  if (share_rank != 0)
+    return;
+
+  size_t cached_bytes = n_bytes[0] + n_bytes[1] + n_bytes[2];
+  mem_track(MEM_HALOS, (ptrdiff_t)cached_bytes);
+  if (compress)
+    mlog("Compressed halo cache by a factor of %.1f.",
+         MLOG_MESG,
+         (double)raw_bytes / (double)(cached_bytes > 0 ? cached_bytes : 1));
+}
+
+static void load_cached_halos(int snapshot, halo_t* halos, fof_group_t* fof_groups, int* index_lookup)
+{
+  halo_cache_block_t* block = &halo_cache[snapshot];
+  size_t halo_bytes = sizeof(halo_t) * block->n_halos;
+  size_t fof_group_bytes = sizeof(fof_group_t) * block->n_fof_groups;
+
+  if (run_globals.params.FlagCompressCaches) {
+    decompress_cache_block(block->halos, halos, halo_bytes);
+    decompress_cache_block(block->fof_groups, fof_groups, fof_group_bytes);
+    if (block->index_lookup != NULL)
+      decompress_cache_block(block->index_lookup, index_lookup, sizeof(int) * block->n_halos);
+  } else {
+    memcpy(halos, block->halos, halo_bytes);
+    memcpy(fof_groups, block->fof_groups, fof_group_bytes);
+    if (block->index_lookup != NULL)
+      memcpy(index_lookup, block->index_lookup, sizeof(int) * block->n_halos);
+  }
+
+  restore_halo_pointers(halos, block->n_halos, fof_groups, block->n_fof_groups);
+}
+
+//! Are the halos of every snapshot read through the working arrays of the first stored snapshot?
+bool halo_cache_in_use()
+{
+  return halo_cache != NULL;
+}
+
 static fof_group_t* init_fof_groups()
 {
   mlog("Allocating fof_group array with %d elements...", MLOG_MESG, run_globals.NFOFGroupsMax);
   fof_group_t* fof_groups = malloc(sizeof(fof_group_t) * run_globals.NFOFGroupsMax);
+  mem_track(MEM_HALOS, (ptrdiff_t)(sizeof(fof_group_t) * run_globals.NFOFGroupsMax));
 
   for (int ii = 0; ii < run_globals.NFOFGroupsMax; ii++) {
     fof_groups[ii].FirstHalo = NULL;
@@ -95,6 +354,17 @@ void initialize_halo_storage()
   *snapshot_index_lookup = (int**)calloc((size_t)*n_store_snapshots, sizeof(int*));
   *snapshot_trees_info = (trees_info_t*)calloc((size_t)*n_store_snapshots, sizeof(trees_info_t));
 
+  if ((run_globals.params.FlagInteractive || run_globals.params.FlagMCMC) &&
+      (run_globals.params.FlagCompressCaches || run_globals.params.FlagSharedHaloCache)) {
+    halo_cache = calloc((size_t)*n_store_snapshots, sizeof(halo_cache_block_t));
+    for (int ii = 0; ii < *n_store_snapshots; ii++)
+      halo_cache[ii].window = MPI_WIN_NULL;
+
+    // N.B. This split is collective over MPI_COMM_WORLD, so every process must initialise at the same time.
+    if (run_globals.params.FlagSharedHaloCache)
+      create_halo_cache_comm();
+  }
+
   for (int ii = 0; ii < *n_store_snapshots; ii++) {
     (*snapshot_trees_info)[ii].n_halos = -1;
     (*snapshot_index_lookup)[ii] = NULL;
@@ -103,19 +373,23 @@ void initialize_halo_storage()
   // loop through and read all snapshots
   if (run_globals.params.FlagInteractive || run_globals.params.FlagMCMC) {
     mlog("Preloading input trees and halos...", MLOG_OPEN);
-    for (int i_snap = 0; i_snap <= last_snap; i_snap++)
+    for (int i_snap = 0; i_snap <= last_snap; i_snap++) {
+      // cached snapshots are all read through the same working arrays
+      int i_store = (halo_cache != NULL) ? 0 : i_snap;
       read_halos(i_snap,
-                 &((*snapshot_halo)[i_snap]),
-                 &((*snapshot_fof_group)[i_snap]),
-                 &((*snapshot_index_lookup)[i_snap]),
+                 &((*snapshot_halo)[i_store]),
+                 &((*snapshot_fof_group)[i_store]),
+                 &((*snapshot_index_lookup)[i_store]),
                  *snapshot_trees_info);
+    }
     mlog("...done", MLOG_CLOSE);
   }
 
   mlog("...done", MLOG_CLOSE);
 }
 
-static void select_forests()
+//! Work out which forests each rank should process, and the maximum number of halos and FOF groups it will hold
+static void distribute_forests(int* n_rank_forests, long** rank_forest_ids, int* n_halos_max, int* n_fof_groups_max)
 {
   // search the input tree files for all unique forest ids, store them, sort
   // them, and then potentially split them amongst cores
@@ -360,12 +634,8 @@ static void select_forests()
   } // mpi_rank = 0
 
   // let all ranks know what their forest ID lists are
-  MPI_Scatter(rank_n_assigned, 1, MPI_INT, &run_globals.NRequestedForests, 1, MPI_INT, 0, run_globals.mpi_comm);
-  if (run_globals.RequestedForestId != NULL)
-    run_globals.RequestedForestId =
-      realloc(run_globals.RequestedForestId, run_globals.NRequestedForests * sizeof(long));
-  else
-    run_globals.RequestedForestId = (long*)malloc(sizeof(long) * run_globals.NRequestedForests);
+  MPI_Scatter(rank_n_assigned, 1, MPI_INT, n_rank_forests, 1, MPI_INT, 0, run_globals.mpi_comm);
+  *rank_forest_ids = (long*)malloc(sizeof(long) * (*n_rank_forests));
 
   // NB: displs only valid on rank 0
   int* displs = calloc(run_globals.mpi_size, sizeof(int));
@@ -376,16 +646,16 @@ static void select_forests()
                rank_n_assigned,
                displs,
                MPI_LONG,
-               run_globals.RequestedForestId,
-               run_globals.NRequestedForests,
+               *rank_forest_ids,
+               *n_rank_forests,
                MPI_LONG,
                0,
                run_globals.mpi_comm);
   free(displs);
 
   // let all ranks know what their max allocation counts are
-  MPI_Scatter(rank_max_contemp_halo, 1, MPI_INT, &run_globals.NHalosMax, 1, MPI_INT, 0, run_globals.mpi_comm);
-  MPI_Scatter(rank_max_contemp_fof, 1, MPI_INT, &run_globals.NFOFGroupsMax, 1, MPI_INT, 0, run_globals.mpi_comm);
+  MPI_Scatter(rank_max_contemp_halo, 1, MPI_INT, n_halos_max, 1, MPI_INT, 0, run_globals.mpi_comm);
+  MPI_Scatter(rank_max_contemp_fof, 1, MPI_INT, n_fof_groups_max, 1, MPI_INT, 0, run_globals.mpi_comm);
 
   if (run_globals.mpi_rank == 0) {
     free(rank_max_contemp_fof);
@@ -395,11 +665,73 @@ static void select_forests()
   }
 
   // sort the requested forest ids so that they can be bsearch'd later
-  qsort(run_globals.RequestedForestId, (size_t)run_globals.NRequestedForests, sizeof(long), compare_longs);
+  qsort(*rank_forest_ids, (size_t)(*n_rank_forests), sizeof(long), compare_longs);
 
   mlog("...done.", MLOG_MESG | MLOG_TIMERSTOP);
 }
 
+static void select_forests()
+{
+  int n_rank_forests = 0;
+  long* rank_forest_ids = NULL;
+
+  distribute_forests(&n_rank_forests, &rank_forest_ids, &run_globals.NHalosMax, &run_globals.NFOFGroupsMax);
+
+  free(run_globals.RequestedForestId);
+  run_globals.RequestedForestId = rank_forest_ids;
+  run_globals.NRequestedForests = n_rank_forests;
+}
+
+//! Estimate the size of the halo storage arrays required for a single snapshot on this rank (without allocating them)
+size_t estimate_halo_storage_bytes(int* n_halos_max)
+{
+  bool use_index_lookup = false;
+  int n_fof_groups_max = 0;
+
+  if ((run_globals.NRequestedForests > -1) || (run_globals.mpi_size > 1)) {
+    if (run_globals.SelectForestsSwitch == true) {
+      // N.B. The forests are only distributed here to find their sizes.  They are distributed for real (identically)
+      // when the halos are first read.
+      int n_rank_forests = 0;
+      long* rank_forest_ids = NULL;
+      distribute_forests(&n_rank_forests, &rank_forest_ids, n_halos_max, &n_fof_groups_max);
+      free(rank_forest_ids);
+    } else {
+      *n_halos_max = run_globals.NHalosMax;
+      n_fof_groups_max = run_globals.NFOFGroupsMax;
+    }
+    use_index_lookup = true;
+  } else {
+    int last_snap = 0;
+    for (int ii = 0; ii < run_globals.NOutputSnaps; ii++)
+      if (run_globals.ListOutputSnaps[ii] > last_snap)
+        last_snap = run_globals.ListOutputSnaps[ii];
+
+    trees_info_t trees_info = { 0 };
+    switch (run_globals.params.TreesID) {
+      case VELOCIRAPTOR_TREES:
+      case VELOCIRAPTOR_TREES_AUG:
+        trees_info = read_trees_info__velociraptor(last_snap);
+        break;
+      case GBPTREES_TREES:
+        trees_info = read_trees_info__gbptrees(last_snap);
+        break;
+      default:
+        mlog_error("Unrecognised input trees identifier (TreesID).");
+        break;
+    }
+
+    *n_halos_max = trees_info.n_halos_max;
+    n_fof_groups_max = trees_info.n_fof_groups_max;
+  }
+
+  size_t n_bytes = sizeof(halo_t) * (size_t)(*n_halos_max) + sizeof(fof_group_t) * (size_t)n_fof_groups_max;
+  if (use_index_lookup)
+    n_bytes += sizeof(int) * (size_t)(*n_halos_max);
+
+  return n_bytes;
+}
+
 trees_info_t read_halos(const int snapshot,
                         halo_t** halos,
                         fof_group_t** fof_groups,
@@ -413,6 +745,8 @@ trees_info_t read_halos(const int snapshot,
          MLOG_MESG,
          snapshot,
          snapshot_trees_info[snapshot].n_halos);
+    if (halo_cache != NULL)
+      load_cached_halos(snapshot, *halos, *fof_groups, *index_lookup);
     return snapshot_trees_info[snapshot];
   }
 
@@ -470,6 +804,7 @@ trees_info_t read_halos(const int snapshot,
         run_globals.SelectForestsSwitch = false;
       }
       *index_lookup = malloc(sizeof(int) * run_globals.NHalosMax);
+      mem_track(MEM_HALOS, (ptrdiff_t)(sizeof(int) * run_globals.NHalosMax));
       for (int ii = 0; ii < run_globals.NHalosMax; ii++)
         (*index_lookup)[ii] = -1;
     } else {
@@ -479,6 +814,7 @@ trees_info_t read_halos(const int snapshot,
 
     mlog("Allocating halo array with %d elements...", MLOG_MESG, run_globals.NHalosMax);
     *halos = malloc(sizeof(halo_t) * run_globals.NHalosMax);
+    mem_track(MEM_HALOS, (ptrdiff_t)(sizeof(halo_t) * run_globals.NHalosMax));
   }
 
   // Allocate the fof_group array if necessary
@@ -521,8 +857,13 @@ trees_info_t read_halos(const int snapshot,
     trees_info.n_fof_groups = n_fof_groups;
   }
 
-  // if we are doing multiple runs then resize the arrays to save space and store the trees_info
-  if (run_globals.params.FlagInteractive || run_globals.params.FlagMCMC) {
+  // if we are doing multiple runs then either copy the arrays into the cache...
+  if (halo_cache != NULL) {
+    cache_halos(snapshot, *halos, n_halos, *fof_groups, n_fof_groups, *index_lookup);
+    snapshot_trees_info[snapshot] = trees_info;
+  }
+  // ...or resize them to save space, and store the trees_info
+  else if (run_globals.params.FlagInteractive || run_globals.params.FlagMCMC) {
     // Ok - what follows here is hacky as hell.  By calling realloc on these
     // arrays, there is a good chance that the actual array will be moved and
     // there is no way to prevent this.  A side effect will be that all of the
@@ -561,6 +902,13 @@ trees_info_t read_halos(const int snapshot,
     // or we are subsampling the trees).
     if (*index_lookup)
       *index_lookup = (int*)realloc(*index_lookup, sizeof(int) * n_halos);
+
+    ptrdiff_t n_halos_freed = (ptrdiff_t)run_globals.NHalosMax - n_halos;
+    ptrdiff_t n_fof_groups_freed = (ptrdiff_t)run_globals.NFOFGroupsMax - n_fof_groups;
+    mem_track(MEM_HALOS,
+              -n_halos_freed * (ptrdiff_t)sizeof(halo_t) - n_fof_groups_freed * (ptrdiff_t)sizeof(fof_group_t));
+    if (*index_lookup)
+      mem_track(MEM_HALOS, -n_halos_freed * (ptrdiff_t)sizeof(int));
     update_pointers_from_offsets(
       n_fof_groups, *fof_groups, fof_FirstHalo_os, n_halos, *halos, halo_FOFGroup_os, halo_NextHaloInFOFGroup_os);
 
@@ -602,4 +950,29 @@ void free_halo_storage()
   free(snapshot_fof_group);
   free(snapshot_index_lookup);
   free(snapshot_trees_info);
+
+  for (int ii = 0; ii < N_HALO_BUFFERS; ii++) {
+    free(halo_read_buffers[ii].data);
+    halo_read_buffers[ii].data = NULL;
+    halo_read_buffers[ii].capacity = 0;
+  }
+
+  if (halo_cache != NULL) {
+    for (int ii = 0; ii < n_store_snapshots; ii++) {
+      if (halo_cache[ii].window != MPI_WIN_NULL)
+        MPI_Win_free(&halo_cache[ii].window);
+      else {
+        free(halo_cache[ii].halos);
+        free(halo_cache[ii].fof_groups);
+        free(halo_cache[ii].index_lookup);
+      }
+    }
+    free(halo_cache);
+    halo_cache = NULL;
+  }
+
+  if (halo_cache_comm != MPI_COMM_NULL)
+    MPI_Comm_free(&halo_cache_comm);
+
+  mem_track(MEM_HALOS, -(ptrdiff_t)mem_current(MEM_HALOS));
 }
@@ -3,6 +3,15 @@
 
 #include "meraxes.h"
 
+//! Scratch buffers used by the tree readers, which are kept for the whole run
+enum halo_read_buffer
+{
+  HALO_BUFFER_TREES,
+  HALO_BUFFER_CATALOG,
+  HALO_BUFFER_GROUPS,
+  N_HALO_BUFFERS
+};
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -14,7 +23,10 @@ extern "C"
                           int** index_lookup,
                           trees_info_t* snapshot_trees_info);
   void initialize_halo_storage(void);
+  bool halo_cache_in_use(void);
+  size_t estimate_halo_storage_bytes(int* n_halos_max);
   void free_halo_storage(void);
+  void* get_halo_read_buffer(enum halo_read_buffer which, size_t n_bytes);
 
   trees_info_t read_trees_info__gbptrees(int snapshot);
   void read_trees__gbptrees(int snapshot,
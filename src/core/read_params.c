@@ -314,6 +314,12 @@ void read_parameter_file(char* fname, int mode)
       params_type[n_param++] = PARAM_TYPE_STRING;
       *(run_params->FFTW3WisdomDir) = '\0';
 
+      strncpy(params_tag[n_param], "FFTW3PlanRigor", tag_length);
+      params_addr[n_param] = &(run_params->FFTW3PlanRigor);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->FFTW3PlanRigor = -1;
+
       strncpy(params_tag[n_param], "UnitVelocity_in_cm_per_s", tag_length);
       params_addr[n_param] = &(run_globals.units.UnitVelocity_in_cm_per_s);
       required_tag[n_param] = 1;
@@ -410,6 +416,102 @@ void read_parameter_file(char* fname, int mode)
       params_type[n_param++] = PARAM_TYPE_INT;
       run_params->FlagIgnoreProgIndex = 0;
 
+      strncpy(params_tag[n_param], "FlagMemoryReport", tag_length);
+      params_addr[n_param] = &(run_params->FlagMemoryReport);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->FlagMemoryReport = 0;
+
+      strncpy(params_tag[n_param], "FlagMemoryDryRun", tag_length);
+      params_addr[n_param] = &(run_params->FlagMemoryDryRun);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->FlagMemoryDryRun = 0;
+
+      strncpy(params_tag[n_param], "FlagSharedGridsCache", tag_length);
+      params_addr[n_param] = &(run_params->FlagSharedGridsCache);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->FlagSharedGridsCache = 0;
+
+      strncpy(params_tag[n_param], "FlagSharedHaloCache", tag_length);
+      params_addr[n_param] = &(run_params->FlagSharedHaloCache);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->FlagSharedHaloCache = 0;
+
+      strncpy(params_tag[n_param], "MCMCResumeInterval", tag_length);
+      params_addr[n_param] = &(run_params->MCMCResumeInterval);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->MCMCResumeInterval = 0;
+
+      strncpy(params_tag[n_param], "FlagCompressCaches", tag_length);
+      params_addr[n_param] = &(run_params->FlagCompressCaches);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->FlagCompressCaches = 0;
+
+      strncpy(params_tag[n_param], "CacheGridsTolerance", tag_length);
+      params_addr[n_param] = &(run_params->CacheGridsTolerance);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_DOUBLE;
+      run_params->CacheGridsTolerance = 0.0;
+
+      strncpy(params_tag[n_param], "FlagSortGalaxiesByCell", tag_length);
+      params_addr[n_param] = &(run_params->FlagSortGalaxiesByCell);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->FlagSortGalaxiesByCell = 0;
+
+      strncpy(params_tag[n_param], "FlagColumnarOutput", tag_length);
+      params_addr[n_param] = &(run_params->FlagColumnarOutput);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->FlagColumnarOutput = 0;
+
+      strncpy(params_tag[n_param], "OutputCompressionLevel", tag_length);
+      params_addr[n_param] = &(run_params->OutputCompressionLevel);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->OutputCompressionLevel = 6;
+
+      strncpy(params_tag[n_param], "OutputFields", tag_length);
+      params_addr[n_param] = &(run_params->OutputFields);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_STRING;
+      strcpy(run_params->OutputFields, "full");
+
+      strncpy(params_tag[n_param], "GridChunkNx", tag_length);
+      params_addr[n_param] = &(run_params->GridChunkNx);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_STRING;
+      strcpy(run_params->GridChunkNx, "1");
+
+      strncpy(params_tag[n_param], "GridCompressionLevel", tag_length);
+      params_addr[n_param] = &(run_params->GridCompressionLevel);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_STRING;
+      strcpy(run_params->GridCompressionLevel, "0");
+
+      strncpy(params_tag[n_param], "GridScaleOffsetDigits", tag_length);
+      params_addr[n_param] = &(run_params->GridScaleOffsetDigits);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_STRING;
+      *(run_params->GridScaleOffsetDigits) = '\0';
+
+      strncpy(params_tag[n_param], "ForestCacheDir", tag_length);
+      params_addr[n_param] = &(run_params->ForestCacheDir);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_STRING;
+      *(run_params->ForestCacheDir) = '\0';
+
+      strncpy(params_tag[n_param], "FlagSharedTables", tag_length);
+      params_addr[n_param] = &(run_params->FlagSharedTables);
+      required_tag[n_param] = 0;
+      params_type[n_param++] = PARAM_TYPE_INT;
+      run_params->FlagSharedTables = 0;
+
       // Physics params
 
       strncpy(params_tag[n_param], "EscapeFracDependency", tag_length);
@@ -1,15 +1,17 @@
 #include <assert.h>
 #include <complex.h>
+#include <ctype.h>
 #include <fenv.h>
 #include <fftw3-mpi.h>
 #include <hdf5_hl.h>
 #include <math.h>
 #include <string.h>
-#include <sys/stat.h>
 
 #include "ComputeTs.h"
+#include "fft_plans.h"
 #include "find_HII_bubbles.h"
 #include "meraxes.h"
+#include "memory_budget.h"
 #include "misc_tools.h"
 #include "read_grids.h"
 #include "reionization.h"
@@ -515,48 +517,277 @@ void init_reion_grids()
   }
 }
 
-void malloc_reionization_grids()
+/*
+ * The reionization grids are allocated through the following, so that the same code can be used to find their
+ * footprint without allocating anything (see reion_grids_footprint).
+ */
+static struct
 {
-  mlog("Allocating reionization grids...", MLOG_OPEN);
+  bool count_only;
+  size_t n_bytes[N_MEM_CATEGORIES];
+} grid_allocator = { false, { 0 } };
 
-  reion_grids_t* grids = &(run_globals.reion_grids);
+static void* grid_alloc(mem_category category, size_t n_bytes, bool zero)
+{
+  grid_allocator.n_bytes[category] += n_bytes;
+  if (grid_allocator.count_only)
+    return NULL;
+
+  mem_track(category, (ptrdiff_t)n_bytes);
+  if (zero)
+    return calloc(n_bytes, 1);
+  return fftwf_malloc(n_bytes);
+}
 
-  fftwf_mpi_init();
-
-  // Load wisdom if requested
-  run_globals.reion_grids.flag_wisdom = strlen(run_globals.params.FFTW3WisdomDir) > 0;
-  bool save_wisdom = false;
-  char wisdom_fname[STRLEN + 32];
-  const int ReionGridDim = run_globals.params.ReionGridDim;
-  unsigned plan_flags = FFTW_ESTIMATE;
-
-  if (run_globals.reion_grids.flag_wisdom) {
-    plan_flags = FFTW_PATIENT;
-    sprintf(wisdom_fname,
-            "%s/fftw3f-meraxes-N_%d-ranks_%d.wisdom",
-            run_globals.params.FFTW3WisdomDir,
-            ReionGridDim,
-            run_globals.mpi_size);
-    if (run_globals.mpi_rank == 0) {
-      if (fftwf_import_wisdom_from_filename(wisdom_fname)) {
-        mlog("Successfully loaded FFTW3 wisdom from %s", MLOG_MESG, wisdom_fname);
-      } else {
-        mlog("FFTW3 wisdom directory provided, but no suitable wisdom exists. New wisdom will be created (this make "
-             "take a while).",
-             MLOG_MESG | MLOG_FLUSH);
-        save_wisdom = true;
-        // Check to see if the wisdom directory exists and if not, create it
-        struct stat filestatus;
-        if (stat(run_globals.params.FFTW3WisdomDir, &filestatus) != 0)
-          mkdir(run_globals.params.FFTW3WisdomDir, 02755);
-      }
+static float* grid_alloc_real(mem_category category, size_t n)
+{
+  return grid_alloc(category, sizeof(float) * n, false);
+}
+
+static fftwf_complex* grid_alloc_complex(size_t n)
+{
+  return grid_alloc(MEM_REION_GRIDS, sizeof(fftwf_complex) * n, false);
+}
+
+//! Allocate the grids of a slab which is slab_nix cells wide (the buffer is sized by the widest slab of any rank)
+static void alloc_reion_grids(reion_grids_t* grids,
+                              ptrdiff_t slab_nix,
+                              ptrdiff_t slab_n_complex,
+                              ptrdiff_t max_slab_nix)
+{
+  run_params_t* params = &(run_globals.params);
+  int ReionGridDim = params->ReionGridDim;
+  size_t slab_n_real = (size_t)slab_nix * (size_t)ReionGridDim * (size_t)ReionGridDim;
+  size_t slab_n_padded = (size_t)slab_n_complex * 2;
+
+  // create a buffer on each rank which is as large as the largest LOGICAL allocation on any single rank
+  grids->buffer_size = (int)(max_slab_nix * ReionGridDim * ReionGridDim);
+  grids->buffer = grid_alloc_real(MEM_REION_GRIDS, (size_t)grids->buffer_size);
+
+  grids->stars = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+  grids->stars_unfiltered = grid_alloc_complex((size_t)slab_n_complex);
+  grids->stars_filtered = grid_alloc_complex((size_t)slab_n_complex);
+
+  grids->deltax = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+  grids->deltax_unfiltered = grid_alloc_complex((size_t)slab_n_complex);
+  grids->deltax_filtered = grid_alloc_complex((size_t)slab_n_complex);
+
+  grids->weighted_sfr = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+  grids->weighted_sfr_unfiltered = grid_alloc_complex((size_t)slab_n_complex);
+  grids->weighted_sfr_filtered = grid_alloc_complex((size_t)slab_n_complex);
+#if USE_MINI_HALOS
+  grids->starsIII = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+  grids->starsIII_unfiltered = grid_alloc_complex((size_t)slab_n_complex);
+  grids->starsIII_filtered = grid_alloc_complex((size_t)slab_n_complex);
+
+  grids->weighted_sfrIII = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+  grids->weighted_sfrIII_unfiltered = grid_alloc_complex((size_t)slab_n_complex);
+  grids->weighted_sfrIII_filtered = grid_alloc_complex((size_t)slab_n_complex);
+#endif
+
+  grids->xH = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+  grids->z_at_ionization = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+  grids->r_bubble = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+
+#if USE_MINI_HALOS
+  if (params->Flag_IncludeLymanWerner) {
+    grids->JLW_box = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+    grids->JLW_boxII = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+  }
+#endif
+
+  if (params->Flag_IncludeSpinTemp) {
+    size_t slab_n_real_smoothedSFR = slab_n_real * (size_t)params->TsNumFilterSteps;
+
+    grids->sfr = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+    grids->sfr_histories = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded * (size_t)run_globals.NstoreSnapshots_SFR);
+    grids->sfr_unfiltered = grid_alloc_complex((size_t)slab_n_complex);
+    grids->sfr_filtered = grid_alloc_complex((size_t)slab_n_complex);
+
+    grids->x_e_box = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+    grids->x_e_unfiltered = grid_alloc_complex((size_t)slab_n_complex);
+    grids->x_e_filtered = grid_alloc_complex((size_t)slab_n_complex);
+    grids->x_e_box_prev = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+
+#if USE_MINI_HALOS
+    grids->sfrIII = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+    grids->sfrIII_histories =
+      grid_alloc_real(MEM_REION_GRIDS, slab_n_padded * (size_t)run_globals.NstoreSnapshots_SFR);
+    grids->sfrIII_unfiltered = grid_alloc_complex((size_t)slab_n_complex);
+    grids->sfrIII_filtered = grid_alloc_complex((size_t)slab_n_complex);
+#endif
+    grids->Tk_box = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+    grids->TS_box = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+
+    grids->SMOOTHED_SFR_GAL = grid_alloc(MEM_REION_GRIDS, sizeof(double) * slab_n_real_smoothedSFR, true);
+#if USE_MINI_HALOS
+    grids->Tk_boxII = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+    grids->TS_boxII = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+
+    grids->SMOOTHED_SFR_III = grid_alloc(MEM_REION_GRIDS, sizeof(double) * slab_n_real_smoothedSFR, true);
+#endif
+  }
+
+  if (params->Flag_IncludeRecombinations) {
+    grids->N_rec = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+    grids->N_rec_unfiltered = grid_alloc_complex((size_t)slab_n_complex);
+    grids->N_rec_filtered = grid_alloc_complex((size_t)slab_n_complex);
+
+    grids->z_re = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+    grids->Gamma12 = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+  }
+
+  if (params->Flag_Compute21cmBrightTemp) {
+    grids->delta_T = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+#if USE_MINI_HALOS
+    grids->delta_TII = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+#endif
+
+    if (params->Flag_IncludePecVelsFor21cm > 0) {
+      grids->vel = grid_alloc_real(MEM_REION_GRIDS, slab_n_padded);
+      grids->vel_gradient = grid_alloc_complex((size_t)slab_n_complex);
     }
-    MPI_Bcast(&save_wisdom, 1, MPI_C_BOOL, 0, run_globals.mpi_comm);
-    if (!save_wisdom) {
-      fftwf_mpi_broadcast_wisdom(run_globals.mpi_comm);
+
+    if (params->Flag_ConstructLightcone) {
+      grids->delta_T_prev = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+#if USE_MINI_HALOS
+      grids->delta_TII_prev = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+#endif
     }
   }
 
+  if (params->ReionUVBFlag) {
+    grids->J_21_at_ionization = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+    grids->J_21 = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+    grids->Mvir_crit = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+
+#if USE_MINI_HALOS
+    if (params->Flag_IncludeLymanWerner)
+      grids->Mvir_crit_MC = grid_alloc_real(MEM_REION_GRIDS, slab_n_real);
+#endif
+  }
+
+  if (params->Flag_ConstructLightcone) {
+    size_t slab_n_real_LC = (size_t)slab_nix * (size_t)ReionGridDim * (size_t)params->LightconeLength;
+    grids->LightconeBox = grid_alloc_real(MEM_LIGHTCONE, slab_n_real_LC);
+    grids->Lightcone_redshifts = grid_alloc_real(MEM_LIGHTCONE, (size_t)params->LightconeLength);
+  }
+
+  if (params->Flag_ComputePS) {
+    grids->PS_k = grid_alloc_real(MEM_REION_GRIDS, (size_t)params->PS_Length);
+    grids->PS_data = grid_alloc_real(MEM_REION_GRIDS, (size_t)params->PS_Length);
+    grids->PS_error = grid_alloc_real(MEM_REION_GRIDS, (size_t)params->PS_Length);
+#if USE_MINI_HALOS
+    grids->PSII_data = grid_alloc_real(MEM_REION_GRIDS, (size_t)params->PS_Length);
+    grids->PSII_error = grid_alloc_real(MEM_REION_GRIDS, (size_t)params->PS_Length);
+#endif
+  }
+}
+
+static void plan_reion_grids(reion_grids_t* grids)
+{
+  run_params_t* params = &(run_globals.params);
+  int ReionGridDim = params->ReionGridDim;
+
+  grids->stars_forward_plan = fft_plan_r2c_3d(
+    ReionGridDim, ReionGridDim, ReionGridDim, grids->stars, grids->stars_unfiltered);
+  grids->stars_filtered_reverse_plan = fft_plan_c2r_3d(
+    ReionGridDim, ReionGridDim, ReionGridDim, grids->stars_filtered, (float*)grids->stars_filtered);
+
+  grids->deltax_forward_plan = fft_plan_r2c_3d(
+    ReionGridDim, ReionGridDim, ReionGridDim, grids->deltax, grids->deltax_unfiltered);
+  grids->deltax_filtered_reverse_plan = fft_plan_c2r_3d(
+    ReionGridDim, ReionGridDim, ReionGridDim, grids->deltax_filtered, (float*)grids->deltax_filtered);
+
+  grids->weighted_sfr_forward_plan = fft_plan_r2c_3d(
+    ReionGridDim, ReionGridDim, ReionGridDim, grids->weighted_sfr, grids->weighted_sfr_unfiltered);
+  grids->weighted_sfr_filtered_reverse_plan = fft_plan_c2r_3d(
+    ReionGridDim, ReionGridDim, ReionGridDim, grids->weighted_sfr_filtered, (float*)grids->weighted_sfr_filtered);
+#if USE_MINI_HALOS
+  grids->starsIII_forward_plan = fft_plan_r2c_3d(
+    ReionGridDim, ReionGridDim, ReionGridDim, grids->starsIII, grids->starsIII_unfiltered);
+  grids->starsIII_filtered_reverse_plan = fft_plan_c2r_3d(
+    ReionGridDim, ReionGridDim, ReionGridDim, grids->starsIII_filtered, (float*)grids->starsIII_filtered);
+
+  grids->weighted_sfrIII_forward_plan = fft_plan_r2c_3d(
+    ReionGridDim, ReionGridDim, ReionGridDim, grids->weighted_sfrIII, grids->weighted_sfrIII_unfiltered);
+  grids->weighted_sfrIII_filtered_reverse_plan = fft_plan_c2r_3d(
+    ReionGridDim, ReionGridDim, ReionGridDim, grids->weighted_sfrIII_filtered, (float*)grids->weighted_sfrIII_filtered);
+#endif
+
+  if (params->Flag_IncludeSpinTemp) {
+    grids->sfr_forward_plan = fft_plan_r2c_3d(
+      ReionGridDim, ReionGridDim, ReionGridDim, grids->sfr, grids->sfr_unfiltered);
+    grids->sfr_filtered_reverse_plan = fft_plan_c2r_3d(
+      ReionGridDim, ReionGridDim, ReionGridDim, grids->sfr_filtered, (float*)grids->sfr_filtered);
+
+    grids->x_e_box_forward_plan = fft_plan_r2c_3d(
+      ReionGridDim, ReionGridDim, ReionGridDim, grids->x_e_box, grids->x_e_unfiltered);
+    grids->x_e_filtered_reverse_plan = fft_plan_c2r_3d(
+      ReionGridDim, ReionGridDim, ReionGridDim, grids->x_e_filtered, (float*)grids->x_e_filtered);
+#if USE_MINI_HALOS
+    grids->sfrIII_forward_plan = fft_plan_r2c_3d(
+      ReionGridDim, ReionGridDim, ReionGridDim, grids->sfrIII, grids->sfrIII_unfiltered);
+    grids->sfrIII_filtered_reverse_plan = fft_plan_c2r_3d(
+      ReionGridDim, ReionGridDim, ReionGridDim, grids->sfrIII_filtered, (float*)grids->sfrIII_filtered);
+#endif
+  }
+
+  if (params->Flag_IncludeRecombinations) {
+    grids->N_rec_forward_plan = fft_plan_r2c_3d(
+      ReionGridDim, ReionGridDim, ReionGridDim, grids->N_rec, grids->N_rec_unfiltered);
+    grids->N_rec_filtered_reverse_plan = fft_plan_c2r_3d(
+      ReionGridDim, ReionGridDim, ReionGridDim, grids->N_rec_filtered, (float*)grids->N_rec_filtered);
+  }
+
+  if (params->Flag_Compute21cmBrightTemp && (params->Flag_IncludePecVelsFor21cm > 0)) {
+    grids->vel_forward_plan = fft_plan_r2c_3d(
+      ReionGridDim, ReionGridDim, ReionGridDim, grids->vel, grids->vel_gradient);
+    grids->vel_gradient_reverse_plan = fft_plan_c2r_3d(
+      ReionGridDim, ReionGridDim, ReionGridDim, grids->vel_gradient, (float*)grids->vel_gradient);
+  }
+}
+
+//! The memory required by the reionization grids of a slab which is slab_nix cells wide (without allocating them)
+void reion_grids_footprint(ptrdiff_t slab_nix, ptrdiff_t slab_n_complex, size_t* grids_bytes, size_t* lightcone_bytes)
+{
+  reion_grids_t scratch = { 0 };
+
+  grid_allocator.count_only = true;
+  grid_allocator.n_bytes[MEM_REION_GRIDS] = 0;
+  grid_allocator.n_bytes[MEM_LIGHTCONE] = 0;
+
+  alloc_reion_grids(&scratch, slab_nix, slab_n_complex, slab_nix);
+
+  *grids_bytes = grid_allocator.n_bytes[MEM_REION_GRIDS];
+  *lightcone_bytes = grid_allocator.n_bytes[MEM_LIGHTCONE];
+  grid_allocator.count_only = false;
+}
+
+//! The size of the mapping of ngals galaxies to slabs (see map_galaxies_to_slabs)
+size_t galaxy_to_slab_map_bytes(int ngals)
+{
+  return sizeof(gal_to_slab_t) * (size_t)ngals;
+}
+
+static int galaxy_to_slab_map_ngals = 0;
+
+void free_galaxy_to_slab_map(void)
+{
+  free(run_globals.reion_grids.galaxy_to_slab_map);
+  run_globals.reion_grids.galaxy_to_slab_map = NULL;
+  mem_track(MEM_GALAXIES, -(ptrdiff_t)galaxy_to_slab_map_bytes(galaxy_to_slab_map_ngals));
+  galaxy_to_slab_map_ngals = 0;
+}
+
+void malloc_reionization_grids()
+{
+  mlog("Allocating reionization grids...", MLOG_OPEN);
+
+  reion_grids_t* grids = &(run_globals.reion_grids);
+
+  init_fft_plans();
+
   // run_globals.NStoreSnapshots is set in `initialize_halo_storage`
   run_globals.SnapshotDeltax = (float**)calloc((size_t)run_globals.NStoreSnapshots, sizeof(float*));
   run_globals.SnapshotVel = (float**)calloc((size_t)run_globals.NStoreSnapshots, sizeof(float*));
@@ -650,301 +881,20 @@ void malloc_reionization_grids()
   if (run_globals.params.Flag_PatchyReion) {
     assign_slabs();
 
-    int ReionGridDim = run_globals.params.ReionGridDim;
     ptrdiff_t* slab_nix = run_globals.reion_grids.slab_nix;
-    ptrdiff_t slab_n_real = slab_nix[run_globals.mpi_rank] * ReionGridDim * ReionGridDim;
     ptrdiff_t slab_n_complex = run_globals.reion_grids.slab_n_complex[run_globals.mpi_rank];
 
-    ptrdiff_t slab_n_real_smoothedSFR;
-    if (run_globals.params.Flag_IncludeSpinTemp) {
-      slab_n_real_smoothedSFR =
-        slab_nix[run_globals.mpi_rank] * run_globals.params.TsNumFilterSteps * ReionGridDim * ReionGridDim;
-    }
-
-    ptrdiff_t slab_n_real_LC;
-    if (run_globals.params.Flag_ConstructLightcone) {
-      slab_n_real_LC = slab_nix[run_globals.mpi_rank] * ReionGridDim * run_globals.params.LightconeLength;
-    }
-
-    // create a buffer on each rank which is as large as the largest LOGICAL allocation on any single rank
-    int max_cells = 0;
-
+    ptrdiff_t max_slab_nix = 0;
     for (int ii = 0; ii < run_globals.mpi_size; ii++)
-      if (slab_nix[ii] > max_cells)
-        max_cells = (int)slab_nix[ii];
-
-    max_cells *= ReionGridDim * ReionGridDim;
-    grids->buffer_size = max_cells;
-
-    grids->buffer = fftwf_alloc_real((size_t)max_cells);
-
-    grids->stars = fftwf_alloc_real((size_t)slab_n_complex * 2);
-    grids->stars_unfiltered = fftwf_alloc_complex((size_t)slab_n_complex);
-    grids->stars_filtered = fftwf_alloc_complex((size_t)slab_n_complex);
-
-    grids->stars_forward_plan = fftwf_mpi_plan_dft_r2c_3d(ReionGridDim,
-                                                          ReionGridDim,
-                                                          ReionGridDim,
-                                                          grids->stars,
-                                                          grids->stars_unfiltered,
-                                                          run_globals.mpi_comm,
-                                                          plan_flags);
-    grids->stars_filtered_reverse_plan = fftwf_mpi_plan_dft_c2r_3d(ReionGridDim,
-                                                                   ReionGridDim,
-                                                                   ReionGridDim,
-                                                                   grids->stars_filtered,
-                                                                   (float*)grids->stars_filtered,
-                                                                   run_globals.mpi_comm,
-                                                                   plan_flags);
-
-    grids->deltax = fftwf_alloc_real((size_t)slab_n_complex * 2);
-    grids->deltax_unfiltered = fftwf_alloc_complex((size_t)slab_n_complex);
-    grids->deltax_filtered = fftwf_alloc_complex((size_t)slab_n_complex);
-
-    grids->deltax_forward_plan = fftwf_mpi_plan_dft_r2c_3d(ReionGridDim,
-                                                           ReionGridDim,
-                                                           ReionGridDim,
-                                                           grids->deltax,
-                                                           grids->deltax_unfiltered,
-                                                           run_globals.mpi_comm,
-                                                           plan_flags);
-    grids->deltax_filtered_reverse_plan = fftwf_mpi_plan_dft_c2r_3d(ReionGridDim,
-                                                                    ReionGridDim,
-                                                                    ReionGridDim,
-                                                                    grids->deltax_filtered,
-                                                                    (float*)grids->deltax_filtered,
-                                                                    run_globals.mpi_comm,
-                                                                    plan_flags);
-
-    grids->weighted_sfr = fftwf_alloc_real((size_t)slab_n_complex * 2);
-    grids->weighted_sfr_unfiltered = fftwf_alloc_complex((size_t)slab_n_complex);
-    grids->weighted_sfr_filtered = fftwf_alloc_complex((size_t)slab_n_complex);
-
-    grids->weighted_sfr_forward_plan = fftwf_mpi_plan_dft_r2c_3d(ReionGridDim,
-                                                                 ReionGridDim,
-                                                                 ReionGridDim,
-                                                                 grids->weighted_sfr,
-                                                                 grids->weighted_sfr_unfiltered,
-                                                                 run_globals.mpi_comm,
-                                                                 plan_flags);
-    grids->weighted_sfr_filtered_reverse_plan = fftwf_mpi_plan_dft_c2r_3d(ReionGridDim,
-                                                                          ReionGridDim,
-                                                                          ReionGridDim,
-                                                                          grids->weighted_sfr_filtered,
-                                                                          (float*)grids->weighted_sfr_filtered,
-                                                                          run_globals.mpi_comm,
-                                                                          plan_flags);
-#if USE_MINI_HALOS
-    grids->starsIII = fftwf_alloc_real((size_t)slab_n_complex * 2);
-    grids->starsIII_unfiltered = fftwf_alloc_complex((size_t)slab_n_complex);
-    grids->starsIII_filtered = fftwf_alloc_complex((size_t)slab_n_complex);
-
-    grids->starsIII_forward_plan = fftwf_mpi_plan_dft_r2c_3d(ReionGridDim,
-                                                             ReionGridDim,
-                                                             ReionGridDim,
-                                                             grids->starsIII,
-                                                             grids->starsIII_unfiltered,
-                                                             run_globals.mpi_comm,
-                                                             plan_flags);
-    grids->starsIII_filtered_reverse_plan = fftwf_mpi_plan_dft_c2r_3d(ReionGridDim,
-                                                                      ReionGridDim,
-                                                                      ReionGridDim,
-                                                                      grids->starsIII_filtered,
-                                                                      (float*)grids->starsIII_filtered,
-                                                                      run_globals.mpi_comm,
-                                                                      plan_flags);
-
-    grids->weighted_sfrIII = fftwf_alloc_real((size_t)slab_n_complex * 2);
-    grids->weighted_sfrIII_unfiltered = fftwf_alloc_complex((size_t)slab_n_complex);
-    grids->weighted_sfrIII_filtered = fftwf_alloc_complex((size_t)slab_n_complex);
-
-    grids->weighted_sfrIII_forward_plan = fftwf_mpi_plan_dft_r2c_3d(ReionGridDim,
-                                                                    ReionGridDim,
-                                                                    ReionGridDim,
-                                                                    grids->weighted_sfrIII,
-                                                                    grids->weighted_sfrIII_unfiltered,
-                                                                    run_globals.mpi_comm,
-                                                                    plan_flags);
-    grids->weighted_sfrIII_filtered_reverse_plan = fftwf_mpi_plan_dft_c2r_3d(ReionGridDim,
-                                                                             ReionGridDim,
-                                                                             ReionGridDim,
-                                                                             grids->weighted_sfrIII_filtered,
-                                                                             (float*)grids->weighted_sfrIII_filtered,
-                                                                             run_globals.mpi_comm,
-                                                                             plan_flags);
-#endif
-
-    grids->xH = fftwf_alloc_real((size_t)slab_n_real);
-    grids->z_at_ionization = fftwf_alloc_real((size_t)slab_n_real);
-    grids->r_bubble = fftwf_alloc_real((size_t)slab_n_real);
-
-#if USE_MINI_HALOS
-    if (run_globals.params.Flag_IncludeLymanWerner) {
-      grids->JLW_box = fftwf_alloc_real((size_t)slab_n_real);
-      grids->JLW_boxII = fftwf_alloc_real((size_t)slab_n_real);
-    }
-#endif
-
-    if (run_globals.params.Flag_IncludeSpinTemp) {
+      if (slab_nix[ii] > max_slab_nix)
+        max_slab_nix = slab_nix[ii];
 
-      grids->sfr = fftwf_alloc_real((size_t)slab_n_complex * 2);
-      grids->sfr_histories = fftwf_alloc_real((size_t)slab_n_complex * 2 * run_globals.NstoreSnapshots_SFR);
-      grids->sfr_unfiltered = fftwf_alloc_complex((size_t)slab_n_complex);
-      grids->sfr_filtered = fftwf_alloc_complex((size_t)slab_n_complex);
-
-      grids->sfr_forward_plan = fftwf_mpi_plan_dft_r2c_3d(
-        ReionGridDim, ReionGridDim, ReionGridDim, grids->sfr, grids->sfr_unfiltered, run_globals.mpi_comm, plan_flags);
-      grids->sfr_filtered_reverse_plan = fftwf_mpi_plan_dft_c2r_3d(ReionGridDim,
-                                                                   ReionGridDim,
-                                                                   ReionGridDim,
-                                                                   grids->sfr_filtered,
-                                                                   (float*)grids->sfr_filtered,
-                                                                   run_globals.mpi_comm,
-                                                                   plan_flags);
-
-      grids->x_e_box = fftwf_alloc_real((size_t)slab_n_complex * 2);
-      grids->x_e_unfiltered = fftwf_alloc_complex((size_t)slab_n_complex);
-      grids->x_e_filtered = fftwf_alloc_complex((size_t)slab_n_complex);
-      grids->x_e_box_prev = fftwf_alloc_real((size_t)slab_n_complex * 2);
-
-      grids->x_e_box_forward_plan = fftwf_mpi_plan_dft_r2c_3d(ReionGridDim,
-                                                              ReionGridDim,
-                                                              ReionGridDim,
-                                                              grids->x_e_box,
-                                                              grids->x_e_unfiltered,
-                                                              run_globals.mpi_comm,
-                                                              plan_flags);
-      grids->x_e_filtered_reverse_plan = fftwf_mpi_plan_dft_c2r_3d(ReionGridDim,
-                                                                   ReionGridDim,
-                                                                   ReionGridDim,
-                                                                   grids->x_e_filtered,
-                                                                   (float*)grids->x_e_filtered,
-                                                                   run_globals.mpi_comm,
-                                                                   plan_flags);
-
-#if USE_MINI_HALOS
-      grids->sfrIII = fftwf_alloc_real((size_t)slab_n_complex * 2);
-      grids->sfrIII_histories = fftwf_alloc_real((size_t)slab_n_complex * 2 * run_globals.NstoreSnapshots_SFR);
-      grids->sfrIII_unfiltered = fftwf_alloc_complex((size_t)slab_n_complex);
-      grids->sfrIII_filtered = fftwf_alloc_complex((size_t)slab_n_complex);
-
-      grids->sfrIII_forward_plan = fftwf_mpi_plan_dft_r2c_3d(ReionGridDim,
-                                                             ReionGridDim,
-                                                             ReionGridDim,
-                                                             grids->sfrIII,
-                                                             grids->sfrIII_unfiltered,
-                                                             run_globals.mpi_comm,
-                                                             plan_flags);
-      grids->sfrIII_filtered_reverse_plan = fftwf_mpi_plan_dft_c2r_3d(ReionGridDim,
-                                                                      ReionGridDim,
-                                                                      ReionGridDim,
-                                                                      grids->sfrIII_filtered,
-                                                                      (float*)grids->sfrIII_filtered,
-                                                                      run_globals.mpi_comm,
-                                                                      plan_flags);
-
-#endif
-      grids->Tk_box = fftwf_alloc_real((size_t)slab_n_real);
-      grids->TS_box = fftwf_alloc_real((size_t)slab_n_real);
-
-      grids->SMOOTHED_SFR_GAL = calloc((size_t)slab_n_real_smoothedSFR, sizeof(double));
-#if USE_MINI_HALOS
-      grids->Tk_boxII = fftwf_alloc_real((size_t)slab_n_real);
-      grids->TS_boxII = fftwf_alloc_real((size_t)slab_n_real);
-
-      grids->SMOOTHED_SFR_III = calloc((size_t)slab_n_real_smoothedSFR, sizeof(double));
-#endif
-    }
-
-    if (run_globals.params.Flag_IncludeRecombinations) {
-      grids->N_rec = fftwf_alloc_real((size_t)slab_n_complex * 2);
-      grids->N_rec_unfiltered = fftwf_alloc_complex((size_t)slab_n_complex);
-      grids->N_rec_filtered = fftwf_alloc_complex((size_t)slab_n_complex);
-
-      grids->N_rec_forward_plan = fftwf_mpi_plan_dft_r2c_3d(ReionGridDim,
-                                                            ReionGridDim,
-                                                            ReionGridDim,
-                                                            grids->N_rec,
-                                                            grids->N_rec_unfiltered,
-                                                            run_globals.mpi_comm,
-                                                            plan_flags);
-      grids->N_rec_filtered_reverse_plan = fftwf_mpi_plan_dft_c2r_3d(ReionGridDim,
-                                                                     ReionGridDim,
-                                                                     ReionGridDim,
-                                                                     grids->N_rec_filtered,
-                                                                     (float*)grids->N_rec_filtered,
-                                                                     run_globals.mpi_comm,
-                                                                     plan_flags);
-
-      grids->z_re = fftwf_alloc_real((size_t)slab_n_real);
-      grids->Gamma12 = fftwf_alloc_real((size_t)slab_n_real);
-    }
-
-    if (run_globals.params.Flag_Compute21cmBrightTemp) {
-      grids->delta_T = fftwf_alloc_real((size_t)slab_n_real);
-#if USE_MINI_HALOS
-      grids->delta_TII = fftwf_alloc_real((size_t)slab_n_real);
-#endif
-
-      if (run_globals.params.Flag_IncludePecVelsFor21cm > 0) {
-        grids->vel = fftwf_alloc_real((size_t)slab_n_complex * 2);
-        grids->vel_gradient = fftwf_alloc_complex((size_t)slab_n_complex);
-
-        grids->vel_forward_plan = fftwf_mpi_plan_dft_r2c_3d(
-          ReionGridDim, ReionGridDim, ReionGridDim, grids->vel, grids->vel_gradient, run_globals.mpi_comm, plan_flags);
-        grids->vel_gradient_reverse_plan = fftwf_mpi_plan_dft_c2r_3d(ReionGridDim,
-                                                                     ReionGridDim,
-                                                                     ReionGridDim,
-                                                                     grids->vel_gradient,
-                                                                     (float*)grids->vel_gradient,
-                                                                     run_globals.mpi_comm,
-                                                                     plan_flags);
-      }
-
-      if (run_globals.params.Flag_ConstructLightcone) {
-        grids->delta_T_prev = fftwf_alloc_real((size_t)slab_n_real);
-#if USE_MINI_HALOS
-        grids->delta_TII_prev = fftwf_alloc_real((size_t)slab_n_real);
-#endif
-      }
-    }
-
-    if (run_globals.params.ReionUVBFlag) {
-      grids->J_21_at_ionization = fftwf_alloc_real((size_t)slab_n_real);
-      grids->J_21 = fftwf_alloc_real((size_t)slab_n_real);
-      grids->Mvir_crit = fftwf_alloc_real((size_t)slab_n_real);
-
-#if USE_MINI_HALOS
-      if (run_globals.params.Flag_IncludeLymanWerner)
-        grids->Mvir_crit_MC = fftwf_alloc_real((size_t)slab_n_real);
-#endif
-    }
-
-    if (run_globals.params.Flag_ConstructLightcone) {
-      grids->LightconeBox = fftwf_alloc_real((size_t)slab_n_real_LC);
-      grids->Lightcone_redshifts = fftwf_alloc_real((size_t)run_globals.params.LightconeLength);
-    }
-
-    if (run_globals.params.Flag_ComputePS) {
-      grids->PS_k = fftwf_alloc_real((size_t)run_globals.params.PS_Length);
-      grids->PS_data = fftwf_alloc_real((size_t)run_globals.params.PS_Length);
-      grids->PS_error = fftwf_alloc_real((size_t)run_globals.params.PS_Length);
-#if USE_MINI_HALOS
-      grids->PSII_data = fftwf_alloc_real((size_t)run_globals.params.PS_Length);
-      grids->PSII_error = fftwf_alloc_real((size_t)run_globals.params.PS_Length);
-#endif
-    }
+    alloc_reion_grids(grids, slab_nix[run_globals.mpi_rank], slab_n_complex, max_slab_nix);
+    plan_reion_grids(grids);
 
     init_reion_grids();
 
-    if (run_globals.reion_grids.flag_wisdom && save_wisdom) {
-      fftwf_mpi_gather_wisdom(run_globals.mpi_comm);
-      if (run_globals.mpi_rank == 0) {
-        if (fftwf_export_wisdom_to_filename(wisdom_fname)) {
-          mlog("Successfully saved FFTW3 wisdom to %s", MLOG_MESG, wisdom_fname);
-        }
-      }
-    }
+    save_fft_wisdom();
 
   } // if (run_globals.params.Flag_PatchyReion)
 
@@ -997,8 +947,6 @@ void free_reionization_grids()
     }
 
     if (run_globals.params.Flag_IncludePecVelsFor21cm > 0) {
-      fftwf_destroy_plan(grids->vel_gradient_reverse_plan);
-      fftwf_destroy_plan(grids->vel_forward_plan);
       fftwf_free(grids->vel_gradient);
       fftwf_free(grids->vel);
     }
@@ -1014,8 +962,6 @@ void free_reionization_grids()
     fftwf_free(grids->Gamma12);
     fftwf_free(grids->z_re);
 
-    fftwf_destroy_plan(grids->N_rec_filtered_reverse_plan);
-    fftwf_destroy_plan(grids->N_rec_forward_plan);
     fftwf_free(grids->N_rec_filtered);
     fftwf_free(grids->N_rec_unfiltered);
     fftwf_free(grids->N_rec);
@@ -1034,23 +980,17 @@ void free_reionization_grids()
     fftwf_free(grids->TS_boxII);
 #endif
 
-    fftwf_destroy_plan(grids->x_e_filtered_reverse_plan);
-    fftwf_destroy_plan(grids->x_e_box_forward_plan);
     fftwf_free(grids->x_e_filtered);
     fftwf_free(grids->x_e_unfiltered);
     fftwf_free(grids->x_e_box_prev);
     fftwf_free(grids->x_e_box);
 
-    fftwf_destroy_plan(grids->sfr_filtered_reverse_plan);
-    fftwf_destroy_plan(grids->sfr_forward_plan);
     fftwf_free(grids->sfr_filtered);
     fftwf_free(grids->sfr_unfiltered);
     fftwf_free(grids->sfr);
     fftwf_free(grids->sfr_histories);
 
 #if USE_MINI_HALOS
-    fftwf_destroy_plan(grids->sfrIII_filtered_reverse_plan);
-    fftwf_destroy_plan(grids->sfrIII_forward_plan);
     fftwf_free(grids->sfrIII_filtered);
     fftwf_free(grids->sfrIII_unfiltered);
     fftwf_free(grids->sfrIII);
@@ -1069,33 +1009,23 @@ void free_reionization_grids()
   fftwf_free(grids->z_at_ionization);
   fftwf_free(grids->xH);
 
-  fftwf_destroy_plan(grids->weighted_sfr_filtered_reverse_plan);
-  fftwf_destroy_plan(grids->weighted_sfr_forward_plan);
   fftwf_free(grids->weighted_sfr_filtered);
   fftwf_free(grids->weighted_sfr_unfiltered);
   fftwf_free(grids->weighted_sfr);
 
-  fftwf_destroy_plan(grids->deltax_filtered_reverse_plan);
-  fftwf_destroy_plan(grids->deltax_forward_plan);
   fftwf_free(grids->deltax_filtered);
   fftwf_free(grids->deltax_unfiltered);
   fftwf_free(grids->deltax);
 
-  fftwf_destroy_plan(grids->stars_filtered_reverse_plan);
-  fftwf_destroy_plan(grids->stars_forward_plan);
   fftwf_free(grids->stars_filtered);
   fftwf_free(grids->stars_unfiltered);
   fftwf_free(grids->stars);
 
 #if USE_MINI_HALOS
-  fftwf_destroy_plan(grids->weighted_sfrIII_filtered_reverse_plan);
-  fftwf_destroy_plan(grids->weighted_sfrIII_forward_plan);
   fftwf_free(grids->weighted_sfrIII_filtered);
   fftwf_free(grids->weighted_sfrIII_unfiltered);
   fftwf_free(grids->weighted_sfrIII);
 
-  fftwf_destroy_plan(grids->starsIII_filtered_reverse_plan);
-  fftwf_destroy_plan(grids->starsIII_forward_plan);
   fftwf_free(grids->starsIII_filtered);
   fftwf_free(grids->starsIII_unfiltered);
   fftwf_free(grids->starsIII);
@@ -1103,9 +1033,22 @@ void free_reionization_grids()
 
   fftwf_free(grids->buffer);
 
+  mem_track(MEM_REION_GRIDS, -(ptrdiff_t)mem_current(MEM_REION_GRIDS));
+  mem_track(MEM_LIGHTCONE, -(ptrdiff_t)mem_current(MEM_LIGHTCONE));
+
   mlog(" ...done", MLOG_CLOSE);
 }
 
+//! The (real) grid index of the cell containing a galaxy within its slab
+int galaxy_slab_cell(galaxy_t* gal, int ix_local, int dim)
+{
+  double box_size = run_globals.params.BoxSize;
+  int iy = pos_to_ngp(gal->Pos[1], box_size, dim);
+  int iz = pos_to_ngp(gal->Pos[2], box_size, dim);
+
+  return grid_index(ix_local, iy, iz, dim, INDEX_REAL);
+}
+
 int map_galaxies_to_slabs(int ngals)
 {
   double box_size = run_globals.params.BoxSize;
@@ -1114,13 +1057,19 @@ int map_galaxies_to_slabs(int ngals)
   mlog("Mapping galaxies to slabs...", MLOG_OPEN);
 
   // Loop through each valid galaxy and find what slab it sits in
-  if (ngals > 0)
-    run_globals.reion_grids.galaxy_to_slab_map = malloc(sizeof(gal_to_slab_t) * ngals);
-  else
+  if (ngals > 0) {
+    run_globals.reion_grids.galaxy_to_slab_map = malloc(galaxy_to_slab_map_bytes(ngals));
+    mem_track(MEM_GALAXIES, (ptrdiff_t)galaxy_to_slab_map_bytes(ngals));
+    galaxy_to_slab_map_ngals = ngals;
+  } else
     run_globals.reion_grids.galaxy_to_slab_map = NULL;
 
   gal_to_slab_t* galaxy_to_slab_map = run_globals.reion_grids.galaxy_to_slab_map;
   ptrdiff_t* slab_ix_start = run_globals.reion_grids.slab_ix_start;
+  bool sort_by_cell = run_globals.params.FlagSortGalaxiesByCell;
+
+  int* slab_of_ix = malloc(sizeof(int) * ReionGridDim);
+  fill_slab_lookup(slab_of_ix, slab_ix_start, run_globals.reion_grids.slab_nix, run_globals.mpi_size);
 
   galaxy_t* gal = run_globals.FirstGal;
   int gal_counter = 0;
@@ -1141,18 +1090,24 @@ int map_galaxies_to_slabs(int ngals)
 
       assert((ix >= 0) && (ix < ReionGridDim));
 
+      int slab_ind = slab_of_ix[ix];
+
       galaxy_to_slab_map[gal_counter].index = gal_counter;
-      galaxy_to_slab_map[gal_counter].slab_ind =
-        searchsorted(&ix, slab_ix_start, run_globals.mpi_size, sizeof(ptrdiff_t), compare_ptrdiff, -1, -1);
+      galaxy_to_slab_map[gal_counter].slab_ind = slab_ind;
+      galaxy_to_slab_map[gal_counter].cell =
+        sort_by_cell ? galaxy_slab_cell(gal, (int)(ix - slab_ix_start[slab_ind]), ReionGridDim) : 0;
       galaxy_to_slab_map[gal_counter++].galaxy = gal;
     }
 
     gal = gal->Next;
   }
 
-  // sort the slab indices IN PLACE (n.b. compare_slab_assign is a stable comparison)
+  free(slab_of_ix);
+
+  // sort the slab indices IN PLACE.  If requested, galaxies are also ordered by the cell they occupy, so that the
+  // grids are traversed in memory order when galaxies are deposited into them or read back from them.
   if (galaxy_to_slab_map != NULL)
-    qsort(galaxy_to_slab_map, (size_t)gal_counter, sizeof(gal_to_slab_t), compare_slab_assign);
+    sort_slab_assignments(galaxy_to_slab_map, gal_counter, run_globals.mpi_size);
 
   assert(gal_counter == ngals);
 
@@ -1395,13 +1350,14 @@ void construct_baryon_grids(int snapshot, int local_ngals)
     }
   }
 
-  // loop through each slab
+  // Make a single pass through the local galaxies, recording the (padded) cell index of each in its destination slab
+  // along with its contribution to every grid.  These are then sent to the ranks which own the slabs in one exchange,
+  // rather than reducing a full slab-sized buffer on to every rank for every property.
   //
   // N.B. We are assuming here that the galaxy_to_slab mapping has been sorted
   // by slab index...
   ptrdiff_t* slab_nix = run_globals.reion_grids.slab_nix;
-  ptrdiff_t buffer_size = run_globals.reion_grids.buffer_size;
-  float* buffer = run_globals.reion_grids.buffer;
+  int mpi_size = run_globals.mpi_size;
 
   enum property
   {
@@ -1412,208 +1368,293 @@ void construct_baryon_grids(int snapshot, int local_ngals)
     prop_weighted_sfrIII,
     prop_sfrIII,
 #endif
-    prop_sfr
+    prop_sfr,
+    n_props
   };
-  for (int prop = prop_stellar; prop <= prop_sfr; prop++) {
-
-    // no need for sfr or sfrIII grid is not using SpinTemp
-#if USE_MINI_HALOS
-    if ((!run_globals.params.Flag_IncludeSpinTemp) && (prop == prop_sfrIII))
-      continue;
-#endif
 
-    if ((!run_globals.params.Flag_IncludeSpinTemp) && (prop == prop_sfr))
+  // no need for sfr or sfrIII grid is not using SpinTemp
+  int props[n_props];
+  int n_active_props = 0;
+  props[n_active_props++] = prop_stellar;
+  props[n_active_props++] = prop_weighted_sfr;
+#if USE_MINI_HALOS
+  props[n_active_props++] = prop_stellarIII;
+  props[n_active_props++] = prop_weighted_sfrIII;
+  if (run_globals.params.Flag_IncludeSpinTemp)
+    props[n_active_props++] = prop_sfrIII;
+#endif
+  if (run_globals.params.Flag_IncludeSpinTemp)
+    props[n_active_props++] = prop_sfr;
+
+  int* send_counts = calloc((size_t)mpi_size * 4, sizeof(int));
+  int* send_displs = send_counts + mpi_size;
+  int* recv_counts = send_counts + 2 * mpi_size;
+  int* recv_displs = send_counts + 3 * mpi_size;
+
+  size_t n_alloc = (size_t)(local_ngals > 0 ? local_ngals : 1);
+  int* send_cells = malloc(sizeof(int) * n_alloc);
+  float* send_vals = malloc(sizeof(float) * n_alloc * (size_t)n_active_props);
+
+  int n_send = 0;
+  int skipped_gals = 0;
+  long N_BlackHoleMassLimitReion = 0;
+
+  // if this core holds no galaxies then we don't need to fill the buffers
+  for (int i_gal = 0; (i_gal - skipped_gals) < local_ngals; i_gal++) {
+    galaxy_t* gal = galaxy_to_slab_map[i_gal].galaxy;
+
+    // Dead galaxies should not be included here and are not in the
+    // local_ngals count.  They will, however, have been assigned to a
+    // slab so we will need to ignore them here...
+    if (gal->Type > 2) {
+      skipped_gals++;
       continue;
+    }
 
-    int i_gal = 0;
-    int skipped_gals = 0;
-    long N_BlackHoleMassLimitReion = 0;
-
-    for (int i_r = 0; i_r < run_globals.mpi_size; i_r++) {
-      // init the buffer
-      for (int ii = 0; ii < buffer_size; ii++)
-        buffer[ii] = (float)0.;
-
-      // if this core holds no galaxies then we don't need to fill the buffer
-      if (local_ngals != 0)
-        // fill the local buffer for this slab
-        while (((i_gal - skipped_gals) < local_ngals) && (galaxy_to_slab_map[i_gal].slab_ind == i_r)) {
-          galaxy_t* gal = galaxy_to_slab_map[i_gal].galaxy;
-
-          // Dead galaxies should not be included here and are not in the
-          // local_ngals count.  They will, however, have been assigned to a
-          // slab so we will need to ignore them here...
-          if (gal->Type > 2) {
-            i_gal++;
-            skipped_gals++;
-            continue;
-          }
+    int i_r = galaxy_to_slab_map[i_gal].slab_ind;
 
-          assert(galaxy_to_slab_map[i_gal].index >= 0);
-          assert((galaxy_to_slab_map[i_gal].slab_ind >= 0) &&
-                 (galaxy_to_slab_map[i_gal].slab_ind < run_globals.mpi_size));
+    assert(galaxy_to_slab_map[i_gal].index >= 0);
+    assert((i_r >= 0) && (i_r < mpi_size));
 
-          int ix = (int)(pos_to_ngp(gal->Pos[0], box_size, ReionGridDim) - slab_ix_start[i_r]);
-          int iy = pos_to_ngp(gal->Pos[1], box_size, ReionGridDim);
-          int iz = pos_to_ngp(gal->Pos[2], box_size, ReionGridDim);
+    int ix = (int)(pos_to_ngp(gal->Pos[0], box_size, ReionGridDim) - slab_ix_start[i_r]);
+    int iy = pos_to_ngp(gal->Pos[1], box_size, ReionGridDim);
+    int iz = pos_to_ngp(gal->Pos[2], box_size, ReionGridDim);
 
-          assert((ix < slab_nix[i_r]) && (ix >= 0));
-          assert((iy < ReionGridDim) && (iy >= 0));
-          assert((iz < ReionGridDim) && (iz >= 0));
+    assert((ix < slab_nix[i_r]) && (ix >= 0));
+    assert((iy < ReionGridDim) && (iy >= 0));
+    assert((iz < ReionGridDim) && (iz >= 0));
 
-          int ind = grid_index(ix, iy, iz, ReionGridDim, INDEX_REAL);
+    send_cells[n_send] = grid_index(ix, iy, iz, ReionGridDim, INDEX_PADDED);
+    send_counts[i_r]++;
 
-          assert((ind >= 0) && (ind < slab_nix[i_r] * ReionGridDim * ReionGridDim));
+    float* vals = &send_vals[n_send * n_active_props];
+    for (int i_prop = 0; i_prop < n_active_props; i_prop++) {
+      double val = 0.0;
 
-          // They are the same just now, but may be different in the future once the model is improved.
-          switch (prop) {
-            case prop_stellar:
+      // They are the same just now, but may be different in the future once the model is improved.
+      switch (props[i_prop]) {
+        case prop_stellar:
+          val = gal->FescWeightedGSM; // Only Pop II
+          // a trick to include quasar radiation using current 21cmFAST code
+          if (run_globals.params.physics.Flag_BHFeedback) {
+            if (gal->BlackHoleMass >= run_globals.params.physics.BlackHoleMassLimitReion)
+              val += gal->EffectiveBHM;
+            else
+              N_BlackHoleMassLimitReion += 1;
+          }
+          break;
+
+#if USE_MINI_HALOS
+        case prop_stellarIII:
+        case prop_weighted_sfrIII:
+          val = gal->FescIIIWeightedGSM;
+          break;
+
+        case prop_sfrIII:
+          val = gal->GrossStellarMassIII;
+          // this sfr grid is used for X-ray and Lyman, PopIII.
+          break;
+#endif
+        case prop_weighted_sfr:
+          val = gal->FescWeightedGSM;
+          // for ionizing_source_formation_rate_grid, need further convertion due to different UV spectral index of
+          // quasar and stellar component
+          if (run_globals.params.physics.Flag_BHFeedback)
+            if (gal->BlackHoleMass >= run_globals.params.physics.BlackHoleMassLimitReion)
+              val += gal->EffectiveBHM * run_globals.params.physics.ReionAlphaUVBH /
+                     run_globals.params.physics.ReionAlphaUV;
+          break;
+
+        case prop_sfr:
+          val = gal->GrossStellarMass;
+          // this sfr grid is used for X-ray and Lyman, PopII.
+          break;
+
+        default:
+          mlog_error("Unrecognised property in slab creation.");
+          ABORT(EXIT_FAILURE);
+          break;
+      }
 
-              buffer[ind] += gal->FescWeightedGSM; // Only Pop II
-              // a trick to include quasar radiation using current 21cmFAST code
-              if (run_globals.params.physics.Flag_BHFeedback) {
-                if (gal->BlackHoleMass >= run_globals.params.physics.BlackHoleMassLimitReion)
-                  buffer[ind] += gal->EffectiveBHM;
-                else
-                  N_BlackHoleMassLimitReion += 1;
-              }
-              break;
+      vals[i_prop] = (float)val;
+    }
 
-#if USE_MINI_HALOS
-            case prop_stellarIII:
+    n_send++;
+  }
 
-              buffer[ind] += gal->FescIIIWeightedGSM;
+  // exchange the cell indices and then all of the property values with the ranks which own them
+  MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, run_globals.mpi_comm);
 
-              break;
+  int n_recv = 0;
+  for (int ii = 0; ii < mpi_size; ii++) {
+    send_displs[ii] = (ii > 0) ? send_displs[ii - 1] + send_counts[ii - 1] : 0;
+    recv_displs[ii] = n_recv;
+    n_recv += recv_counts[ii];
+  }
 
-            case prop_weighted_sfrIII:
+  int* recv_cells = malloc(sizeof(int) * (size_t)(n_recv > 0 ? n_recv : 1));
+  float* recv_vals = malloc(sizeof(float) * (size_t)(n_recv > 0 ? n_recv : 1) * (size_t)n_active_props);
 
-              buffer[ind] += gal->FescIIIWeightedGSM;
+  MPI_Alltoallv(
+    send_cells, send_counts, send_displs, MPI_INT, recv_cells, recv_counts, recv_displs, MPI_INT, run_globals.mpi_comm);
 
-              break;
+  for (int ii = 0; ii < mpi_size; ii++) {
+    send_counts[ii] *= n_active_props;
+    send_displs[ii] *= n_active_props;
+    recv_counts[ii] *= n_active_props;
+    recv_displs[ii] *= n_active_props;
+  }
 
-            case prop_sfrIII:
+  MPI_Alltoallv(send_vals,
+                send_counts,
+                send_displs,
+                MPI_FLOAT,
+                recv_vals,
+                recv_counts,
+                recv_displs,
+                MPI_FLOAT,
+                run_globals.mpi_comm);
+
+  free(send_vals);
+  free(send_cells);
+  free(send_counts);
+
+  float* prop_grids[n_props];
+  prop_grids[prop_stellar] = stellar_grid;
+  prop_grids[prop_weighted_sfr] = weighted_sfr_grid;
+  prop_grids[prop_sfr] = sfr_grid;
+#if USE_MINI_HALOS
+  prop_grids[prop_stellarIII] = stellarIII_grid;
+  prop_grids[prop_weighted_sfrIII] = weighted_sfrIII_grid;
+  prop_grids[prop_sfrIII] = sfrIII_grid;
+#endif
+
+  // deposit the received contributions into our slab
+  for (int ii = 0; ii < n_recv; ii++)
+    for (int i_prop = 0; i_prop < n_active_props; i_prop++)
+      prop_grids[props[i_prop]][recv_cells[ii]] += recv_vals[ii * n_active_props + i_prop];
+
+  free(recv_vals);
+  free(recv_cells);
+
+  // Do one final pass and divide the sfr grids by the sfr timescale in order to convert the stellar masses recorded
+  // into SFRs.
+  int local_nix = (int)slab_nix[run_globals.mpi_rank];
+  for (int i_prop = 0; i_prop < n_active_props; i_prop++) {
+    int prop = props[i_prop];
+    float* grid = prop_grids[prop];
+
+    for (int ix = 0; ix < local_nix; ix++)
+      for (int iy = 0; iy < ReionGridDim; iy++)
+        for (int iz = 0; iz < ReionGridDim; iz++) {
+          int ind = grid_index(ix, iy, iz, ReionGridDim, INDEX_PADDED);
 
-              buffer[ind] += gal->GrossStellarMassIII;
-              // this sfr grid is used for X-ray and Lyman, PopIII.
-              break;
+          switch (prop) {
+            case prop_stellar:
+#if USE_MINI_HALOS
+            case prop_stellarIII:
 #endif
-            case prop_weighted_sfr:
-              buffer[ind] += (gal->FescWeightedGSM);
-              // for ionizing_source_formation_rate_grid, need further convertion due to different UV spectral index of
-              // quasar and stellar component
-              if (run_globals.params.physics.Flag_BHFeedback)
-                if (gal->BlackHoleMass >= run_globals.params.physics.BlackHoleMassLimitReion)
-                  buffer[ind] += gal->EffectiveBHM * run_globals.params.physics.ReionAlphaUVBH /
-                                 run_globals.params.physics.ReionAlphaUV;
-              break;
-
-            case prop_sfr:
-              buffer[ind] += gal->GrossStellarMass;
-              // this sfr grid is used for X-ray and Lyman, PopII.
+              if (grid[ind] < 0)
+                grid[ind] = 0;
               break;
 
-            default:
-              mlog_error("Unrecognised property in slab creation.");
-              ABORT(EXIT_FAILURE);
-              break;
+            default: {
+              double val = (double)grid[ind];
+              val = (val > 0) ? val / sfr_timescale : 0;
+              grid[ind] = (float)val;
+            } break;
           }
-
-          i_gal++;
         }
 
-      // reduce on to the correct rank
-      if (run_globals.mpi_rank == i_r)
-        MPI_Reduce(MPI_IN_PLACE, buffer, (int)buffer_size, MPI_FLOAT, MPI_SUM, i_r, run_globals.mpi_comm);
-      else
-        MPI_Reduce(buffer, buffer, (int)buffer_size, MPI_FLOAT, MPI_SUM, i_r, run_globals.mpi_comm);
-
-      if (run_globals.mpi_rank == i_r)
-
-        // Do one final pass and divide the sfr_grid by the sfr timescale
-        // in order to convert the stellar masses recorded into SFRs before
-        // finally copying the values into the appropriate slab.
-        switch (prop) {
-          case prop_weighted_sfr:
-            for (int ix = 0; ix < slab_nix[i_r]; ix++)
-              for (int iy = 0; iy < ReionGridDim; iy++)
-                for (int iz = 0; iz < ReionGridDim; iz++) {
-                  double val = (double)buffer[grid_index(ix, iy, iz, ReionGridDim, INDEX_REAL)];
-                  val = (val > 0) ? val / sfr_timescale : 0;
-                  weighted_sfr_grid[grid_index(ix, iy, iz, ReionGridDim, INDEX_PADDED)] = (float)val;
-                }
-            break;
+    // the newest sfr history is this snapshot's sfr grid
+    if (prop == prop_sfr)
+      memcpy(sfr_histories_grid, sfr_grid, sizeof(float) * (size_t)local_n_complex * 2);
 #if USE_MINI_HALOS
-          case prop_weighted_sfrIII:
-            for (int ix = 0; ix < slab_nix[i_r]; ix++)
-              for (int iy = 0; iy < ReionGridDim; iy++)
-                for (int iz = 0; iz < ReionGridDim; iz++) {
-                  double val = (double)buffer[grid_index(ix, iy, iz, ReionGridDim, INDEX_REAL)];
-                  val = (val > 0) ? val / sfr_timescale : 0;
-                  weighted_sfrIII_grid[grid_index(ix, iy, iz, ReionGridDim, INDEX_PADDED)] = (float)val;
-                }
-            break;
+    if (prop == prop_sfrIII)
+      memcpy(sfrIII_histories_grid, sfrIII_grid, sizeof(float) * (size_t)local_n_complex * 2);
+#endif
+  }
 
-          case prop_sfrIII:
-            for (int ix = 0; ix < slab_nix[i_r]; ix++)
-              for (int iy = 0; iy < ReionGridDim; iy++)
-                for (int iz = 0; iz < ReionGridDim; iz++) {
-                  double val = (double)buffer[grid_index(ix, iy, iz, ReionGridDim, INDEX_REAL)];
-                  val = (val > 0) ? val / sfr_timescale : 0;
-                  sfrIII_grid[grid_index(ix, iy, iz, ReionGridDim, INDEX_PADDED)] = (float)val;
-                  sfrIII_histories_grid[grid_index(ix, iy, iz, ReionGridDim, INDEX_PADDED)] = (float)val;
-                }
-            break;
+  MPI_Allreduce(MPI_IN_PLACE, &N_BlackHoleMassLimitReion, 1, MPI_LONG, MPI_SUM, run_globals.mpi_comm);
+  mlog("%d quasars are smaller than %g",
+       MLOG_MESG,
+       N_BlackHoleMassLimitReion,
+       run_globals.params.physics.BlackHoleMassLimitReion);
 
-          case prop_stellarIII:
-            for (int ix = 0; ix < slab_nix[i_r]; ix++)
-              for (int iy = 0; iy < ReionGridDim; iy++)
-                for (int iz = 0; iz < ReionGridDim; iz++) {
-                  float val = buffer[grid_index(ix, iy, iz, ReionGridDim, INDEX_REAL)];
-                  if (val < 0)
-                    val = 0;
-                  stellarIII_grid[grid_index(ix, iy, iz, ReionGridDim, INDEX_PADDED)] = val;
-                }
-            break;
-#endif
-          case prop_sfr:
-            for (int ix = 0; ix < slab_nix[i_r]; ix++)
-              for (int iy = 0; iy < ReionGridDim; iy++)
-                for (int iz = 0; iz < ReionGridDim; iz++) {
-                  double val = (double)buffer[grid_index(ix, iy, iz, ReionGridDim, INDEX_REAL)];
-                  val = (val > 0) ? val / sfr_timescale : 0;
-                  sfr_grid[grid_index(ix, iy, iz, ReionGridDim, INDEX_PADDED)] = (float)val;
-                  sfr_histories_grid[grid_index(ix, iy, iz, ReionGridDim, INDEX_PADDED)] = (float)val;
-                }
-            break;
+  mlog("done", MLOG_CLOSE | MLOG_TIMERSTOP);
+}
 
-          case prop_stellar:
-            for (int ix = 0; ix < slab_nix[i_r]; ix++)
-              for (int iy = 0; iy < ReionGridDim; iy++)
-                for (int iz = 0; iz < ReionGridDim; iz++) {
-                  float val = buffer[grid_index(ix, iy, iz, ReionGridDim, INDEX_REAL)];
-                  if (val < 0)
-                    val = 0;
-                  stellar_grid[grid_index(ix, iy, iz, ReionGridDim, INDEX_PADDED)] = val;
-                }
-            break;
+//! Create the dataset creation property list of an output grid, chunked along the x-axis
+// N.B. This only sets the shape of the chunks.  The number of x-planes in each chunk and the filters are chosen for
+// each grid in write_grid_float.
+static hid_t create_grid_dcpl(int dim, int nz)
+{
+  hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+  H5Pset_chunk(dcpl_id, 3, (hsize_t[3]){ 1, (hsize_t)dim, (hsize_t)nz });
 
-          default:
-            mlog_error("Eh!?!");
-            ABORT(EXIT_FAILURE);
-        }
+  return dcpl_id;
+}
+
+static char* trim_whitespace(char* str)
+{
+  while (isspace((unsigned char)*str))
+    str++;
+
+  char* end = str + strlen(str);
+  while ((end > str) && isspace((unsigned char)end[-1]))
+    end--;
+  *end = '\0';
+
+  return str;
+}
+
+//! The value of a per-grid output option (e.g. GridChunkNx) for the named grid
+static int grid_output_option(const char* option, const char* param_name, const char* grid_name, int default_value)
+{
+  char buffer[STRLEN];
+  int value = default_value;
+
+  strncpy(buffer, option, STRLEN - 1);
+  buffer[STRLEN - 1] = '\0';
+
+  // Entries are separated by commas and are of the form name:value, where a name of * (or a value on its own) matches
+  // every grid but explicit names take precedence.  Grid names may contain spaces (e.g. "Average Radius").
+  for (char* entry = strtok(buffer, ","); entry != NULL; entry = strtok(NULL, ",")) {
+    char original[STRLEN];
+    strcpy(original, entry);
+
+    char* entry_name = "*";
+    char* entry_value = entry;
+    char* sep = strrchr(entry, ':');
+    if (sep != NULL) {
+      *sep = '\0';
+      entry_name = trim_whitespace(entry);
+      entry_value = sep + 1;
     }
-    MPI_Allreduce(MPI_IN_PLACE, &N_BlackHoleMassLimitReion, 1, MPI_LONG, MPI_SUM, run_globals.mpi_comm);
-    if (prop == prop_stellar)
-      mlog("%d quasars are smaller than %g",
-         MLOG_MESG,
-         N_BlackHoleMassLimitReion,
-         run_globals.params.physics.BlackHoleMassLimitReion);
+    entry_value = trim_whitespace(entry_value);
+
+    if ((sep == NULL) && (*entry_value == '\0'))
+      continue;
+
+    char* end = NULL;
+    long entry_int = strtol(entry_value, &end, 10);
+    if ((end == entry_value) || (*end != '\0') || (*entry_name == '\0')) {
+      mlog_error("Unrecognised %s entry `%s' (expected name:value)!", param_name, original);
+      ABORT(EXIT_FAILURE);
+    }
+
+    if (strcmp(entry_name, grid_name) == 0)
+      return (int)entry_int;
+    else if (strcmp(entry_name, "*") == 0)
+      value = (int)entry_int;
   }
 
-  mlog("done", MLOG_CLOSE | MLOG_TIMERSTOP);
+  return value;
 }
 
+// HDF5 limits the size of a single chunk to 4 GB
+#define MAX_CHUNK_BYTES 4294967295ULL
+
 static void write_grid_float(const char* name,
                              float* data,
                              hid_t file_id,
@@ -1621,8 +1662,59 @@ static void write_grid_float(const char* name,
                              hid_t memspace_id,
                              hid_t dcpl_id)
 {
+  run_params_t* params = &(run_globals.params);
+  hid_t dset_dcpl_id = H5Pcopy(dcpl_id);
+
+  // the number of x-planes in each chunk
+  hsize_t chunk_dims[3];
+  H5Pget_chunk(dcpl_id, 3, chunk_dims);
+
+  // a single x-plane of a long light-cone can exceed the chunk size limit by itself
+  if (sizeof(float) * chunk_dims[1] * chunk_dims[2] > MAX_CHUNK_BYTES)
+    chunk_dims[2] = MAX_CHUNK_BYTES / (sizeof(float) * chunk_dims[1]);
+
+  hsize_t max_chunk_nx = MAX_CHUNK_BYTES / (sizeof(float) * chunk_dims[1] * chunk_dims[2]);
+  hsize_t dims[3];
+  H5Sget_simple_extent_dims(fspace_id, dims, NULL);
+  if (max_chunk_nx > dims[0])
+    max_chunk_nx = dims[0];
+
+  int chunk_nx = grid_output_option(params->GridChunkNx, "GridChunkNx", name, 1);
+  if (chunk_nx < 1)
+    chunk_nx = 1;
+  else if ((hsize_t)chunk_nx > max_chunk_nx) {
+    mlog("Reducing GridChunkNx of %s from %d to %d x-planes (the dataset extent or the HDF5 chunk size limit).",
+         MLOG_MESG,
+         name,
+         chunk_nx,
+         (int)max_chunk_nx);
+    chunk_nx = (int)max_chunk_nx;
+  }
+  chunk_dims[0] = (hsize_t)chunk_nx;
+  H5Pset_chunk(dset_dcpl_id, 3, chunk_dims);
+
+  // add any requested filters (N.B. parallel writes with filters require HDF5 >= 1.10.2)
+  int compression_level = grid_output_option(params->GridCompressionLevel, "GridCompressionLevel", name, 0);
+  if ((compression_level < 0) || (compression_level > 9)) {
+    mlog_error("GridCompressionLevel of %s must be between 0 and 9 (not %d)!", name, compression_level);
+    ABORT(EXIT_FAILURE);
+  }
+
+  // the number of decimal digits to keep (or -1 for lossless output)
+  int digits = grid_output_option(params->GridScaleOffsetDigits, "GridScaleOffsetDigits", name, -1);
+
+  if (digits >= 0)
+    H5Pset_scaleoffset(dset_dcpl_id, H5Z_SO_FLOAT_DSCALE, digits);
+  if (compression_level > 0) {
+    // the output of the scale-offset filter is already packed, so there's nothing to gain from shuffling it
+    if (digits < 0)
+      H5Pset_shuffle(dset_dcpl_id);
+    H5Pset_deflate(dset_dcpl_id, (unsigned)compression_level);
+  }
+
   // create the dataset
-  hid_t dset_id = H5Dcreate(file_id, name, H5T_NATIVE_FLOAT, fspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+  hid_t dset_id = H5Dcreate(file_id, name, H5T_NATIVE_FLOAT, fspace_id, H5P_DEFAULT, dset_dcpl_id, H5P_DEFAULT);
+  H5Pclose(dset_dcpl_id);
 
   // create the property list
   hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
@@ -1637,6 +1729,19 @@ static void write_grid_float(const char* name,
   H5Dclose(dset_id);
 }
 
+//! Describe the local slab of an FFTW padded (real-space, in-place) grid so that it can be written without a copy
+static hid_t create_padded_memspace(int local_nix, int dim)
+{
+  hsize_t mem_dims[3] = { (hsize_t)local_nix, (hsize_t)dim, (hsize_t)(2 * (dim / 2 + 1)) };
+  hid_t memspace_id = H5Screate_simple(3, mem_dims, NULL);
+
+  hsize_t start[3] = { 0, 0, 0 };
+  hsize_t count[3] = { (hsize_t)local_nix, (hsize_t)dim, (hsize_t)dim };
+  H5Sselect_hyperslab(memspace_id, H5S_SELECT_SET, start, NULL, count, NULL);
+
+  return memspace_id;
+}
+
 void gen_grids_fname(const int snapshot, char* name, const bool relative)
 {
   if (!relative)
@@ -1678,10 +1783,10 @@ void save_reion_input_grids(int snapshot)
   H5Sselect_hyperslab(fspace_id, H5S_SELECT_SET, start, NULL, count, NULL);
 
   // set the dataset creation property list to use chunking along x-axis
-  hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
-  H5Pset_chunk(dcpl_id, 3, (hsize_t[3]){ 1, (hsize_t)ReionGridDim, (hsize_t)ReionGridDim });
+  hid_t dcpl_id = create_grid_dcpl(ReionGridDim, ReionGridDim);
 
-  // fftw padded grids
+  // fftw padded grids are written directly, but those which need converting to output units go through a buffer
+  hid_t padded_memspace_id = create_padded_memspace(local_nix, ReionGridDim);
   float* grid = (float*)calloc((size_t)local_nix * (size_t)ReionGridDim * (size_t)ReionGridDim, sizeof(float));
 
   if (run_globals.params.Flag_IncludeSpinTemp) {
@@ -1703,19 +1808,8 @@ void save_reion_input_grids(int snapshot)
 #endif
   }
 
-  for (int ii = 0; ii < local_nix; ii++)
-    for (int jj = 0; jj < ReionGridDim; jj++)
-      for (int kk = 0; kk < ReionGridDim; kk++)
-        grid[grid_index(ii, jj, kk, ReionGridDim, INDEX_REAL)] =
-          (grids->deltax)[grid_index(ii, jj, kk, ReionGridDim, INDEX_PADDED)];
-  write_grid_float("deltax", grid, file_id, fspace_id, memspace_id, dcpl_id);
-
-  for (int ii = 0; ii < local_nix; ii++)
-    for (int jj = 0; jj < ReionGridDim; jj++)
-      for (int kk = 0; kk < ReionGridDim; kk++)
-        grid[grid_index(ii, jj, kk, ReionGridDim, INDEX_REAL)] =
-          (grids->stars)[grid_index(ii, jj, kk, ReionGridDim, INDEX_PADDED)];
-  write_grid_float("stars", grid, file_id, fspace_id, memspace_id, dcpl_id);
+  write_grid_float("deltax", grids->deltax, file_id, fspace_id, padded_memspace_id, dcpl_id);
+  write_grid_float("stars", grids->stars, file_id, fspace_id, padded_memspace_id, dcpl_id);
 
   for (int ii = 0; ii < local_nix; ii++)
     for (int jj = 0; jj < ReionGridDim; jj++)
@@ -1726,12 +1820,7 @@ void save_reion_input_grids(int snapshot)
   write_grid_float("weighted_sfr", grid, file_id, fspace_id, memspace_id, dcpl_id);
 
 #if USE_MINI_HALOS
-  for (int ii = 0; ii < local_nix; ii++)
-    for (int jj = 0; jj < ReionGridDim; jj++)
-      for (int kk = 0; kk < ReionGridDim; kk++)
-        grid[grid_index(ii, jj, kk, ReionGridDim, INDEX_REAL)] =
-          (grids->starsIII)[grid_index(ii, jj, kk, ReionGridDim, INDEX_PADDED)];
-  write_grid_float("starsIII", grid, file_id, fspace_id, memspace_id, dcpl_id);
+  write_grid_float("starsIII", grids->starsIII, file_id, fspace_id, padded_memspace_id, dcpl_id);
 
   for (int ii = 0; ii < local_nix; ii++)
     for (int jj = 0; jj < ReionGridDim; jj++)
@@ -1745,6 +1834,7 @@ void save_reion_input_grids(int snapshot)
   // tidy up
   free(grid);
   H5Pclose(dcpl_id);
+  H5Sclose(padded_memspace_id);
   H5Sclose(memspace_id);
   H5Sclose(fspace_id);
   H5Fclose(file_id);
@@ -1823,8 +1913,7 @@ void save_reion_output_grids(int snapshot)
   H5Sselect_hyperslab(fspace_id, H5S_SELECT_SET, start, NULL, count, NULL);
 
   // set the dataset creation property list to use chunking along x-axis
-  hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
-  H5Pset_chunk(dcpl_id, 3, (hsize_t[3]){ 1, (hsize_t)ReionGridDim, (hsize_t)ReionGridDim });
+  hid_t dcpl_id = create_grid_dcpl(ReionGridDim, ReionGridDim);
 
   // create and write the datasets
   write_grid_float("xH", grids->xH, file_id, fspace_id, memspace_id, dcpl_id);
@@ -1843,9 +1932,6 @@ void save_reion_output_grids(int snapshot)
 #endif
   }
 
-  // fftw padded grids
-  float* grid = (float*)calloc((size_t)(local_nix * ReionGridDim * ReionGridDim), sizeof(float));
-
 #if USE_MINI_HALOS
   if (run_globals.params.Flag_IncludeLymanWerner) {
     write_grid_float("JLW_box", grids->JLW_box, file_id, fspace_id, memspace_id, dcpl_id);
@@ -1861,13 +1947,10 @@ void save_reion_output_grids(int snapshot)
     write_grid_float("Tk_boxII", grids->Tk_boxII, file_id, fspace_id, memspace_id, dcpl_id);
 #endif
 
-    for (int ii = 0; ii < local_nix; ii++)
-      for (int jj = 0; jj < ReionGridDim; jj++)
-        for (int kk = 0; kk < ReionGridDim; kk++)
-          grid[grid_index(ii, jj, kk, ReionGridDim, INDEX_REAL)] =
-            (grids->x_e_box_prev)[grid_index(ii, jj, kk, ReionGridDim, INDEX_PADDED)];
-
-    write_grid_float("x_e_box", grid, file_id, fspace_id, memspace_id, dcpl_id);
+    // fftw padded grid
+    hid_t padded_memspace_id = create_padded_memspace(local_nix, ReionGridDim);
+    write_grid_float("x_e_box", grids->x_e_box_prev, file_id, fspace_id, padded_memspace_id, dcpl_id);
+    H5Sclose(padded_memspace_id);
   }
 
   if (run_globals.params.Flag_Compute21cmBrightTemp) {
@@ -1894,8 +1977,7 @@ void save_reion_output_grids(int snapshot)
     H5Sselect_hyperslab(fspace_id_LC, H5S_SELECT_SET, start_LC, NULL, count_LC, NULL);
 
     // set the dataset creation property list to use chunking along x-axis
-    hid_t dcpl_id_LC = H5Pcreate(H5P_DATASET_CREATE);
-    H5Pset_chunk(dcpl_id_LC, 3, (hsize_t[3]){ 1, (hsize_t)ReionGridDim, (hsize_t)run_globals.params.LightconeLength });
+    hid_t dcpl_id_LC = create_grid_dcpl(ReionGridDim, run_globals.params.LightconeLength);
 
     mlog("Outputting light-cone", MLOG_MESG);
     write_grid_float("LightconeBox", grids->LightconeBox, file_id, fspace_id_LC, memspace_id_LC, dcpl_id_LC);
@@ -2040,7 +2122,6 @@ void save_reion_output_grids(int snapshot)
   }
 
   // tidy up
-  free(grid);
   H5Pclose(dcpl_id);
   H5Sclose(memspace_id);
   H5Sclose(fspace_id);
@@ -2169,6 +2250,90 @@ void filter(fftwf_complex* box, int local_ix_start, int slab_nx, int grid_dim, f
   } // End looping through k box
 }
 
+void filtered_abs_sums(fftwf_complex** boxes,
+                       int n_boxes,
+                       int local_ix_start,
+                       int slab_nx,
+                       int grid_dim,
+                       float R,
+                       int filter_type,
+                       double* sums,
+                       double* dc_terms)
+{
+  // For each box, accumulates the sum of |W(kR)| |box_k| over all non-zero modes held by this rank into sums, where W
+  // is the window applied by filter(), and the real part of the zero mode into dc_terms.  Since the inverse transform
+  // of a filtered box is a sum over these modes, |dc_term| + sum (summed over all ranks) bounds the absolute value of
+  // every cell of the filtered real-space field without having to actually filter and transform it.
+  int middle = grid_dim / 2;
+  double box_size = run_globals.params.BoxSize;
+  double delta_k = 2.0 * M_PI / box_size;
+
+  for (int n_x = 0; n_x < slab_nx; n_x++) {
+    double k_x;
+    int n_x_global = n_x + local_ix_start;
+
+    if (n_x_global > middle)
+      k_x = (n_x_global - grid_dim) * delta_k;
+    else
+      k_x = n_x_global * delta_k;
+
+    for (int n_y = 0; n_y < grid_dim; n_y++) {
+      double k_y;
+
+      if (n_y > middle)
+        k_y = (n_y - grid_dim) * delta_k;
+      else
+        k_y = n_y * delta_k;
+
+      for (int n_z = 0; n_z <= middle; n_z++) {
+        int ind = grid_index(n_x, n_y, n_z, grid_dim, INDEX_COMPLEX_HERM);
+
+        if ((n_x_global == 0) && (n_y == 0) && (n_z == 0)) {
+          for (int ii = 0; ii < n_boxes; ii++)
+            dc_terms[ii] += crealf(boxes[ii][ind]);
+          continue;
+        }
+
+        double k_z = n_z * delta_k;
+        double kR = sqrt(k_x * k_x + k_y * k_y + k_z * k_z) * R;
+        double window = 1.0;
+
+        switch (filter_type) {
+          case 0: // Real space top-hat
+            if (kR > 1e-4)
+              window = fabs(3.0 * (sin(kR) / pow(kR, 3) - cos(kR) / pow(kR, 2)));
+            break;
+
+          case 1: // k-space top hat
+            if (kR * 0.413566994 > 1)
+              window = 0.0;
+            break;
+
+          case 2: // Gaussian
+            kR *= 0.643;
+            window = exp(-kR * kR / 2.0);
+            break;
+
+          default:
+            mlog_error("ReionFilterType.c: Warning, ReionFilterType type %d is undefined!", filter_type);
+            ABORT(EXIT_FAILURE);
+            break;
+        }
+
+        if (window == 0.0)
+          continue;
+
+        // modes with 0 < n_z < N/2 also stand in for their (unstored) Hermitian conjugates
+        if ((n_z > 0) && !((grid_dim % 2 == 0) && (n_z == middle)))
+          window *= 2.0;
+
+        for (int ii = 0; ii < n_boxes; ii++)
+          sums[ii] += window * cabsf(boxes[ii][ind]);
+      }
+    }
+  }
+}
+
 void velocity_gradient(fftwf_complex* box, int slab_nx, int grid_dim)
 {
   int middle = grid_dim / 2;
@@ -45,6 +45,7 @@ typedef struct gal_to_slab_t
   int index;
   struct galaxy_t* galaxy;
   int slab_ind;
+  int cell; //!< (real) grid cell index within the slab if FlagSortGalaxiesByCell is set, otherwise 0
 } gal_to_slab_t;
 
 #ifdef __cplusplus
@@ -56,11 +57,18 @@ extern "C"
   void set_quasar_fobs(void);
   void set_ReionEfficiency(void);
   void assign_slabs(void);
+  void reion_grids_footprint(ptrdiff_t slab_nix,
+                             ptrdiff_t slab_n_complex,
+                             size_t* grids_bytes,
+                             size_t* lightcone_bytes);
+  size_t galaxy_to_slab_map_bytes(int ngals);
+  void free_galaxy_to_slab_map(void);
   void call_find_HII_bubbles(int snapshot, int nout_gals, timer_info* timer);
   void call_ComputeTs(int snapshot, int nout_gals, timer_info* timer);
   void init_reion_grids(void);
   void malloc_reionization_grids(void);
   void free_reionization_grids(void);
+  int galaxy_slab_cell(struct galaxy_t* gal, int ix_local, int dim);
   int map_galaxies_to_slabs(int ngals);
   void assign_Mvir_crit_to_galaxies(int ngals_in_slabs, int flag_feed);
   void construct_baryon_grids(int snapshot, int ngals);
@@ -70,6 +78,15 @@ extern "C"
   void save_reion_output_grids(int snapshot);
   bool check_if_reionization_ongoing(int snapshot);
   void filter(fftwf_complex* box, int local_ix_start, int slab_nx, int grid_dim, float R, int filter_type);
+  void filtered_abs_sums(fftwf_complex** boxes,
+                         int n_boxes,
+                         int local_ix_start,
+                         int slab_nx,
+                         int grid_dim,
+                         float R,
+                         int filter_type,
+                         double* sums,
+                         double* dc_terms);
   void velocity_gradient(fftwf_complex* box, int slab_nx, int grid_dim);
 
 #ifdef __cplusplus
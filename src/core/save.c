@@ -1,8 +1,10 @@
 #include <assert.h>
 #include <hdf5_hl.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "magnitudes.h"
+#include "memory_budget.h"
 #include "meraxes.h"
 #include "parse_paramfile.h"
 #include "reionization.h"
@@ -11,6 +13,25 @@
 #include "metal_evo.h"
 #endif
 
+#define GALAXY_COLUMN_CHUNK_BYTES (1 << 20)
+
+// Output properties which are (relatively) expensive to calculate, and so are skipped if they aren't selected
+enum output_skip_flags
+{
+  OUTPUT_SKIP_MWMSA = 1 << 0,
+  OUTPUT_SKIP_NEWSTARS = 1 << 1,
+  OUTPUT_SKIP_MAGS = 1 << 2,
+  OUTPUT_SKIP_DUSTY_MAGS = 1 << 3,
+  OUTPUT_SKIP_MAGS_III = 1 << 4,
+  OUTPUT_SKIP_NEWSTARS_II = 1 << 5,
+  OUTPUT_SKIP_NEWSTARS_III = 1 << 6
+};
+
+// The galaxy properties written when OutputFields includes "minimal"
+static const char* minimal_output_fields[] = { "ID",  "HaloID", "Type",    "CentralGal", "GhostFlag",   "Pos",
+                                               "Vel", "Mvir",   "ColdGas", "HotGas",     "StellarMass", "Sfr",
+                                               "Rvir", "BlackHoleMass" };
+
 static float current_mwmsa(galaxy_t* gal, int i_snap)
 {
   double* LTTime = run_globals.LTTime;
@@ -26,102 +47,240 @@ static float current_mwmsa(galaxy_t* gal, int i_snap)
   return (float)((mwmsa_num / mwmsa_denom) - LTTime[snapshot]);
 }
 
-void prepare_galaxy_for_output(galaxy_t gal, galaxy_output_t* galout, int i_snap)
+// N.B. If dusty_mags is false the DustyMags are left untouched, so that they can be calculated in batches
+static void fill_galaxy_output(galaxy_t* gal, galaxy_output_t* galout, int i_snap, bool dusty_mags)
 {
   run_units_t* units = &(run_globals.units);
-
-  galout->ID = gal.ID;
-  galout->Type = gal.Type;
-  if (!gal.ghost_flag) {
-    galout->HaloID = (long long)gal.Halo->ID;
-    galout->CentralGal = gal.Halo->FOFGroup->FirstOccupiedHalo->Galaxy->output_index;
-    galout->FOFMvir = (float)(gal.Halo->FOFGroup->Mvir);
+  unsigned skip = run_globals.hdf5props.skip_fields;
+
+  galout->ID = gal->ID;
+  galout->Type = gal->Type;
+  if (!gal->ghost_flag) {
+    galout->HaloID = (long long)gal->Halo->ID;
+    galout->CentralGal = gal->Halo->FOFGroup->FirstOccupiedHalo->Galaxy->output_index;
+    galout->FOFMvir = (float)(gal->Halo->FOFGroup->Mvir);
   } else {
     galout->HaloID = -1;
     galout->CentralGal = -1;
     galout->FOFMvir = (float)-1.0;
   }
-  galout->GhostFlag = (int)gal.ghost_flag;
+  galout->GhostFlag = (int)gal->ghost_flag;
 
   for (int ii = 0; ii < 3; ii++) {
-    galout->Pos[ii] = gal.Pos[ii];
-    galout->Vel[ii] = gal.Vel[ii];
+    galout->Pos[ii] = gal->Pos[ii];
+    galout->Vel[ii] = gal->Vel[ii];
   }
 
-  galout->Len = gal.Len;
-  galout->MaxLen = gal.MaxLen;
-  galout->Mvir = (float)(gal.Mvir);
-  galout->Rvir = (float)(gal.Rvir);
-  galout->Vvir = (float)(gal.Vvir);
-  galout->Vmax = (float)(gal.Vmax);
-  galout->Spin = (float)(gal.Spin);
-  galout->HotGas = (float)(gal.HotGas);
-  galout->MetalsHotGas = (float)(gal.MetalsHotGas);
-  galout->ColdGas = (float)(gal.ColdGas);
-  galout->MetalsColdGas = (float)(gal.MetalsColdGas);
-  galout->H2Frac = (float)(gal.H2Frac);
-  galout->H2Mass = (float)(gal.H2Mass);
-  galout->HIMass = (float)(gal.HIMass);
-  galout->Mcool = (float)(gal.Mcool);
-  galout->StellarMass = (float)(gal.StellarMass);
-  galout->GrossStellarMass = (float)(gal.GrossStellarMass);
-  galout->Fesc = (float)(gal.Fesc);
-  galout->FescWeightedGSM = (float)(gal.FescWeightedGSM);
-  galout->BlackHoleMass = (float)(gal.BlackHoleMass);
-  galout->FescBH = (float)(gal.FescBH);
-  galout->BHemissivity = (float)(gal.BHemissivity);
-  galout->EffectiveBHM = (float)(gal.EffectiveBHM);
-  galout->BlackHoleAccretedHotMass = (float)(gal.BlackHoleAccretedHotMass);
-  galout->BlackHoleAccretedColdMass = (float)(gal.BlackHoleAccretedColdMass);
-  galout->DiskScaleLength = (float)(gal.DiskScaleLength);
-  galout->MetalsStellarMass = (float)(gal.MetalsStellarMass);
-  galout->Sfr = (float)(gal.Sfr * units->UnitMass_in_g / units->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS);
-  galout->EjectedGas = (float)(gal.EjectedGas);
-  galout->MetalsEjectedGas = (float)(gal.MetalsEjectedGas);
-  galout->Rcool = (float)(gal.Rcool);
-  galout->Cos_Inc = (float)(gal.Cos_Inc);
-  galout->BaryonFracModifier = (float)(gal.BaryonFracModifier);
-  galout->FOFMvirModifier = (float)(gal.FOFMvirModifier);
-  galout->MvirCrit = (float)(gal.MvirCrit);
-  galout->dt = (float)(gal.dt * units->UnitTime_in_Megayears);
-  galout->MergerBurstMass = (float)(gal.MergerBurstMass);
-  galout->MergTime = (float)(gal.MergTime * units->UnitTime_in_Megayears);
-  galout->MergerStartRadius = (float)(gal.MergerStartRadius);
-  galout->MWMSA = current_mwmsa(&gal, i_snap);
+  galout->Len = gal->Len;
+  galout->MaxLen = gal->MaxLen;
+  galout->Mvir = (float)(gal->Mvir);
+  galout->Rvir = (float)(gal->Rvir);
+  galout->Vvir = (float)(gal->Vvir);
+  galout->Vmax = (float)(gal->Vmax);
+  galout->Spin = (float)(gal->Spin);
+  galout->HotGas = (float)(gal->HotGas);
+  galout->MetalsHotGas = (float)(gal->MetalsHotGas);
+  galout->ColdGas = (float)(gal->ColdGas);
+  galout->MetalsColdGas = (float)(gal->MetalsColdGas);
+  galout->H2Frac = (float)(gal->H2Frac);
+  galout->H2Mass = (float)(gal->H2Mass);
+  galout->HIMass = (float)(gal->HIMass);
+  galout->Mcool = (float)(gal->Mcool);
+  galout->StellarMass = (float)(gal->StellarMass);
+  galout->GrossStellarMass = (float)(gal->GrossStellarMass);
+  galout->Fesc = (float)(gal->Fesc);
+  galout->FescWeightedGSM = (float)(gal->FescWeightedGSM);
+  galout->BlackHoleMass = (float)(gal->BlackHoleMass);
+  galout->FescBH = (float)(gal->FescBH);
+  galout->BHemissivity = (float)(gal->BHemissivity);
+  galout->EffectiveBHM = (float)(gal->EffectiveBHM);
+  galout->BlackHoleAccretedHotMass = (float)(gal->BlackHoleAccretedHotMass);
+  galout->BlackHoleAccretedColdMass = (float)(gal->BlackHoleAccretedColdMass);
+  galout->DiskScaleLength = (float)(gal->DiskScaleLength);
+  galout->MetalsStellarMass = (float)(gal->MetalsStellarMass);
+  galout->Sfr = (float)(gal->Sfr * units->UnitMass_in_g / units->UnitTime_in_s * SEC_PER_YEAR / SOLAR_MASS);
+  galout->EjectedGas = (float)(gal->EjectedGas);
+  galout->MetalsEjectedGas = (float)(gal->MetalsEjectedGas);
+  galout->Rcool = (float)(gal->Rcool);
+  galout->Cos_Inc = (float)(gal->Cos_Inc);
+  galout->BaryonFracModifier = (float)(gal->BaryonFracModifier);
+  galout->FOFMvirModifier = (float)(gal->FOFMvirModifier);
+  galout->MvirCrit = (float)(gal->MvirCrit);
+  galout->dt = (float)(gal->dt * units->UnitTime_in_Megayears);
+  galout->MergerBurstMass = (float)(gal->MergerBurstMass);
+  galout->MergTime = (float)(gal->MergTime * units->UnitTime_in_Megayears);
+  galout->MergerStartRadius = (float)(gal->MergerStartRadius);
+  if (!(skip & OUTPUT_SKIP_MWMSA))
+    galout->MWMSA = current_mwmsa(gal, i_snap);
 
 #if USE_MINI_HALOS
-  galout->GrossStellarMassIII = (float)(gal.GrossStellarMassIII);
-  galout->FescIII = (float)(gal.FescIII);
-  galout->FescIIIWeightedGSM = (float)(gal.FescIIIWeightedGSM);
-
-  galout->MvirCrit_MC = (float)(gal.MvirCrit_MC);
-
-  galout->RmetalBubble = (float)(gal.RmetalBubble); // new for MetalEvo
-  galout->Galaxy_Population = (int)(gal.Galaxy_Population);
-  galout->Flag_ExtMetEnr = (int)(gal.Flag_ExtMetEnr);
-  galout->Metal_Probability = (float)(gal.Metal_Probability);
-  galout->GalMetal_Probability = (float)(gal.GalMetal_Probability);
-  galout->StellarMass_II = (float)(gal.StellarMass_II);
-  galout->StellarMass_III = (float)(gal.StellarMass_III);
-  galout->Remnant_Mass = (float)(gal.Remnant_Mass);
+  galout->GrossStellarMassIII = (float)(gal->GrossStellarMassIII);
+  galout->FescIII = (float)(gal->FescIII);
+  galout->FescIIIWeightedGSM = (float)(gal->FescIIIWeightedGSM);
+
+  galout->MvirCrit_MC = (float)(gal->MvirCrit_MC);
+
+  galout->RmetalBubble = (float)(gal->RmetalBubble); // new for MetalEvo
+  galout->Galaxy_Population = (int)(gal->Galaxy_Population);
+  galout->Flag_ExtMetEnr = (int)(gal->Flag_ExtMetEnr);
+  galout->Metal_Probability = (float)(gal->Metal_Probability);
+  galout->GalMetal_Probability = (float)(gal->GalMetal_Probability);
+  galout->StellarMass_II = (float)(gal->StellarMass_II);
+  galout->StellarMass_III = (float)(gal->StellarMass_III);
+  galout->Remnant_Mass = (float)(gal->Remnant_Mass);
 #endif
 
-  for (int ii = 0; ii < N_HISTORY_SNAPS; ii++) {
-    galout->NewStars[ii] = (float)(gal.NewStars[ii]);
+  if (!(skip & OUTPUT_SKIP_NEWSTARS))
+    for (int ii = 0; ii < N_HISTORY_SNAPS; ii++)
+      galout->NewStars[ii] = (float)(gal->NewStars[ii]);
 #if USE_MINI_HALOS
-    galout->NewStars_III[ii] = (float)(gal.NewStars_III[ii]);
-    galout->NewStars_II[ii] = (float)(gal.NewStars_II[ii]);
+  if (!(skip & OUTPUT_SKIP_NEWSTARS_II))
+    for (int ii = 0; ii < N_HISTORY_SNAPS; ii++)
+      galout->NewStars_II[ii] = (float)(gal->NewStars_II[ii]);
+  if (!(skip & OUTPUT_SKIP_NEWSTARS_III))
+    for (int ii = 0; ii < N_HISTORY_SNAPS; ii++)
+      galout->NewStars_III[ii] = (float)(gal->NewStars_III[ii]);
 #endif
-  }
 
 #ifdef CALC_MAGS
-  get_output_magnitudes(galout->Mags, galout->DustyMags, &gal, run_globals.ListOutputSnaps[i_snap]);
+  dusty_mags = dusty_mags && !(skip & OUTPUT_SKIP_DUSTY_MAGS);
+  if (!(skip & OUTPUT_SKIP_MAGS) || dusty_mags)
+    get_output_magnitudes(
+      galout->Mags, dusty_mags ? galout->DustyMags : NULL, gal, run_globals.ListOutputSnaps[i_snap]);
 #if USE_MINI_HALOS
-  get_output_magnitudesIII(galout->MagsIII, &gal, run_globals.ListOutputSnaps[i_snap]);
+  if (!(skip & OUTPUT_SKIP_MAGS_III))
+    get_output_magnitudesIII(galout->MagsIII, gal, run_globals.ListOutputSnaps[i_snap]);
+#endif
+#else
+  (void)dusty_mags;
+#endif
+}
+
+void prepare_galaxy_for_output(galaxy_t* gal, galaxy_output_t* galout, int i_snap)
+{
+  fill_galaxy_output(gal, galout, i_snap, true);
+}
+
+#ifdef CALC_MAGS
+//! Calculate the dust attenuated magnitudes of a chunk of output galaxies in one go
+static void fill_dusty_magnitudes(galaxy_output_t* output_buffer, galaxy_t** gals, int n_gals, int i_snap)
+{
+  if (run_globals.hdf5props.skip_fields & OUTPUT_SKIP_DUSTY_MAGS)
+    return;
+
+  float* dusty_mags = malloc(sizeof(float) * MAGS_N_BANDS * (size_t)(n_gals > 0 ? n_gals : 1));
+
+  get_output_dusty_magnitudes(dusty_mags, gals, n_gals, run_globals.ListOutputSnaps[i_snap]);
+  for (int ii = 0; ii < n_gals; ii++)
+    memcpy(output_buffer[ii].DustyMags, dusty_mags + ii * MAGS_N_BANDS, sizeof(float) * MAGS_N_BANDS);
+
+  free(dusty_mags);
+}
 #endif
+
+//! Convert a batch of galaxies, read in place, straight into consecutive entries of an output buffer
+static void fill_galaxy_outputs(galaxy_t** gals, int n_gals, galaxy_output_t* output_buffer, int i_snap)
+{
+  for (int ii = 0; ii < n_gals; ii++)
+    fill_galaxy_output(gals[ii], &output_buffer[ii], i_snap, false);
+
+#ifdef CALC_MAGS
+  fill_dusty_magnitudes(output_buffer, gals, n_gals, i_snap);
 #endif
 }
 
+static bool output_field_requested(const char* name, const char* selection)
+{
+  char buffer[STRLEN];
+  bool requested = false;
+
+  strncpy(buffer, selection, STRLEN - 1);
+  buffer[STRLEN - 1] = '\0';
+
+  for (char* token = strtok(buffer, ", \t"); (token != NULL) && !requested; token = strtok(NULL, ", \t")) {
+    if (strcmp(token, "full") == 0)
+      requested = true;
+    else if (strcmp(token, "minimal") == 0) {
+      for (size_t ii = 0; ii < sizeof(minimal_output_fields) / sizeof(minimal_output_fields[0]); ii++)
+        if (strcmp(name, minimal_output_fields[ii]) == 0)
+          requested = true;
+    } else if (strcmp(token, name) == 0)
+      requested = true;
+  }
+
+  return requested;
+}
+
+//! Drop any galaxy properties which weren't requested by OutputFields and set up the layout of the output tables
+static void select_output_fields(hdf5_output_t* h5props)
+{
+  const char* selection = run_globals.params.OutputFields;
+  int n_all = h5props->n_props;
+
+  // check that every requested field exists
+  {
+    char buffer[STRLEN];
+    strncpy(buffer, selection, STRLEN - 1);
+    buffer[STRLEN - 1] = '\0';
+
+    for (char* token = strtok(buffer, ", \t"); token != NULL; token = strtok(NULL, ", \t")) {
+      bool found = (strcmp(token, "full") == 0) || (strcmp(token, "minimal") == 0);
+      for (int ii = 0; (ii < n_all) && !found; ii++)
+        found = (strcmp(token, h5props->field_names[ii]) == 0);
+      if (!found) {
+        mlog_error("Unrecognised galaxy property `%s' in OutputFields!", token);
+        ABORT(EXIT_FAILURE);
+      }
+    }
+  }
+
+  const char* skippable[] = { "MWMSA", "NewStars", "NewStarsPop2", "NewStarsPop3", "Mags", "DustyMags", "MagsIII" };
+  const unsigned skip_flags[] = { OUTPUT_SKIP_MWMSA,       OUTPUT_SKIP_NEWSTARS, OUTPUT_SKIP_NEWSTARS_II,
+                                  OUTPUT_SKIP_NEWSTARS_III, OUTPUT_SKIP_MAGS,     OUTPUT_SKIP_DUSTY_MAGS,
+                                  OUTPUT_SKIP_MAGS_III };
+  h5props->skip_fields = OUTPUT_SKIP_MWMSA | OUTPUT_SKIP_NEWSTARS | OUTPUT_SKIP_NEWSTARS_II | OUTPUT_SKIP_NEWSTARS_III |
+                         OUTPUT_SKIP_MAGS | OUTPUT_SKIP_DUSTY_MAGS | OUTPUT_SKIP_MAGS_III;
+
+  int n_props = 0;
+  for (int ii = 0; ii < n_all; ii++) {
+    if (!output_field_requested(h5props->field_names[ii], selection))
+      continue;
+
+    for (int jj = 0; jj < (int)(sizeof(skippable) / sizeof(skippable[0])); jj++)
+      if (strcmp(h5props->field_names[ii], skippable[jj]) == 0)
+        h5props->skip_fields &= ~skip_flags[jj];
+
+    h5props->dst_offsets[n_props] = h5props->dst_offsets[ii];
+    h5props->dst_field_sizes[n_props] = h5props->dst_field_sizes[ii];
+    h5props->field_names[n_props] = h5props->field_names[ii];
+    h5props->field_units[n_props] = h5props->field_units[ii];
+    h5props->field_h_conv[n_props] = h5props->field_h_conv[ii];
+    h5props->field_types[n_props] = h5props->field_types[ii];
+    n_props++;
+  }
+
+  if (n_props == 0) {
+    mlog_error("No galaxy properties selected for output (OutputFields = `%s')!", selection);
+    ABORT(EXIT_FAILURE);
+  }
+  h5props->n_props = n_props;
+
+  // If only some of the properties are written then the table records are packed so that the unwritten ones don't
+  // take up space in the file
+  h5props->table_offsets = malloc(sizeof(size_t) * n_props);
+  if (n_props == n_all) {
+    memcpy(h5props->table_offsets, h5props->dst_offsets, sizeof(size_t) * n_props);
+    h5props->table_size = h5props->dst_size;
+  } else {
+    h5props->table_size = 0;
+    for (int ii = 0; ii < n_props; ii++) {
+      h5props->table_offsets[ii] = h5props->table_size;
+      h5props->table_size += h5props->dst_field_sizes[ii];
+    }
+    mlog("Writing %d of %d galaxy properties", MLOG_MESG, n_props, n_all);
+  }
+}
+
 void calc_hdf5_props()
 {
   /*
@@ -134,6 +293,11 @@ void calc_hdf5_props()
     galaxy_output_t galout;
     int i; // dummy
 
+    if ((run_globals.params.OutputCompressionLevel < 0) || (run_globals.params.OutputCompressionLevel > 9)) {
+      mlog_error("OutputCompressionLevel must be between 0 and 9 (not %d)!", run_globals.params.OutputCompressionLevel);
+      ABORT(EXIT_FAILURE);
+    }
+
     h5props->n_props = 49;
 #if USE_MINI_HALOS
     h5props->n_props += 14; // Double check later
@@ -654,6 +818,8 @@ void calc_hdf5_props()
       mlog_error("Incorrect number of galaxy properties in HDF5 file. Should be %d, but is %d", h5props->n_props, i);
       ABORT(EXIT_FAILURE);
     }
+
+    select_output_fields(h5props);
   }
 }
 
@@ -893,7 +1059,12 @@ void create_master_file()
       H5Lcreate_external(relative_source_file, source_ds, group_id, "Galaxies", H5P_DEFAULT, H5P_DEFAULT);
 
       source_file_id = H5Fopen(source_file, H5F_ACC_RDONLY, H5P_DEFAULT);
-      H5TBget_table_info(source_file_id, source_ds, NULL, &core_n_gals);
+      if (run_globals.params.FlagColumnarOutput) {
+        int n_gals;
+        H5LTget_attribute_int(source_file_id, source_ds, "NGalaxies", &n_gals);
+        core_n_gals = (hsize_t)n_gals;
+      } else
+        H5TBget_table_info(source_file_id, source_ds, NULL, &core_n_gals);
       snap_n_gals += (int)core_n_gals;
 
       // if they exists, then also create a link to walk indices
@@ -984,7 +1155,8 @@ static inline void save_walk_indices(hid_t file_id,
 
     hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
     H5Pset_chunk(plist_id, 1, chunks);
-    H5Pset_deflate(plist_id, 6);
+    if (run_globals.params.OutputCompressionLevel > 0)
+      H5Pset_deflate(plist_id, (unsigned)run_globals.params.OutputCompressionLevel);
 
     hid_t dspace_id = H5Screate_simple(1, dim, NULL);
 
@@ -1019,7 +1191,8 @@ static inline void save_walk_indices(hid_t file_id,
 
     hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
     H5Pset_chunk(plist_id, 1, chunks);
-    H5Pset_deflate(plist_id, 6);
+    if (run_globals.params.OutputCompressionLevel > 0)
+      H5Pset_deflate(plist_id, (unsigned)run_globals.params.OutputCompressionLevel);
 
     H5Pset_chunk(plist_id, 1, chunks);
     hid_t dspace_id = H5Screate_simple(1, dim, NULL);
@@ -1054,6 +1227,130 @@ static inline bool pass_write_check(galaxy_t* gal, bool flag_merger)
     return false;
 }
 
+// Array properties (e.g. Pos, NewStars) are stored as 2D datasets of their base type in columnar output
+static hid_t galaxy_column_type(hid_t field_type, int* rank, hsize_t dims[2])
+{
+  if (H5Tget_class(field_type) == H5T_ARRAY) {
+    H5Tget_array_dims(field_type, &dims[1]);
+    *rank = 2;
+    return H5Tget_super(field_type);
+  }
+
+  dims[1] = 1;
+  *rank = 1;
+  return H5Tcopy(field_type);
+}
+
+static void create_galaxy_columns(hid_t group_id, int n_write)
+{
+  hdf5_output_t* h5props = &(run_globals.hdf5props);
+  int compression_level = run_globals.params.OutputCompressionLevel;
+
+  hid_t gals_group_id = H5Gcreate(group_id, "Galaxies", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  H5LTset_attribute_int(group_id, "Galaxies", "NGalaxies", &n_write, 1);
+
+  for (int ii = 0; ii < h5props->n_props; ii++) {
+    int rank;
+    hsize_t dims[2] = { (hsize_t)n_write, 1 };
+    hid_t dtype_id = galaxy_column_type(h5props->field_types[ii], &rank, dims);
+    hid_t dspace_id = H5Screate_simple(rank, dims, NULL);
+    hid_t plist_id = H5Pcreate(H5P_DATASET_CREATE);
+
+    if (n_write > 0) {
+      // Aim for chunks of ~1 MB, but no larger than the column itself
+      hsize_t chunks[2] = { (hsize_t)(GALAXY_COLUMN_CHUNK_BYTES / h5props->dst_field_sizes[ii]), dims[1] };
+      if (chunks[0] > dims[0])
+        chunks[0] = dims[0];
+      if (chunks[0] < 1)
+        chunks[0] = 1;
+      H5Pset_chunk(plist_id, rank, chunks);
+
+      if (compression_level > 0) {
+        H5Pset_shuffle(plist_id);
+        H5Pset_deflate(plist_id, (unsigned)compression_level);
+      }
+    }
+
+    hid_t dset_id =
+      H5Dcreate(gals_group_id, h5props->field_names[ii], dtype_id, dspace_id, H5P_DEFAULT, plist_id, H5P_DEFAULT);
+
+    H5Dclose(dset_id);
+    H5Pclose(plist_id);
+    H5Sclose(dspace_id);
+    H5Tclose(dtype_id);
+  }
+
+  H5Gclose(gals_group_id);
+}
+
+static void write_galaxy_columns(hid_t group_id,
+                                 const galaxy_output_t* output_buffer,
+                                 int offset,
+                                 int n_gals,
+                                 char* column_buffer)
+{
+  hdf5_output_t* h5props = &(run_globals.hdf5props);
+  hid_t gals_group_id = H5Gopen(group_id, "Galaxies", H5P_DEFAULT);
+
+  for (int ii = 0; ii < h5props->n_props; ii++) {
+    size_t field_size = h5props->dst_field_sizes[ii];
+    const char* src = (const char*)output_buffer + h5props->dst_offsets[ii];
+
+    // gather this property from every galaxy in the buffer
+    for (int i_gal = 0; i_gal < n_gals; i_gal++, src += h5props->dst_size)
+      memcpy(column_buffer + (size_t)i_gal * field_size, src, field_size);
+
+    int rank;
+    hsize_t dims[2] = { (hsize_t)n_gals, 1 };
+    hid_t dtype_id = galaxy_column_type(h5props->field_types[ii], &rank, dims);
+    hsize_t start[2] = { (hsize_t)offset, 0 };
+
+    hid_t dset_id = H5Dopen(gals_group_id, h5props->field_names[ii], H5P_DEFAULT);
+    hid_t fspace_id = H5Dget_space(dset_id);
+    hid_t memspace_id = H5Screate_simple(rank, dims, NULL);
+    H5Sselect_hyperslab(fspace_id, H5S_SELECT_SET, start, NULL, dims, NULL);
+
+    H5Dwrite(dset_id, dtype_id, memspace_id, fspace_id, H5P_DEFAULT, column_buffer);
+
+    H5Sclose(memspace_id);
+    H5Sclose(fspace_id);
+    H5Dclose(dset_id);
+    H5Tclose(dtype_id);
+  }
+
+  H5Gclose(gals_group_id);
+}
+
+static void write_galaxy_table(hid_t group_id,
+                               const galaxy_output_t* output_buffer,
+                               int offset,
+                               int n_gals,
+                               char* record_buffer)
+{
+  hdf5_output_t* h5props = &(run_globals.hdf5props);
+  const void* records = output_buffer;
+
+  if (h5props->table_size != h5props->dst_size) {
+    // pack the selected properties of each galaxy into contiguous records
+    for (int i_gal = 0; i_gal < n_gals; i_gal++) {
+      const char* src = (const char*)&output_buffer[i_gal];
+      char* dest = record_buffer + (size_t)i_gal * h5props->table_size;
+      for (int ii = 0; ii < h5props->n_props; ii++)
+        memcpy(dest + h5props->table_offsets[ii], src + h5props->dst_offsets[ii], h5props->dst_field_sizes[ii]);
+    }
+    records = record_buffer;
+  }
+
+  H5TBwrite_records(group_id,
+                    "Galaxies",
+                    (hsize_t)offset,
+                    (hsize_t)n_gals,
+                    h5props->table_size,
+                    h5props->table_offsets,
+                    h5props->dst_field_sizes,
+                    records);
+}
+
 void write_snapshot(int n_write, int i_out, int* last_n_write)
 {
   /*
@@ -1075,6 +1372,9 @@ void write_snapshot(int n_write, int i_out, int* last_n_write)
   int calc_descendants_i_out = -1;
   int prev_snapshot = -1;
   int write_count = 0;
+  bool columnar = run_globals.params.FlagColumnarOutput;
+  char* write_buffer = NULL;
+  size_t write_buffer_size = 0;
 
   mlog("Writing output file (n_write = %d)...", MLOG_OPEN | MLOG_TIMERSTART, n_write);
 
@@ -1104,20 +1404,23 @@ void write_snapshot(int n_write, int i_out, int* last_n_write)
   if ((int)chunk_size < n_write)
     chunk_size = (hsize_t)n_write;
 
-  // Make the table
-  H5TBmake_table("Galaxies",
-                 group_id,
-                 "Galaxies",
-                 (hsize_t)h5props.n_props,
-                 (hsize_t)n_write,
-                 h5props.dst_size,
-                 h5props.field_names,
-                 h5props.dst_offsets,
-                 h5props.field_types,
-                 chunk_size,
-                 fill_data,
-                 1,
-                 NULL);
+  // Make the table (or one dataset per property)
+  if (columnar)
+    create_galaxy_columns(group_id, n_write);
+  else
+    H5TBmake_table("Galaxies",
+                   group_id,
+                   "Galaxies",
+                   (hsize_t)h5props.n_props,
+                   (hsize_t)n_write,
+                   h5props.table_size,
+                   h5props.field_names,
+                   h5props.table_offsets,
+                   h5props.field_types,
+                   chunk_size,
+                   fill_data,
+                   run_globals.params.OutputCompressionLevel > 0,
+                   NULL);
 
   // If the immediately preceding snapshot was also written, then save the
   // descendent indices
@@ -1225,22 +1528,32 @@ void write_snapshot(int n_write, int i_out, int* last_n_write)
   gal_count = 0;
   gal = run_globals.FirstGal;
   output_buffer = calloc((int)chunk_size, sizeof(galaxy_output_t));
+  mem_track(MEM_OUTPUT, (ptrdiff_t)(chunk_size * sizeof(galaxy_output_t)));
+  galaxy_t** buffer_gals = malloc(sizeof(galaxy_t*) * (size_t)chunk_size);
+  // scratch space for gathering a single property (columnar output) or packing the selected properties (tables)
+  if (columnar) {
+    size_t max_field_size = 0;
+    for (int ii = 0; ii < h5props.n_props; ii++)
+      if (h5props.dst_field_sizes[ii] > max_field_size)
+        max_field_size = h5props.dst_field_sizes[ii];
+    write_buffer_size = max_field_size * (size_t)chunk_size;
+  } else if (h5props.table_size != h5props.dst_size)
+    write_buffer_size = h5props.table_size * (size_t)chunk_size;
+  if (write_buffer_size > 0) {
+    write_buffer = malloc(write_buffer_size);
+    mem_track(MEM_OUTPUT, (ptrdiff_t)write_buffer_size);
+  }
   int buffer_count = 0;
   while (gal != NULL) {
     // Don't output galaxies which merged at this timestep
-    if (pass_write_check(gal, false)) {
-      prepare_galaxy_for_output(*gal, &(output_buffer[buffer_count]), i_out);
-      buffer_count++;
-    }
+    if (pass_write_check(gal, false))
+      buffer_gals[buffer_count++] = gal;
     if (buffer_count == (int)chunk_size) {
-      H5TBwrite_records(group_id,
-                        "Galaxies",
-                        (hsize_t)gal_count,
-                        (hsize_t)buffer_count,
-                        h5props.dst_size,
-                        h5props.dst_offsets,
-                        h5props.dst_field_sizes,
-                        output_buffer);
+      fill_galaxy_outputs(buffer_gals, buffer_count, output_buffer, i_out);
+      if (columnar)
+        write_galaxy_columns(group_id, output_buffer, gal_count, buffer_count, write_buffer);
+      else
+        write_galaxy_table(group_id, output_buffer, gal_count, buffer_count, write_buffer);
       gal_count += buffer_count;
       buffer_count = 0;
     }
@@ -1249,14 +1562,11 @@ void write_snapshot(int n_write, int i_out, int* last_n_write)
 
   // Write any remaining galaxies in the buffer
   if (buffer_count > 0) {
-    H5TBwrite_records(group_id,
-                      "Galaxies",
-                      (hsize_t)gal_count,
-                      (hsize_t)buffer_count,
-                      h5props.dst_size,
-                      h5props.dst_offsets,
-                      h5props.dst_field_sizes,
-                      output_buffer);
+    fill_galaxy_outputs(buffer_gals, buffer_count, output_buffer, i_out);
+    if (columnar)
+      write_galaxy_columns(group_id, output_buffer, gal_count, buffer_count, write_buffer);
+    else
+      write_galaxy_table(group_id, output_buffer, gal_count, buffer_count, write_buffer);
     gal_count += buffer_count;
   }
 
@@ -1267,7 +1577,10 @@ void write_snapshot(int n_write, int i_out, int* last_n_write)
   }
 
   // Free the output buffer
+  free(buffer_gals);
+  free(write_buffer);
   free(output_buffer);
+  mem_track(MEM_OUTPUT, -(ptrdiff_t)(chunk_size * sizeof(galaxy_output_t) + write_buffer_size));
 
   if (run_globals.params.Flag_PatchyReion && check_if_reionization_ongoing(run_globals.ListOutputSnaps[i_out]) &&
       (run_globals.params.Flag_OutputGrids))
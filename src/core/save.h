@@ -100,7 +100,7 @@ extern "C"
 {
 #endif
 
-  void prepare_galaxy_for_output(struct galaxy_t gal, galaxy_output_t* galout, int i_snap);
+  void prepare_galaxy_for_output(struct galaxy_t* gal, galaxy_output_t* galout, int i_snap);
   void calc_hdf5_props(void);
   void prep_hdf5_file(void);
   void create_master_file(void);
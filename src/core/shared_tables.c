@@ -0,0 +1,211 @@
+#include <string.h>
+
+#include "meraxes.h"
+#include "shared_tables.h"
+
+/*
+ * Storage for large read-only tables which are identical on every rank (e.g. the photometric templates and the
+ * stellar feedback tables).
+ *
+ * By default every rank holds its own copy of each table.  If FlagSharedTables is set, each table is instead held once
+ * per node in an MPI-3 shared memory window.  The first rank of each node is the only one which writes to it: tables
+ * read by rank 0 are broadcast between the first ranks of each node, and tables computed from them are only computed
+ * by the first rank of each node.
+ *
+ * N.B. All of these functions (except is_shared_table_writer) are collective over run_globals.mpi_comm.
+ */
+
+typedef struct shared_table_t
+{
+  void* data;
+  MPI_Win win;
+} shared_table_t;
+
+static struct
+{
+  MPI_Comm node_comm;   //!< the ranks on this node
+  MPI_Comm leader_comm; //!< the first rank of each node (MPI_COMM_NULL on the other ranks)
+  shared_table_t* tables;
+  int n_tables;
+  int node_rank;
+} shared_tables = { MPI_COMM_NULL, MPI_COMM_NULL, NULL, 0, 0 };
+
+// MPI counts are ints, so large tables are broadcast in pieces
+#define SHARED_TABLE_BCAST_BYTES (1 << 30)
+
+void init_shared_tables(void)
+{
+  if (!run_globals.params.FlagSharedTables)
+    return;
+
+  MPI_Comm_split_type(
+    run_globals.mpi_comm, MPI_COMM_TYPE_SHARED, run_globals.mpi_rank, MPI_INFO_NULL, &shared_tables.node_comm);
+  MPI_Comm_rank(shared_tables.node_comm, &shared_tables.node_rank);
+
+  // N.B. The first rank of each node has the lowest rank on that node, so rank 0 is also rank 0 of leader_comm
+  MPI_Comm_split(run_globals.mpi_comm,
+                 shared_tables.node_rank == 0 ? 0 : MPI_UNDEFINED,
+                 run_globals.mpi_rank,
+                 &shared_tables.leader_comm);
+
+  int n_nodes = (shared_tables.node_rank == 0) ? 1 : 0;
+  MPI_Allreduce(MPI_IN_PLACE, &n_nodes, 1, MPI_INT, MPI_SUM, run_globals.mpi_comm);
+  mlog("Read-only tables will be shared between the ranks of each of %d node(s).", MLOG_MESG, n_nodes);
+}
+
+//! Allocate a table of n_bytes (only filled in by ranks for which is_shared_table_writer is true)
+void* alloc_shared_table(size_t n_bytes)
+{
+  shared_table_t table = { NULL, MPI_WIN_NULL };
+
+  if (shared_tables.node_comm == MPI_COMM_NULL)
+    table.data = malloc(n_bytes > 0 ? n_bytes : 1);
+  else {
+    MPI_Aint win_size = (shared_tables.node_rank == 0) ? (MPI_Aint)n_bytes : 0;
+    MPI_Win_allocate_shared(win_size, 1, MPI_INFO_NULL, shared_tables.node_comm, &table.data, &table.win);
+
+    if (shared_tables.node_rank != 0) {
+      int disp_unit = 0;
+      MPI_Win_shared_query(table.win, 0, &win_size, &disp_unit, &table.data);
+    }
+
+    // the windows stay in a passive target epoch until they are freed
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, table.win);
+  }
+
+  if (table.data == NULL) {
+    mlog_error("Failed to allocate a table of %zu bytes!", n_bytes);
+    ABORT(EXIT_FAILURE);
+  }
+
+  shared_tables.tables =
+    realloc(shared_tables.tables, sizeof(shared_table_t) * (size_t)(shared_tables.n_tables + 1));
+  shared_tables.tables[shared_tables.n_tables++] = table;
+
+  return table.data;
+}
+
+//! Should this rank fill in the tables?
+bool is_shared_table_writer(void)
+{
+  return (shared_tables.node_comm == MPI_COMM_NULL) || (shared_tables.node_rank == 0);
+}
+
+static shared_table_t* find_table(void* data)
+{
+  for (int ii = 0; ii < shared_tables.n_tables; ii++)
+    if (shared_tables.tables[ii].data == data)
+      return &shared_tables.tables[ii];
+
+  mlog_error("Unknown shared table!");
+  ABORT(EXIT_FAILURE);
+  return NULL;
+}
+
+//! Make the contents of a table written by its writers visible to all of the ranks which share it
+void sync_shared_table(void* table)
+{
+  shared_table_t* entry = find_table(table);
+
+  if (entry->win != MPI_WIN_NULL) {
+    MPI_Win_sync(entry->win);
+    MPI_Barrier(shared_tables.node_comm);
+    MPI_Win_sync(entry->win);
+  }
+}
+
+//! Copy a table filled in by rank 0 to all other ranks
+void share_table(void* table, size_t n_bytes)
+{
+  MPI_Comm comm = run_globals.mpi_comm;
+  if (shared_tables.node_comm != MPI_COMM_NULL)
+    comm = shared_tables.leader_comm;
+
+  if (comm != MPI_COMM_NULL)
+    for (size_t offset = 0; offset < n_bytes; offset += SHARED_TABLE_BCAST_BYTES) {
+      size_t n_chunk = (n_bytes - offset < SHARED_TABLE_BCAST_BYTES) ? n_bytes - offset : SHARED_TABLE_BCAST_BYTES;
+      MPI_Bcast((char*)table + offset, (int)n_chunk, MPI_BYTE, 0, comm);
+    }
+
+  sync_shared_table(table);
+}
+
+void free_shared_table(void* table)
+{
+  if (table == NULL)
+    return;
+
+  shared_table_t* entry = find_table(table);
+
+  if (entry->win != MPI_WIN_NULL) {
+    MPI_Win_unlock_all(entry->win);
+    MPI_Win_free(&entry->win);
+  } else
+    free(entry->data);
+
+  *entry = shared_tables.tables[--shared_tables.n_tables];
+}
+
+void free_shared_tables(void)
+{
+  while (shared_tables.n_tables > 0)
+    free_shared_table(shared_tables.tables[shared_tables.n_tables - 1].data);
+
+  free(shared_tables.tables);
+  shared_tables.tables = NULL;
+
+  if (shared_tables.leader_comm != MPI_COMM_NULL)
+    MPI_Comm_free(&shared_tables.leader_comm);
+  if (shared_tables.node_comm != MPI_COMM_NULL)
+    MPI_Comm_free(&shared_tables.node_comm);
+}
+
+static unsigned long hash_bytes(const void* data, size_t n_bytes, unsigned long hash)
+{
+  const unsigned char* bytes = data;
+  for (size_t ii = 0; ii < n_bytes; ii++)
+    hash = hash * 33 + (unsigned long)bytes[ii];
+  return hash;
+}
+
+//! Split the processes on this node into groups with identical keys (collective over MPI_COMM_WORLD)
+// Used by the node-shared input caches, whose processes can only share their data if everything which determines it
+// (the key) agrees exactly.  Keys should be zeroed before they are filled in so that any padding and the unused bytes
+// of strings are identical on every process.
+MPI_Comm create_shared_cache_comm(const void* key, size_t n_bytes)
+{
+  MPI_Comm node_comm;
+  int world_rank = 0;
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, world_rank, MPI_INFO_NULL, &node_comm);
+
+  // A first split on a hash of the key...
+  MPI_Comm hash_comm;
+  unsigned long hash = hash_bytes(key, n_bytes, 5381);
+  MPI_Comm_split(node_comm, (int)(hash & 0x7fffffff), world_rank, &hash_comm);
+  MPI_Comm_free(&node_comm);
+
+  // ...and then an exact comparison of the full keys, in case of hash collisions.  Each process joins the group of the
+  // first process with an identical key.
+  int hash_rank = 0;
+  int hash_size = 0;
+  MPI_Comm_rank(hash_comm, &hash_rank);
+  MPI_Comm_size(hash_comm, &hash_size);
+
+  char* keys = malloc(n_bytes * (size_t)hash_size);
+  MPI_Allgather(key, (int)n_bytes, MPI_BYTE, keys, (int)n_bytes, MPI_BYTE, hash_comm);
+
+  int color = hash_rank;
+  for (int ii = 0; ii < hash_rank; ii++)
+    if (memcmp(keys + n_bytes * (size_t)ii, key, n_bytes) == 0) {
+      color = ii;
+      break;
+    }
+  free(keys);
+
+  MPI_Comm cache_comm;
+  MPI_Comm_split(hash_comm, color, hash_rank, &cache_comm);
+  MPI_Comm_free(&hash_comm);
+
+  return cache_comm;
+}
@@ -0,0 +1,26 @@
+#ifndef SHARED_TABLES_H
+#define SHARED_TABLES_H
+
+#include <mpi.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+  void init_shared_tables(void);
+  void* alloc_shared_table(size_t n_bytes);
+  bool is_shared_table_writer(void);
+  void share_table(void* table, size_t n_bytes);
+  void sync_shared_table(void* table);
+  void free_shared_table(void* table);
+  void free_shared_tables(void);
+  MPI_Comm create_shared_cache_comm(const void* key, size_t n_bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,15 +3,17 @@
 
 #include "meraxes.h"
 #include "misc_tools.h"
+#include "shared_tables.h"
 #include "stellar_feedback.h"
 #if USE_MINI_HALOS
 #include "PopIII.h"
 #endif
 
-static double age[NAGE];
-static double yield_tables[NELEMENT][NMETAL * NAGE];
+// N.B. age, yield_tables and energy_tables are read-only and all live in a single (possibly node-shared) table
+static double* age = NULL;
+static double (*yield_tables)[NMETAL * NAGE] = NULL;
 static double yield_tables_working[N_HISTORY_SNAPS][NMETAL][NELEMENT];
-static double energy_tables[NMETAL * NAGE];
+static double* energy_tables = NULL;
 static double energy_tables_working[N_HISTORY_SNAPS][NMETAL];
 
 static void check_n_history_snaps(void)
@@ -70,6 +72,11 @@ static void check_n_history_snaps(void)
 
 void read_stellar_feedback_tables(void)
 {
+  size_t n_bytes = sizeof(double) * (NAGE + (size_t)(NELEMENT + 1) * NMETAL * NAGE);
+  age = alloc_shared_table(n_bytes);
+  yield_tables = (double(*)[NMETAL * NAGE])(age + NAGE);
+  energy_tables = yield_tables[NELEMENT];
+
   if (run_globals.mpi_rank == 0) {
     hid_t fd;
     char fname[STRLEN];
@@ -95,9 +102,7 @@ void read_stellar_feedback_tables(void)
   }
 
   // Broadcast the values to all cores
-  MPI_Bcast(age, sizeof(age), MPI_BYTE, 0, run_globals.mpi_comm);
-  MPI_Bcast(yield_tables, sizeof(yield_tables), MPI_BYTE, 0, run_globals.mpi_comm);
-  MPI_Bcast(energy_tables, sizeof(energy_tables), MPI_BYTE, 0, run_globals.mpi_comm);
+  share_table(age, n_bytes);
 }
 
 void compute_stellar_feedback_tables(int snapshot)
@@ -237,6 +237,7 @@ typedef struct run_params_t
   char MassRatioModifier[STRLEN];
   char BaryonFracModifier[STRLEN];
   char FFTW3WisdomDir[STRLEN];
+  int FFTW3PlanRigor;
 
   physics_params_t physics;
 
@@ -299,6 +300,22 @@ typedef struct run_params_t
   int Flag_OutputGrids;
   int Flag_OutputGridsPostReion;
   int FlagIgnoreProgIndex;
+  int FlagMemoryReport;
+  int FlagMemoryDryRun;
+  int FlagSharedGridsCache;
+  int FlagSharedHaloCache;
+  int MCMCResumeInterval;
+  int FlagCompressCaches;
+  double CacheGridsTolerance;
+  int FlagSortGalaxiesByCell;
+  int FlagColumnarOutput;
+  int OutputCompressionLevel;
+  char OutputFields[STRLEN];
+  char GridChunkNx[STRLEN];
+  char GridCompressionLevel[STRLEN];
+  char GridScaleOffsetDigits[STRLEN];
+  char ForestCacheDir[STRLEN];
+  int FlagSharedTables;
 } run_params_t;
 
 typedef struct run_units_t
@@ -322,16 +339,19 @@ typedef struct hdf5_output_t
   int* params_type;
   size_t* dst_offsets;
   size_t* dst_field_sizes;
+  size_t* table_offsets;
   const char** field_names;
   const char** field_units;
   const char** field_h_conv;
   hid_t* field_types;
   size_t dst_size;
+  size_t table_size;
   hid_t array3f_tid; // sizeof(hid_t) = 4
   hid_t array_nmag_f_tid;
   hid_t array_nhist_f_tid;
   int n_props;
   int params_count;
+  unsigned skip_fields;
 
   // TOTAL : 52 + 4 padding (must be multiple of 8)
 } hdf5_output_t;
@@ -519,25 +539,27 @@ typedef struct reion_grids_t
   int started;
   int finished;
   int buffer_size;
-  bool flag_wisdom;
 } reion_grids_t;
 
+// Storage type of the star formation histories.  In single precision each stored value carries a relative rounding
+// error of ~6e-8, and the values are only ever summed into doubles.
+#ifdef FLOAT_SF_HISTORIES
+typedef float sf_history_t;
+#else
+typedef double sf_history_t;
+#endif
+
 typedef struct galaxy_t
 {
-  double NewStars[N_HISTORY_SNAPS];
+  sf_history_t NewStars[N_HISTORY_SNAPS];
 #if USE_MINI_HALOS
-  double NewStars_II[N_HISTORY_SNAPS]; // New
-  double NewStars_III[N_HISTORY_SNAPS];
+  sf_history_t NewStars_II[N_HISTORY_SNAPS]; // New
+  sf_history_t NewStars_III[N_HISTORY_SNAPS];
 #endif
-  double NewMetals[N_HISTORY_SNAPS];
+  sf_history_t NewMetals[N_HISTORY_SNAPS];
 
 #ifdef CALC_MAGS
-  double inBCFlux[MAGS_N];
-  double outBCFlux[MAGS_N];
-#if USE_MINI_HALOS
-  double inBCFluxIII[MAGS_N];
-  double outBCFluxIII[MAGS_N];
-#endif
+  int LumIndex; //!< entry in the luminosity store (see magnitudes.c), -1 if the galaxy has never formed stars
 #endif
 
   // Unique ID for the galaxy
@@ -799,6 +821,7 @@ typedef struct run_globals_t
   int NRequestedForests;
   int NStoreSnapshots;
   int NstoreSnapshots_SFR;
+  int FirstEvolvedSnapshot; //!< the first snapshot evolved by this call (> 0 if an MCMC call resumed)
 
   bool SelectForestsSwitch;
   struct Modifier* mass_ratio_modifier;
@@ -835,10 +858,12 @@ extern "C"
 
   // core/magnitudes.c
   void get_output_magnitudes(float* mags, float* dusty_mags, galaxy_t* gal, int snapshot);
+  void get_output_dusty_magnitudes(float* dusty_mags, galaxy_t** gals, int n_gals, int snapshot);
   void get_output_magnitudesIII(float* mags, galaxy_t* gal, int snapshot);
 
 // MCMC related
 // meraxes_mhysa_hook must be implemented by the calling code (Mhysa)!
+// N.B. If MCMCResumeInterval is set, it is only called for snapshots >= run_globals.FirstEvolvedSnapshot
 #ifdef _MAIN
   int (*meraxes_mhysa_hook)(void* self, int snapshot, int ngals);
 #else
@@ -0,0 +1,67 @@
+#define _MAIN
+#include "../core/cache_codec.h"
+#include <criterion/criterion.h>
+#include <criterion/parameterized.h>
+#include <math.h>
+#include <meraxes.h>
+
+#define N_FLOATS 100000
+
+static float* values = NULL;
+
+// A density-like field: mostly small values around zero with a long positive tail
+void setup(void)
+{
+  unsigned int state = 12345;
+  values = malloc(sizeof(float) * N_FLOATS);
+
+  for (int ii = 0; ii < N_FLOATS; ii++) {
+    state = state * 1103515245u + 12345u;
+    double uniform = (double)(state >> 8) / (double)(1u << 24);
+    values[ii] = (float)(exp(8.0 * uniform * uniform) - 1.5);
+  }
+}
+
+void teardown(void)
+{
+  free(values);
+}
+
+static double max_round_trip_error(double tolerance)
+{
+  void* block = NULL;
+  float* decoded = malloc(sizeof(float) * N_FLOATS);
+  double max_error = 0.0;
+
+  compress_cache_floats(values, N_FLOATS, tolerance, &block);
+  decompress_cache_floats(block, decoded, N_FLOATS);
+
+  for (int ii = 0; ii < N_FLOATS; ii++) {
+    double error = fabs((double)decoded[ii] - (double)values[ii]);
+    if (error > max_error)
+      max_error = error;
+  }
+
+  free(decoded);
+  free(block);
+  return max_error;
+}
+
+TestSuite(cache_codec, .init = setup, .fini = teardown);
+
+Test(cache_codec, lossless)
+{
+  cr_expect_eq(max_round_trip_error(0.0), 0.0);
+}
+
+ParameterizedTestParameters(cache_codec, lossy_bound)
+{
+  static double tolerances[] = { 1e-1, 1e-3, 1e-5, 1e-7 };
+  return cr_make_param_array(double, tolerances, 4);
+}
+
+ParameterizedTest(double* tolerance, cache_codec, lossy_bound, .init = setup, .fini = teardown)
+{
+  double max_error = max_round_trip_error(*tolerance);
+  cr_expect(max_error <= *tolerance, "max error %g exceeds the tolerance %g", max_error, *tolerance);
+}